@@ -0,0 +1,118 @@
+#include "HttpHelper.h"
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+#include "freertos/task.h"
+
+static const char* TAG = "Http Async >>> ";
+
+typedef struct {
+    uint32_t id;
+    http_async_type_t type;
+    http_client_config config;
+    http_async_callback_t callback;
+    void* ctx;
+} http_async_job_t;
+
+static QueueHandle_t job_queue = NULL;
+static uint32_t last_request_id = 0;
+static portMUX_TYPE request_id_lock = portMUX_INITIALIZER_UNLOCKED;
+
+static http_client_json_response run_job(http_async_job_t* job) {
+    switch (job->type) {
+        case HTTP_ASYNC_REQUEST:
+            return http_client_request(job->config);
+        case HTTP_ASYNC_UPLOAD:
+            return http_client_upload(job->config);
+        case HTTP_ASYNC_DOWNLOAD:
+            return http_client_download(job->config);
+    }
+
+    ESP_LOGE(TAG, "unknown request type %d", job->type);
+    return (http_client_json_response)JSON_RESPONSE_NULL();
+}
+
+static void http_async_worker(void* arg) {
+    http_async_job_t job;
+
+    while (true) {
+        if (xQueueReceive(job_queue, &job, portMAX_DELAY) != pdTRUE) {
+            continue;
+        }
+
+        ESP_LOGI(TAG, "request %ld started [%s]", (long)job.id, job.config.url);
+
+        http_client_json_response response = run_job(&job);
+
+        http_async_result_t result = {
+            .request_id = job.id,
+            .type = job.type,
+            .http_status_code = response.http_status_code,
+            .json = response.json,
+        };
+
+        // the callback is the only owner of the json, event handlers may be several or none
+        if (job.callback != NULL) {
+            job.callback(&result, job.ctx);
+        } else {
+            cJSON_Delete(result.json);
+        }
+        result.json = NULL;
+
+        // completion must not be dropped
+        esp_event_post(HTTP_EVENT, HTTP_REQUEST_DONE, &result, sizeof(result), portMAX_DELAY);
+    }
+}
+
+void http_async_init(http_async_config_t config) {
+    if (job_queue != NULL) {
+        ESP_LOGI(TAG, "async workers already running");
+        return;
+    }
+
+    job_queue = xQueueCreate(config.queue_length, sizeof(http_async_job_t));
+    if (job_queue == NULL) {
+        ESP_LOGE(TAG, "Failed to create request queue of %d", config.queue_length);
+        return;
+    }
+
+    for (int i = 0; i < config.worker_count; i++) {
+        char name[configMAX_TASK_NAME_LEN];
+        snprintf(name, sizeof(name), "http_async_%d", i);
+
+        if (xTaskCreatePinnedToCore(&http_async_worker, name, config.stack_size, NULL, config.priority, NULL, config.core_id) != pdPASS) {
+            ESP_LOGE(TAG, "Failed to start worker %d", i);
+        }
+    }
+
+    ESP_LOGI(TAG, "%d worker(s) started on core %d", config.worker_count, config.core_id);
+}
+
+uint32_t http_async_submit(http_async_type_t type, http_client_config config, http_async_callback_t callback, void* ctx) {
+    if (job_queue == NULL) {
+        ESP_LOGE(TAG, "async workers not initialized");
+        return 0;
+    }
+
+    http_async_job_t job = {
+        .type = type,
+        .config = config,
+        .callback = callback,
+        .ctx = ctx,
+    };
+
+    portENTER_CRITICAL(&request_id_lock);
+    job.id = ++last_request_id;
+    if (job.id == 0) {
+        job.id = ++last_request_id;
+    }
+    portEXIT_CRITICAL(&request_id_lock);
+
+    // never block the caller, it is usually an audio or event task
+    if (xQueueSend(job_queue, &job, 0) != pdTRUE) {
+        ESP_LOGE(TAG, "request queue full, request [%s] dropped", config.url);
+        return 0;
+    }
+
+    return job.id;
+}
@@ -0,0 +1,250 @@
+#include "HttpInternal.h"
+#include "HttpPool.h"
+#include "esp_timer.h"
+#include "zlib.h"
+
+static const char* TAG = "Http Compress >>> ";
+
+#define COMPRESS_IN_SIZE (4 * 1024)
+#define COMPRESS_OUT_SIZE (4 * 1024)
+
+typedef struct {
+    z_stream stream;
+    esp_http_client_handle_t client;  // NULL only counts the output, used by the benchmark
+    uint8_t* out;
+    uint32_t raw_bytes;
+    uint32_t compressed_bytes;
+    uint32_t raw_total;
+    uint32_t progress_step;
+    uint32_t next_progress;
+    bool local_failed;  // deflate or the file read failed, not the network
+} compressor_t;
+
+static bool compressor_init(compressor_t* c, http_compression_t compression) {
+    int window_bits = compression.window_bits;
+    if (compression.type == HTTP_COMPRESSION_GZIP) {
+        window_bits += 16;
+    }
+
+    memset(&c->stream, 0, sizeof(c->stream));
+    if (deflateInit2(&c->stream, compression.level, Z_DEFLATED, window_bits, compression.mem_level, Z_DEFAULT_STRATEGY) != Z_OK) {
+        ESP_LOGE(TAG, "Failed to init compressor, level %d window %d mem %d",
+                 compression.level, compression.window_bits, compression.mem_level);
+        return false;
+    }
+
+    c->out = malloc(COMPRESS_OUT_SIZE);
+    if (c->out == NULL) {
+        ESP_LOGE(TAG, "Failed to allocate compressor output (%d bytes)", COMPRESS_OUT_SIZE);
+        deflateEnd(&c->stream);
+        return false;
+    }
+
+    return true;
+}
+
+static void compressor_end(compressor_t* c) {
+    deflateEnd(&c->stream);
+    free(c->out);
+}
+
+// compresses data and sends every full output block as one chunk
+static bool compressor_feed(compressor_t* c, const uint8_t* data, uint32_t len, int flush) {
+    c->stream.next_in = (Bytef*)data;
+    c->stream.avail_in = len;
+
+    int ret;
+    do {
+        c->stream.next_out = c->out;
+        c->stream.avail_out = COMPRESS_OUT_SIZE;
+
+        ret = deflate(&c->stream, flush);
+        if (ret == Z_STREAM_ERROR) {
+            ESP_LOGE(TAG, "deflate failed");
+            c->local_failed = true;
+            return false;
+        }
+
+        int have = COMPRESS_OUT_SIZE - c->stream.avail_out;
+        if (c->client != NULL && !http_write_chunk(c->client, (const char*)c->out, have)) {
+            ESP_LOGE(TAG, "Failed to send compressed chunk");
+            return false;
+        }
+        c->compressed_bytes += have;
+    } while (c->stream.avail_out == 0);
+
+    c->raw_bytes += len;
+    http_report_progress(c->raw_bytes, c->raw_total, c->progress_step, &c->next_progress);
+
+    return flush != Z_FINISH || ret == Z_STREAM_END;
+}
+
+static bool compress_segments(compressor_t* c, const http_client_upload_segment_t* segments, int segment_count) {
+    for (int i = 0; i < segment_count; i++) {
+        if (!compressor_feed(c, segments[i].data, segments[i].size, Z_NO_FLUSH)) {
+            return false;
+        }
+    }
+
+    return compressor_feed(c, NULL, 0, Z_FINISH);
+}
+
+static bool compress_file(compressor_t* c, FILE* file) {
+    uint8_t* in = malloc(COMPRESS_IN_SIZE);
+    if (in == NULL) {
+        ESP_LOGE(TAG, "Failed to allocate compressor input (%d bytes)", COMPRESS_IN_SIZE);
+        c->local_failed = true;
+        return false;
+    }
+
+    bool ok = true;
+    size_t bytes_read;
+    while (ok && (bytes_read = fread(in, 1, COMPRESS_IN_SIZE, file)) > 0) {
+        ok = compressor_feed(c, in, bytes_read, Z_NO_FLUSH);
+    }
+
+    if (ok && ferror(file)) {
+        ESP_LOGE(TAG, "Failed to read upload file");
+        c->local_failed = true;
+        ok = false;
+    }
+    ok = ok && compressor_feed(c, NULL, 0, Z_FINISH);
+
+    free(in);
+
+    return ok;
+}
+
+http_client_json_response http_client_upload_compressed(http_client_config client_config) {
+    http_client_json_response response = JSON_RESPONSE_NULL();
+    http_compression_t compression = client_config.upload.compression;
+    http_client_upload_buffer_t buffer_config = client_config.upload.buffer_config;
+
+    http_client_upload_segment_t single_segment = {
+        .data = buffer_config.data_buffer,
+        .size = buffer_config.data_buffer_size,
+    };
+    const http_client_upload_segment_t* segments = buffer_config.segments;
+    int segment_count = buffer_config.segment_count;
+    if (segments == NULL) {
+        segments = &single_segment;
+        segment_count = 1;
+    }
+
+    compressor_t compressor = {
+        .progress_step = client_config.upload.progress_step,
+    };
+
+    FILE* file = NULL;
+    if (client_config.upload.file_config.path != NULL) {
+        file = fopen(client_config.upload.file_config.path, "rb");
+        if (file == NULL) {
+            ESP_LOGE(TAG, "Failed to open file for reading");
+            return http_local_error();
+        }
+
+        fseek(file, 0, SEEK_END);
+        compressor.raw_total = ftell(file);
+        fseek(file, 0, SEEK_SET);
+    } else {
+        for (int i = 0; i < segment_count; i++) {
+            compressor.raw_total += segments[i].size;
+        }
+    }
+
+    if (compressor.raw_total == 0) {
+        ESP_LOGE(TAG, "Provided data buffer is empty or invalid");
+        if (file != NULL) {
+            fclose(file);
+        }
+        return http_local_error();
+    }
+
+    if (!compressor_init(&compressor, compression)) {
+        if (file != NULL) {
+            fclose(file);
+        }
+        return http_local_error();
+    }
+
+    http_client_header_t encoding_header = {
+        .key = "Content-Encoding",
+        .value = compression.type == HTTP_COMPRESSION_GZIP ? "gzip" : "deflate",
+    };
+
+    ESP_LOGI(TAG, "Init http connection [%s], %s level %d", client_config.url, encoding_header.value, compression.level);
+
+    compressor.client = open_connection(client_config, -1, &encoding_header, 1);
+    if (compressor.client == NULL) {
+        compressor_end(&compressor);
+        if (file != NULL) {
+            fclose(file);
+        }
+        return response;
+    }
+
+    int64_t start = esp_timer_get_time();
+    bool ok = file != NULL ? compress_file(&compressor, file) : compress_segments(&compressor, segments, segment_count);
+    ok = ok && http_finish_chunks(compressor.client);
+
+    if (file != NULL) {
+        fclose(file);
+    }
+    compressor_end(&compressor);
+
+    if (!ok) {
+        ESP_LOGE(TAG, "compressed upload failed after %ld bytes", (long)compressor.raw_bytes);
+        http_metrics_error(compressor.client);
+        http_pool_release(compressor.client, false);
+        return compressor.local_failed ? http_local_error() : response;
+    }
+
+    ESP_LOGI(TAG, "upload done: %ld bytes sent as %ld", (long)compressor.raw_bytes, (long)compressor.compressed_bytes);
+    http_metrics_record(compressor.client, HTTP_PHASE_UPLOAD, start, compressor.compressed_bytes);
+
+    if (client_config.response_handler.type != NONE) {
+        response = read_json_response(client_config.response_handler, compressor.client);
+    } else {
+        response = read_status_response(compressor.client);
+    }
+
+    http_pool_release(compressor.client, response.http_status_code > 0);
+
+    return response;
+}
+
+esp_err_t http_compress_benchmark(const uint8_t* data, uint32_t size, http_compression_t compression, http_compress_stats_t* stats) {
+    if (data == NULL || size == 0 || stats == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    compressor_t compressor = {
+        .raw_total = size,
+    };
+
+    if (!compressor_init(&compressor, compression)) {
+        return ESP_FAIL;
+    }
+
+    int64_t start = esp_timer_get_time();
+    bool ok = compressor_feed(&compressor, data, size, Z_FINISH);
+    int64_t duration = esp_timer_get_time() - start;
+
+    compressor_end(&compressor);
+
+    if (!ok) {
+        return ESP_FAIL;
+    }
+
+    stats->input_bytes = size;
+    stats->output_bytes = compressor.compressed_bytes;
+    stats->ratio = compressor.compressed_bytes > 0 ? (float)size / compressor.compressed_bytes : 0;
+    stats->throughput_kbps = duration > 0 ? (size / 1024.0f) / (duration / 1000000.0f) : 0;
+    stats->duration_us = duration;
+
+    ESP_LOGI(TAG, "level %d window %d: %ld -> %ld bytes, ratio %.2f, %.1f KB/s",
+             compression.level, compression.window_bits, (long)size, (long)stats->output_bytes,
+             stats->ratio, stats->throughput_kbps);
+
+    return ESP_OK;
+}
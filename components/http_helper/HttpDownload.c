@@ -0,0 +1,589 @@
+#include <errno.h>
+#include <strings.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "HttpInternal.h"
+#include "HttpPool.h"
+#include "esp_heap_caps.h"
+#include "esp_rom_crc.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+#include "mbedtls/sha256.h"
+
+static const char* TAG = "Http Download >>> ";
+
+#define DOWNLOAD_STATE_MAGIC 0x32534c44  // "DLS2"
+#define DOWNLOAD_PATH_MAX 128
+#define DOWNLOAD_VALIDATOR_MAX 64
+
+// progress of every range, kept next to the file as "<name>.dl" so a download can resume.
+// the validator is the ETag, or Last-Modified without one, of the version being downloaded
+typedef struct {
+    uint32_t magic;
+    uint32_t count;
+    int64_t total;
+    int64_t next[HTTP_DOWNLOAD_MAX_CONNECTIONS];  // next byte to fetch
+    int64_t end[HTTP_DOWNLOAD_MAX_CONNECTIONS];   // last byte of the range, -1 when open ended
+    char validator[DOWNLOAD_VALIDATOR_MAX];
+} download_state_t;
+
+typedef struct {
+    http_client_config config;
+    http_download_options_t options;
+    FILE* file;
+    char state_path[DOWNLOAD_PATH_MAX];
+    download_state_t state;
+    SemaphoreHandle_t lock;
+    SemaphoreHandle_t done;
+    uint32_t unsaved;   // bytes written since the last checkpoint
+    bool checkpointing; // one range saves the state at a time, the others keep writing
+    bool failed;
+    bool resumed;      // the ranges continue a partial file
+    bool changed;      // the file changed on the server, the partial file is dropped
+    bool local_failed; // the card or memory failed, retrying the transfer would not help
+    int error_status;  // unexpected status of a failed range, 0 when the transfer broke off
+    int status_code;
+} download_job_t;
+
+typedef struct {
+    download_job_t* job;
+    int index;
+} download_range_arg_t;
+
+// --------------------- validators ----------------------------------------
+static void response_validator(esp_http_client_handle_t client, char* validator) {
+    http_pool_response_info_t info;
+    http_pool_response_info(client, &info);
+
+    const char* value = info.etag[0] != '\0' ? info.etag : info.last_modified;
+    strncpy(validator, value, DOWNLOAD_VALIDATOR_MAX - 1);
+    validator[DOWNLOAD_VALIDATOR_MAX - 1] = '\0';
+}
+
+// "bytes <first>-<last>/<total>" or "bytes */<total>", -1 for a part that is missing or "*"
+static void response_range(esp_http_client_handle_t client, int64_t* first, int64_t* total) {
+    http_pool_response_info_t info;
+    http_pool_response_info(client, &info);
+
+    *first = -1;
+    *total = -1;
+
+    const char* value = info.content_range;
+    if (strncasecmp(value, "bytes ", 6) != 0) {
+        return;
+    }
+    value += 6;
+
+    if (*value != '*') {
+        *first = strtoll(value, NULL, 10);
+    }
+
+    const char* slash = strchr(value, '/');
+    if (slash != NULL && slash[1] != '*') {
+        *total = strtoll(slash + 1, NULL, 10);
+    }
+}
+
+// --------------------- state file ----------------------------------------
+// a state without a validator is never resumed, nothing would tell a newer version apart.
+// total < 0 accepts any total
+static bool load_state(download_job_t* job, int64_t total, int count, const char* validator) {
+    FILE* f = fopen(job->state_path, "rb");
+    if (f == NULL) {
+        return false;
+    }
+
+    download_state_t state;
+    bool valid = fread(&state, sizeof(state), 1, f) == 1 &&
+                 state.magic == DOWNLOAD_STATE_MAGIC &&
+                 (total < 0 || state.total == total) &&
+                 state.count == count &&
+                 state.validator[0] != '\0' &&
+                 (validator == NULL || strcmp(state.validator, validator) == 0);
+    fclose(f);
+
+    if (valid) {
+        job->state = state;
+    }
+
+    return valid;
+}
+
+// runs without the job lock, the data is synced first so the saved state never runs ahead of the file.
+// the file is unbuffered, so every write reported in state has already reached the FAT driver
+static void save_state(download_job_t* job, const download_state_t* state) {
+    fsync(fileno(job->file));
+
+    // rewritten in place, recreating it every time would churn the FAT
+    FILE* f = fopen(job->state_path, "r+b");
+    if (f == NULL) {
+        f = fopen(job->state_path, "wb");
+    }
+    if (f == NULL) {
+        ESP_LOGW(TAG, "Failed to save download state %s", job->state_path);
+        return;
+    }
+
+    fwrite(state, sizeof(*state), 1, f);
+    fflush(f);
+    fsync(fileno(f));
+    fclose(f);
+}
+
+// --------------------- range transfer ----------------------------------------
+static bool flush_range(download_job_t* job, int index, const char* buffer, size_t len) {
+    bool ok = true;
+    bool checkpoint = false;
+    download_state_t state;
+
+    xSemaphoreTake(job->lock, portMAX_DELAY);
+
+    if (fseek(job->file, job->state.next[index], SEEK_SET) != 0 ||
+        fwrite(buffer, 1, len, job->file) != len) {
+        ESP_LOGE(TAG, "Failed to write %d bytes at %jd (errno %d)", (int)len, job->state.next[index], errno);
+        ok = false;
+    } else {
+        job->state.next[index] += len;
+        job->unsaved += len;
+
+        if (job->state.count > 1 && job->unsaved >= job->options.checkpoint_bytes && !job->checkpointing) {
+            job->checkpointing = true;
+            job->unsaved = 0;
+            state = job->state;
+            checkpoint = true;
+        }
+    }
+
+    xSemaphoreGive(job->lock);
+
+    if (checkpoint) {
+        save_state(job, &state);
+
+        xSemaphoreTake(job->lock, portMAX_DELAY);
+        job->checkpointing = false;
+        xSemaphoreGive(job->lock);
+    }
+
+    return ok;
+}
+
+static char* alloc_buffer(size_t size) {
+    // DMA capable memory lets the SD driver write without a bounce buffer
+    char* buffer = heap_caps_aligned_alloc(4, size, MALLOC_CAP_DMA);
+    if (buffer == NULL) {
+        buffer = heap_caps_aligned_alloc(4, size, MALLOC_CAP_DEFAULT);
+    }
+
+    return buffer;
+}
+
+static bool download_range(download_job_t* job, int index) {
+    int64_t start = job->state.next[index];
+    int64_t end = job->state.end[index];
+
+    if (end >= 0 && start > end) {
+        return true;
+    }
+
+    char range[48];
+    if (end >= 0) {
+        snprintf(range, sizeof(range), "bytes=%jd-%jd", start, end);
+    } else {
+        snprintf(range, sizeof(range), "bytes=%jd-", start);
+    }
+
+    // with If-Range a server whose file changed answers with the whole new file instead of a part of it
+    http_client_header_t headers[2] = {
+        {.key = "Range", .value = range},
+        {.key = "If-Range", .value = job->state.validator},
+    };
+    bool ranged = start > 0 || end >= 0;
+    int header_count = !ranged ? 0 : job->state.validator[0] != '\0' ? 2 : 1;
+
+    esp_http_client_handle_t client = open_connection(job->config, 0, headers, header_count);
+    if (client == NULL) {
+        return false;
+    }
+
+    int64_t content_length = http_fetch_headers(client);
+    int status_code = esp_http_client_get_status_code(client);
+    int64_t range_first;
+    int64_t range_total;
+    response_range(client, &range_first, &range_total);
+
+    if (status_code == 416 && end < 0) {
+        http_pool_release(client, true);
+
+        // complete only when the server's size is exactly what is on the card
+        if (range_total >= 0 && range_total == start) {
+            ESP_LOGI(TAG, "nothing left to download past %jd", start);
+            job->status_code = 200;
+            return true;
+        }
+
+        ESP_LOGW(TAG, "local file of %jd bytes does not match the server size %jd, restarting", start, range_total);
+        ftruncate(fileno(job->file), 0);
+        job->state.next[index] = 0;
+        job->state.validator[0] = '\0';
+        return download_range(job, index);
+    }
+
+    if (status_code == 200 && ranged) {
+        if (job->state.count > 1) {
+            if (job->resumed) {
+                ESP_LOGW(TAG, "file changed on the server, the partial download is dropped");
+                job->changed = true;
+            } else {
+                ESP_LOGE(TAG, "server ignored the range request, use a single connection");
+                job->local_failed = true;
+            }
+            http_pool_release(client, false);
+            return false;
+        }
+
+        // server ignored the range or the file changed, start over
+        ESP_LOGW(TAG, "full response to a range request, restarting from 0");
+        xSemaphoreTake(job->lock, portMAX_DELAY);
+        ftruncate(fileno(job->file), 0);
+        job->state.next[index] = 0;
+        xSemaphoreGive(job->lock);
+        start = 0;
+    } else if (status_code == 206) {
+        // a part of another version or at another offset must not be stitched into the file.
+        // an unpooled handle does not see the header, both are -1 then
+        if ((range_first >= 0 && range_first != start) ||
+            (range_total >= 0 && job->state.total >= 0 && range_total != job->state.total)) {
+            ESP_LOGE(TAG, "Content-Range %jd of %jd does not match %jd of %jd", range_first, range_total, start,
+                     job->state.total);
+            job->changed = true;
+            http_pool_release(client, false);
+            return false;
+        }
+    } else if (status_code != 200) {
+        ESP_LOGE(TAG, "unexpected status %d for range %s", status_code, range);
+        job->error_status = status_code;
+        http_pool_release(client, false);
+        return false;
+    }
+
+    // a single connection download keeps the validator of what it fetches from 0 for a later resume
+    if (status_code == 200 && job->state.count == 1) {
+        response_validator(client, job->state.validator);
+        job->state.total = content_length;
+        if (job->state.validator[0] != '\0') {
+            save_state(job, &job->state);
+        } else {
+            unlink(job->state_path);
+        }
+    }
+
+    job->status_code = status_code;
+    ESP_LOGI(TAG, "range %d: %s, %jd bytes", index, ranged ? range : "full", content_length);
+
+    size_t buffer_size = job->options.buffer_size;
+    char* buffer = alloc_buffer(buffer_size);
+    if (buffer == NULL) {
+        ESP_LOGE(TAG, "Failed to allocate buffer (%d bytes)", (int)buffer_size);
+        job->local_failed = true;
+        http_pool_release(client, false);
+        return false;
+    }
+
+    // the first write only fills up to the next buffer boundary, every later write is cluster aligned
+    size_t limit = buffer_size - (size_t)(start % buffer_size);
+    size_t filled = 0;
+    int64_t range_start = job->state.next[index];
+    int64_t start_us = esp_timer_get_time();
+    int read_len = 0;
+    bool ok = true;
+
+    while (ok) {
+        read_len = esp_http_client_read(client, buffer + filled, limit - filled);
+        if (read_len <= 0) {
+            break;
+        }
+
+        filled += read_len;
+        if (filled == limit) {
+            ok = flush_range(job, index, buffer, filled);
+            filled = 0;
+            limit = buffer_size;
+        }
+    }
+
+    if (ok && filled > 0) {
+        ok = flush_range(job, index, buffer, filled);
+    }
+
+    heap_caps_free(buffer);
+
+    if (!ok) {
+        job->local_failed = true;
+    }
+
+    ok = ok && read_len == 0 && esp_http_client_is_complete_data_received(client);
+    if (ok && end >= 0 && job->state.next[index] != end + 1) {
+        ESP_LOGE(TAG, "range %d ended at %jd, expected %jd", index, job->state.next[index], end + 1);
+        ok = false;
+    }
+
+    if (ok) {
+        http_metrics_record(client, HTTP_PHASE_DOWNLOAD, start_us, job->state.next[index] - range_start);
+    } else {
+        http_metrics_error(client);
+    }
+
+    http_pool_release(client, ok);
+
+    return ok;
+}
+
+static void download_range_task(void* arg) {
+    download_range_arg_t* range = (download_range_arg_t*)arg;
+
+    if (!download_range(range->job, range->index)) {
+        range->job->failed = true;
+    }
+
+    xSemaphoreGive(range->job->done);
+    vTaskDelete(NULL);
+}
+
+static int64_t probe_length(http_client_config config, char* validator) {
+    config.method = HTTP_METHOD_HEAD;
+    validator[0] = '\0';
+
+    esp_http_client_handle_t client = init_connection(config, 0);
+    if (client == NULL) {
+        return -1;
+    }
+
+    int64_t content_length = http_fetch_headers(client);
+    int status_code = esp_http_client_get_status_code(client);
+    response_validator(client, validator);
+
+    // a HEAD response has no body to drain, so the connection is not pooled
+    http_pool_release(client, false);
+
+    return status_code == 200 ? content_length : -1;
+}
+
+// --------------------- integrity ----------------------------------------
+static bool verify_file(const char* path, http_download_options_t options) {
+    if (options.verify == HTTP_DOWNLOAD_VERIFY_NONE) {
+        return true;
+    }
+
+    if (options.expected_digest == NULL) {
+        ESP_LOGE(TAG, "no expected digest provided");
+        return false;
+    }
+
+    FILE* f = fopen(path, "rb");
+    char* buffer = alloc_buffer(options.buffer_size);
+    if (f == NULL || buffer == NULL) {
+        ESP_LOGE(TAG, "Failed to open %s for verification", path);
+        if (f != NULL) {
+            fclose(f);
+        }
+        heap_caps_free(buffer);
+        return false;
+    }
+
+    mbedtls_sha256_context sha;
+    uint32_t crc = 0;
+    size_t read_len;
+
+    mbedtls_sha256_init(&sha);
+    mbedtls_sha256_starts(&sha, 0);
+
+    while ((read_len = fread(buffer, 1, options.buffer_size, f)) > 0) {
+        if (options.verify == HTTP_DOWNLOAD_VERIFY_SHA256) {
+            mbedtls_sha256_update(&sha, (const unsigned char*)buffer, read_len);
+        } else {
+            crc = esp_rom_crc32_le(crc, (const uint8_t*)buffer, read_len);
+        }
+    }
+
+    fclose(f);
+    heap_caps_free(buffer);
+
+    char digest[65];
+    if (options.verify == HTTP_DOWNLOAD_VERIFY_SHA256) {
+        unsigned char hash[32];
+        mbedtls_sha256_finish(&sha, hash);
+        for (int i = 0; i < sizeof(hash); i++) {
+            sprintf(digest + i * 2, "%02x", hash[i]);
+        }
+    } else {
+        sprintf(digest, "%08lx", (unsigned long)crc);
+    }
+    mbedtls_sha256_free(&sha);
+
+    if (strcasecmp(digest, options.expected_digest) != 0) {
+        ESP_LOGE(TAG, "integrity check failed for %s: got %s expected %s", path, digest, options.expected_digest);
+        return false;
+    }
+
+    ESP_LOGI(TAG, "integrity check passed for %s", path);
+    return true;
+}
+
+// --------------------- download engine ----------------------------------------
+static http_client_json_response download_ranged_once(http_client_config config, void* ctx) {
+    http_download_options_t options = *(http_download_options_t*)ctx;
+    http_client_json_response response = JSON_RESPONSE_NULL();
+    const char* path = config.download.file_config.path;
+
+    if (path == NULL || options.cluster_size == 0) {
+        ESP_LOGE(TAG, "Invalid download configuration");
+        return http_local_error();
+    }
+
+    download_job_t job = {
+        .config = config,
+        .options = options,
+    };
+
+    // the extension is swapped rather than appended so the name stays 8.3 without long file names
+    if (sdcard_path_swap_ext(path, "dl", job.state_path, sizeof(job.state_path)) != ESP_OK) {
+        return http_local_error();
+    }
+
+    // round the buffer up to whole clusters
+    job.options.buffer_size = ((options.buffer_size + options.cluster_size - 1) / options.cluster_size) * options.cluster_size;
+    if (job.options.buffer_size == 0) {
+        job.options.buffer_size = options.cluster_size;
+    }
+
+    int count = options.connections;
+    if (count > HTTP_DOWNLOAD_MAX_CONNECTIONS) {
+        count = HTTP_DOWNLOAD_MAX_CONNECTIONS;
+    }
+
+    int64_t total = -1;
+    char validator[DOWNLOAD_VALIDATOR_MAX] = "";
+    if (count > 1) {
+        total = probe_length(config, validator);
+        if (total < (int64_t)count * job.options.buffer_size) {
+            ESP_LOGW(TAG, "size %jd unknown or too small for %d ranges, using one connection", total, count);
+            count = 1;
+        }
+    }
+
+    bool existing = false;
+    if (count > 1) {
+        existing = options.resume && load_state(&job, total, count, validator);
+        if (!existing) {
+            job.state.magic = DOWNLOAD_STATE_MAGIC;
+            job.state.count = count;
+            job.state.total = total;
+            for (int i = 0; i < count; i++) {
+                job.state.next[i] = total * i / count;
+                job.state.end[i] = total * (i + 1) / count - 1;
+            }
+            strcpy(job.state.validator, validator);
+        }
+    } else {
+        // the validator saved by the first attempt goes out in If-Range, the server decides if it still matches
+        struct stat st;
+        existing = options.resume && load_state(&job, -1, 1, NULL) && stat(path, &st) == 0 && st.st_size > 0;
+
+        if (!existing) {
+            memset(&job.state, 0, sizeof(job.state));
+            job.state.magic = DOWNLOAD_STATE_MAGIC;
+            job.state.count = 1;
+            job.state.total = -1;
+            unlink(job.state_path);
+        }
+        job.state.next[0] = existing ? st.st_size : 0;
+        job.state.end[0] = -1;
+    }
+    job.resumed = existing;
+
+    if (existing) {
+        ESP_LOGI(TAG, "resuming download of %s", path);
+    }
+
+    job.file = fopen(path, existing ? "r+b" : "w+b");
+    if (job.file == NULL) {
+        ESP_LOGE(TAG, "Failed to open file %s for writing", path);
+        return http_local_error();
+    }
+
+    // writes come in whole cluster buffers, stdio buffering would only add a copy and would
+    // keep data out of the fsync of a checkpoint taken on another range task
+    setvbuf(job.file, NULL, _IONBF, 0);
+
+    job.lock = xSemaphoreCreateMutex();
+    job.done = xSemaphoreCreateCounting(HTTP_DOWNLOAD_MAX_CONNECTIONS, 0);
+
+    // first range runs on the calling task, the others on their own tasks
+    download_range_arg_t ranges[HTTP_DOWNLOAD_MAX_CONNECTIONS];
+    int started = 0;
+    for (int i = 1; i < count; i++) {
+        ranges[i].job = &job;
+        ranges[i].index = i;
+
+        if (xTaskCreate(&download_range_task, "http_range", options.task_stack_size, &ranges[i], 5, NULL) == pdPASS) {
+            started++;
+        } else {
+            ESP_LOGE(TAG, "Failed to start range task %d", i);
+            job.failed = true;
+            job.local_failed = true;
+        }
+    }
+
+    if (!download_range(&job, 0)) {
+        job.failed = true;
+    }
+
+    for (int i = 0; i < started; i++) {
+        xSemaphoreTake(job.done, portMAX_DELAY);
+    }
+
+    // a partial file of an older version is of no use, the next call starts over
+    if (job.changed) {
+        ftruncate(fileno(job.file), 0);
+        unlink(job.state_path);
+    } else if (job.failed && job.state.count > 1) {
+        // the progress of a failed download is saved once more, the next call resumes from there
+        save_state(&job, &job.state);
+    }
+
+    fsync(fileno(job.file));
+    fclose(job.file);
+    vSemaphoreDelete(job.lock);
+    vSemaphoreDelete(job.done);
+
+    if (job.failed) {
+        ESP_LOGE(TAG, "download of %s incomplete, it resumes on the next call", path);
+        if (job.local_failed) {
+            return http_local_error();
+        }
+        response.http_status_code = job.error_status;
+        return response;
+    }
+
+    unlink(job.state_path);
+
+    // a corrupt file must not be resumed from
+    if (!verify_file(path, job.options)) {
+        unlink(path);
+        return response;
+    }
+
+    // every range was already on the card from an earlier attempt
+    ESP_LOGI(TAG, "download of %s complete", path);
+    response.http_status_code = job.status_code != 0 ? job.status_code : 200;
+
+    return response;
+}
+
+// a retry resumes from what the failed attempt already wrote
+http_client_json_response http_client_download_ranged(http_client_config config, http_download_options_t options) {
+    return http_retry(config, download_ranged_once, &options);
+}
@@ -1,9 +1,14 @@
 #include "HttpHelper.h"
 
+#include "HttpInternal.h"
+#include "HttpJsonStream.h"
+#include "HttpPool.h"
+#include "SdCardHelper.h"
+#include "esp_timer.h"
+
 static const char* TAG = "Http Client >>> ";
 
 // --------------------- callback process ----------------------------------------
-ESP_EVENT_DECLARE_BASE(HTTP_EVENT);
 ESP_EVENT_DEFINE_BASE(HTTP_EVENT);
 
 void http_register_callback(esp_event_handler_t callback) {
@@ -29,114 +34,309 @@ void http_trigger_event(http_event_t event, char* event_data) {
     );
 }
 
-// private methods
-esp_http_client_handle_t init_connection(http_client_config config, int content_length) {
-    esp_http_client_config_t clientConfig = {
-        .url = config.url,
-        .method = config.method,
+// posts upload progress every step bytes and once at the end, never blocks the upload
+void http_report_progress(uint32_t sent, uint32_t total, uint32_t step, uint32_t* next_report) {
+    if (step == 0 || (sent < *next_report && (total == 0 || sent < total))) {
+        return;
+    }
+
+    http_upload_progress_t progress = {
+        .sent = sent,
+        .total = total,
     };
+    esp_event_post(HTTP_EVENT, HTTP_UPLOAD_PROGRESS, &progress, sizeof(progress), 0);
+
+    *next_report = sent - (sent % step) + step;
+}
 
-    esp_http_client_handle_t client = esp_http_client_init(&clientConfig);
+// private methods
+static esp_http_client_handle_t acquire_connection(http_client_config config, int content_length, const http_client_header_t* headers, int header_count, bool* reused) {
+    esp_http_client_handle_t client = http_pool_acquire(config.url, config.method, reused);
     if (client == NULL) {
         ESP_LOGE(TAG, "Failed to initialize HTTP client");
         return NULL;
     }
 
+    // pooled handles keep their timeout, so it is set on every request
+    esp_http_client_set_timeout_ms(client, config.timeout_ms > 0 ? config.timeout_ms : HTTP_TIMEOUT_DEFAULT_MS);
+
+    for (int i = 0; i < header_count; i++) {
+        http_pool_set_header(client, headers[i].key, headers[i].value);
+    }
+
+    if (config.retry.idempotency_key != NULL) {
+        http_pool_set_header(client, "Idempotency-Key", config.retry.idempotency_key);
+    }
+
+    // esp_http_client_open adds this header itself, tracking it keeps it off the next pooled request
+    if (content_length < 0) {
+        http_pool_set_header(client, "Transfer-Encoding", "chunked");
+    }
+
+    return client;
+}
+
+esp_http_client_handle_t open_connection(http_client_config config, int content_length, const http_client_header_t* headers, int header_count) {
+    bool reused = false;
+    esp_http_client_handle_t client = acquire_connection(config, content_length, headers, header_count, &reused);
+    if (client == NULL) {
+        return NULL;
+    }
+
+    int64_t start = esp_timer_get_time();
     esp_err_t err = esp_http_client_open(client, content_length);
+
+    // pooled connection was closed by the server while idle, retry once on a fresh one
+    if (err != ESP_OK && reused) {
+        ESP_LOGW(TAG, "Pooled connection is stale: %s", esp_err_to_name(err));
+        http_pool_discard_stale(client);
+
+        client = acquire_connection(config, content_length, headers, header_count, &reused);
+        if (client == NULL) {
+            return NULL;
+        }
+
+        err = esp_http_client_open(client, content_length);
+    }
+
     if (err != ESP_OK) {
         ESP_LOGE(TAG, "Failed to open HTTP connection: %s", esp_err_to_name(err));
-        esp_http_client_cleanup(client);
+        http_metrics_error(client);
+        http_pool_release(client, false);
         //    xEventGroupSetBits(http_download_group, HTTP_DOWNLOAD_FAIL);
         return NULL;
     }
 
+    http_metrics_record(client, HTTP_PHASE_CONNECT, start, 0);
+
     return client;
 }
 
+http_client_json_response http_local_error() {
+    http_client_json_response response = JSON_RESPONSE_NULL();
+    response.local_error = true;
+
+    return response;
+}
+
+http_client_json_response http_no_response(esp_http_client_handle_t client) {
+    http_client_json_response response = JSON_RESPONSE_NULL();
+    response.stale_connection = http_pool_is_reused(client);
+
+    return response;
+}
+
+esp_http_client_handle_t init_connection(http_client_config config, int content_length) {
+    return open_connection(config, content_length, NULL, 0);
+}
+
+bool http_write_chunk(esp_http_client_handle_t client, const char* data, int len) {
+    if (len <= 0) {
+        return true;
+    }
+
+    char chunk_header[12];
+    int header_len = snprintf(chunk_header, sizeof(chunk_header), "%x\r\n", len);
+
+    return esp_http_client_write(client, chunk_header, header_len) == header_len &&
+           esp_http_client_write(client, data, len) == len &&
+           esp_http_client_write(client, "\r\n", 2) == 2;
+}
+
+bool http_finish_chunks(esp_http_client_handle_t client) {
+    return esp_http_client_write(client, "0\r\n\r\n", 5) == 5;
+}
+
+// reads the status of a response whose body is not needed, so the connection can go back to the pool
+http_client_json_response read_status_response(esp_http_client_handle_t client) {
+    http_client_json_response response = JSON_RESPONSE_NULL();
+
+    if (http_fetch_headers(client) < 0) {
+        ESP_LOGE(TAG, "failed to read response headers");
+        return http_no_response(client);
+    }
+
+    response.http_status_code = esp_http_client_get_status_code(client);
+
+    return response;
+}
+
 http_client_json_response read_json_response(response_handler config, esp_http_client_handle_t client) {
-    int64_t resp_length = esp_http_client_fetch_headers(client);
+    if (config.type == JSON_STREAM) {
+        return read_json_stream_response(config, client);
+    }
+
+    int64_t resp_length = http_fetch_headers(client);
     ESP_LOGI(TAG, "response body size %jd", resp_length);
 
     http_client_json_response response = JSON_RESPONSE_NULL();
 
+    // chunked responses have no length up front, they are read up to config.size
+    bool chunked = esp_http_client_is_chunked_response(client);
+    if (resp_length < 0 && !chunked) {
+        ESP_LOGE(TAG, "failed to read response headers");
+        return http_no_response(client);
+    }
+
     // check if response is of the expected size
     if (resp_length > config.size) {
         ESP_LOGE(TAG, "response body is too large [ %jd ] expected [ %d ]", resp_length, config.size);
-        esp_http_client_cleanup(client);
-        return response;
+        return http_local_error();
     }
 
     int status_code = esp_http_client_get_status_code(client);
     ESP_LOGI(TAG, "response status code: %d", status_code);
 
-    if (resp_length > 0) {
-        char response_buffer[resp_length + 1];
-        int bytes_received = esp_http_client_read_response(client, response_buffer, (int)resp_length);
-        if (bytes_received <= 0) {
-            ESP_LOGE(TAG, "failed to read response");
-            // Handle error
-        } else {
-            response_buffer[bytes_received] = '\0';  // Null-terminate the response
-            ESP_LOGI(TAG, "received response: %s", response_buffer);
+    int64_t start = esp_timer_get_time();
+    int capacity = resp_length > 0 ? (int)resp_length : config.size;
+    char* response_buffer = malloc(capacity + 1);
+    if (response_buffer == NULL) {
+        ESP_LOGE(TAG, "Failed to allocate response buffer (%d bytes)", capacity + 1);
+        return http_local_error();
+    }
 
-            response.json = cJSON_Parse(response_buffer);
+    int bytes_received = 0;
+    int read_len = 0;
+    while (bytes_received < capacity) {
+        read_len = esp_http_client_read(client, response_buffer + bytes_received, capacity - bytes_received);
+        if (read_len <= 0) {
+            break;
         }
-    } else {
-        ESP_LOGE(TAG, "failed to read response headers");
-        // Handle error
+        bytes_received += read_len;
+    }
+
+    if (read_len < 0) {
+        ESP_LOGE(TAG, "failed to read response");
+        free(response_buffer);
+        return response;
     }
 
     response.http_status_code = status_code;
 
+    if (bytes_received == 0) {
+        ESP_LOGE(TAG, "response body is empty");
+        free(response_buffer);
+        return response;
+    }
+
+    if (chunked && !esp_http_client_is_complete_data_received(client)) {
+        ESP_LOGE(TAG, "chunked response body is larger than [ %d ]", config.size);
+        free(response_buffer);
+        return http_local_error();
+    }
+
+    response_buffer[bytes_received] = '\0';  // Null-terminate the response
+    ESP_LOGD(TAG, "received response: %s", response_buffer);
+
+    response.json = cJSON_ParseWithLength(response_buffer, bytes_received);
+    http_metrics_record(client, HTTP_PHASE_PARSE, start, bytes_received);
+
+    if (response.json == NULL) {
+        ESP_LOGE(TAG, "invalid json body of %d bytes", bytes_received);
+        response.parse_error = true;
+    }
+
+    free(response_buffer);
+
     return response;
 }
 
-void http_client_download_file(http_client_config config) {
-    FILE* f = fopen(config.download.file_config.path, "wb");
+static http_client_json_response download_once(http_client_config config, void* ctx) {
+    http_client_json_response response = JSON_RESPONSE_NULL();
+
+    // the SD writer task does the file I/O, card latency does not stall the socket reads
+    sdcard_writer_file_handle f = sdcard_writer_open(config.download.file_config.path, "wb");
     if (f == NULL) {
         ESP_LOGE(TAG, "Failed to open file for writing");
-        return;
+        return http_local_error();
     }
 
     esp_http_client_handle_t client = init_connection(config, 0);
     if (client == NULL) {
-        return;
+        sdcard_writer_close(f);
+        return response;
     }
 
-    int64_t total_len = esp_http_client_fetch_headers(client);
+    int64_t total_len = http_fetch_headers(client);
     ESP_LOGI(TAG, "LEN %jd", total_len);
 
+    if (total_len < 0 && !esp_http_client_is_chunked_response(client)) {
+        ESP_LOGE(TAG, "failed to read response headers");
+        response = http_no_response(client);
+        http_pool_release(client, false);
+        sdcard_writer_close(f);
+        return response;
+    }
+
     // Dynamically allocate buffer so it can go to PSRAM
     size_t buffer_size = 2048;
     char* buffer = (char*)malloc(buffer_size);
     if (buffer == NULL) {
         ESP_LOGE(TAG, "Failed to allocate buffer");
-        fclose(f);
-        esp_http_client_cleanup(client);
-        return;
+        sdcard_writer_close(f);
+        http_pool_release(client, false);
+        return http_local_error();
     }
 
     int read_len;
+    bool write_failed = false;
     int64_t total_read = 0;
+    int64_t start = esp_timer_get_time();
     while ((read_len = esp_http_client_read(client, buffer, buffer_size)) > 0) {
-        fwrite(buffer, 1, read_len, f);
+        total_read += read_len;
+
+        if (sdcard_writer_write(f, buffer, read_len) != ESP_OK) {
+            ESP_LOGE(TAG, "Failed to write %d bytes to %s", read_len, config.download.file_config.path);
+            write_failed = true;
+            read_len = -1;
+            break;
+        }
 
         if (config.enable_read_logs) {
-            total_read += read_len;
             ESP_LOGI(TAG, "downloaded bytes %jd", total_read);
         }
     }
 
+    int status_code = esp_http_client_get_status_code(client);
+    if (read_len == 0) {
+        http_metrics_record(client, HTTP_PHASE_DOWNLOAD, start, total_read);
+    } else {
+        http_metrics_error(client);
+    }
+
     // Free the buffer after use
     free(buffer);
-    f_sync(f);
-    fclose(f);
-    esp_http_client_cleanup(client);
+    http_pool_release(client, read_len == 0);
+
+    // the connection is back in the pool before waiting for the card
+    if (sdcard_writer_flush(f) != ESP_OK && read_len == 0) {
+        ESP_LOGE(TAG, "Failed to write %s", config.download.file_config.path);
+        write_failed = true;
+        read_len = -1;
+    }
+    sdcard_writer_close(f);
+
+    if (read_len < 0) {
+        ESP_LOGE(TAG, "Download of %s failed", config.download.file_config.path);
+        return write_failed ? http_local_error() : response;
+    }
 
     ESP_LOGI(TAG, "Downloaded %jd bytes to %s", total_len, config.download.file_config.path);
+
+    response.http_status_code = status_code;
+
+    return response;
 }
 
-http_client_json_response http_client_request(http_client_config config) {
+http_client_json_response http_client_download(http_client_config config) {
+    return http_retry(config, download_once, NULL);
+}
+
+void http_client_download_file(http_client_config config) {
+    http_client_download(config);
+}
+
+static http_client_json_response request_once(http_client_config config, void* ctx) {
     http_client_json_response response = JSON_RESPONSE_NULL();
     esp_http_client_handle_t client = init_connection(config, 0);
     if (client == NULL) {
@@ -144,16 +344,22 @@ http_client_json_response http_client_request(http_client_config config) {
     }
 
     http_client_json_response r = JSON_RESPONSE_NULL();
-    if (config.response_handler.type == JSON) {
+    if (config.response_handler.type != NONE) {
         r = read_json_response(config.response_handler, client);
+    } else {
+        r = read_status_response(client);
     }
 
     // Clean up
-    esp_http_client_cleanup(client);
+    http_pool_release(client, r.http_status_code > 0);
 
     return r;
 }
 
+http_client_json_response http_client_request(http_client_config config) {
+    return http_retry(config, request_once, NULL);
+}
+
 http_client_json_response http_client_upload_file(http_client_config client_config) {
     http_client_json_response response = JSON_RESPONSE_NULL();
     http_client_upload_file_t config = client_config.upload.file_config;
@@ -163,7 +369,7 @@ http_client_json_response http_client_upload_file(http_client_config client_conf
     FILE* file = fopen(config.path, "rb");
     if (file == NULL) {
         ESP_LOGE(TAG, "Failed to open file for reading");
-        return response;
+        return http_local_error();
     }
 
     ESP_LOGI(TAG, "Init http connection [%s]", client_config.url);
@@ -178,6 +384,7 @@ http_client_json_response http_client_upload_file(http_client_config client_conf
     // Open the HTTP connection
     esp_http_client_handle_t client = init_connection(client_config, (int)content_length);
     if (client == NULL) {
+        fclose(file);
         return response;
     }
 
@@ -185,7 +392,9 @@ http_client_json_response http_client_upload_file(http_client_config client_conf
     char buffer[4096];
     size_t bytes_read;
     int counter = 0;
+    uint32_t next_progress = 0;
     esp_err_t http_ret = 0;
+    int64_t start = esp_timer_get_time();
 
     while ((bytes_read = fread(buffer, 1, sizeof(buffer), file)) > 0) {
         http_ret = esp_http_client_write(client, buffer, bytes_read);
@@ -195,7 +404,7 @@ http_client_json_response http_client_upload_file(http_client_config client_conf
             break;
         } else {
             counter += bytes_read;
-            ESP_LOGI(TAG, "uploaded: %d", counter);
+            http_report_progress(counter, content_length, client_config.upload.progress_step, &next_progress);
         }
     }
 
@@ -205,20 +414,24 @@ http_client_json_response http_client_upload_file(http_client_config client_conf
     if (http_ret < 0) {
         ESP_LOGE(TAG, "file upload failed: %d", http_ret);
 
-        esp_http_client_cleanup(client);
+        http_metrics_error(client);
+        http_pool_release(client, false);
 
         return response;
     }
 
     ESP_LOGI(TAG, "uploaded done: %d bytes left to upload", (counter - (int)content_length));
+    http_metrics_record(client, HTTP_PHASE_UPLOAD, start, counter);
 
     // read response if one is expected
-    if (client_config.response_handler.type == JSON) {
+    if (client_config.response_handler.type != NONE) {
         response = read_json_response(client_config.response_handler, client);
+    } else {
+        response = read_status_response(client);
     }
 
     // Clean up
-    esp_http_client_cleanup(client);
+    http_pool_release(client, response.http_status_code > 0);
 
     return response;
 }
@@ -227,18 +440,36 @@ http_client_json_response http_client_upload_data(http_client_config client_conf
     http_client_json_response response = JSON_RESPONSE_NULL();
     http_client_upload_buffer_t config = client_config.upload.buffer_config;
 
+    // a plain buffer is sent as a single segment
+    http_client_upload_segment_t single_segment = {
+        .data = config.data_buffer,
+        .size = config.data_buffer_size,
+    };
+    const http_client_upload_segment_t* segments = config.segments;
+    int segment_count = config.segment_count;
+    if (segments == NULL) {
+        segments = &single_segment;
+        segment_count = 1;
+    }
+
+    // Get content length from segment sizes
+    uint32_t content_length = 0;
+    for (int i = 0; i < segment_count; i++) {
+        if (segments[i].data == NULL && segments[i].size > 0) {
+            ESP_LOGE(TAG, "Upload segment %d is invalid", i);
+            return http_local_error();
+        }
+        content_length += segments[i].size;
+    }
+
     // Validate data buffer
-    if (config.data_buffer == NULL || config.data_buffer_size == 0) {
+    if (content_length == 0) {
         ESP_LOGE(TAG, "Provided data buffer is empty or invalid");
-        return response;
+        return http_local_error();
     }
 
     ESP_LOGI(TAG, "Init http connection [%s]", client_config.url);
-
-    // Get content length from buffer size
-    uint32_t content_length = config.data_buffer_size;
-
-    ESP_LOGI(TAG, "Upload size: %ld bytes", content_length);
+    ESP_LOGI(TAG, "Upload size: %ld bytes in %d segment(s)", (long)content_length, segment_count);
 
     // Open the HTTP connection
     esp_http_client_handle_t client = init_connection(client_config, (int)content_length);
@@ -247,56 +478,73 @@ http_client_json_response http_client_upload_data(http_client_config client_conf
         return response;
     }
 
-    // Send the buffer in chunks
-    char buffer[4096];
-    size_t bytes_remaining = content_length;
-    size_t offset = 0;
-    int counter = 0;
-    esp_err_t http_ret = ESP_OK;
-
-    while (bytes_remaining > 0) {
-        size_t bytes_to_send = bytes_remaining > sizeof(buffer) ? sizeof(buffer) : bytes_remaining;
-        memcpy(buffer, config.data_buffer + offset, bytes_to_send);
-
-        http_ret = esp_http_client_write(client, buffer, bytes_to_send);
-        if (http_ret < 0) {
-            ESP_LOGE(TAG, "Failed to send chunk: %s", esp_err_to_name(http_ret));
-            break;
-        } else {
-            counter += bytes_to_send;
-            offset += bytes_to_send;
-            bytes_remaining -= bytes_to_send;
-            ESP_LOGI(TAG, "Uploaded: %d/%ld bytes", counter, (long)content_length);
+    // Send straight from the caller's memory, no intermediate copy
+    uint32_t chunk_size = client_config.upload.chunk_size > 0 ? client_config.upload.chunk_size : HTTP_UPLOAD_CHUNK_SIZE_DEFAULT;
+    uint32_t counter = 0;
+    uint32_t next_progress = 0;
+    int http_ret = 0;
+    int64_t start = esp_timer_get_time();
+
+    for (int i = 0; i < segment_count && http_ret >= 0; i++) {
+        const uint8_t* data = segments[i].data;
+        uint32_t bytes_remaining = segments[i].size;
+
+        while (bytes_remaining > 0) {
+            uint32_t bytes_to_send = bytes_remaining > chunk_size ? chunk_size : bytes_remaining;
+
+            http_ret = esp_http_client_write(client, (const char*)data, (int)bytes_to_send);
+            if (http_ret <= 0) {
+                ESP_LOGE(TAG, "Failed to send chunk: %s", esp_err_to_name(http_ret));
+                http_ret = -1;
+                break;
+            }
+
+            data += http_ret;
+            bytes_remaining -= http_ret;
+            counter += http_ret;
+            http_report_progress(counter, content_length, client_config.upload.progress_step, &next_progress);
         }
     }
 
     if (http_ret < 0) {
-        ESP_LOGE(TAG, "Data upload failed: %s", esp_err_to_name(http_ret));
-        esp_http_client_cleanup(client);
+        ESP_LOGE(TAG, "Data upload failed after %ld/%ld bytes", (long)counter, (long)content_length);
+        http_metrics_error(client);
+        http_pool_release(client, false);
         return response;
     }
 
-    ESP_LOGI(TAG, "Upload complete: %d bytes uploaded", counter);
+    ESP_LOGI(TAG, "Upload complete: %ld bytes uploaded", (long)counter);
+    http_metrics_record(client, HTTP_PHASE_UPLOAD, start, counter);
 
     // Read response if expected
-    if (client_config.response_handler.type == JSON) {
+    if (client_config.response_handler.type != NONE) {
         response = read_json_response(client_config.response_handler, client);
+    } else {
+        response = read_status_response(client);
     }
 
     // Clean up
-    esp_http_client_cleanup(client);
+    http_pool_release(client, response.http_status_code > 0);
 
     return response;
 }
 
 // Main upload dispatcher
-http_client_json_response http_client_upload(http_client_config config) {
-    if (config.upload.file_config.path != NULL) {
+static http_client_json_response upload_once(http_client_config config, void* ctx) {
+    if (config.upload.compression.type != HTTP_COMPRESSION_NONE) {
+        return http_client_upload_compressed(config);
+    } else if (config.upload.file_config.path != NULL && config.upload.file_config.pipeline_buffers >= 2) {
+        return http_client_upload_file_pipelined(config);
+    } else if (config.upload.file_config.path != NULL) {
         return http_client_upload_file(config);
-    } else if (config.upload.buffer_config.data_buffer != NULL) {
+    } else if (config.upload.buffer_config.data_buffer != NULL || config.upload.buffer_config.segments != NULL) {
         return http_client_upload_data(config);
     }
 
     ESP_LOGE(TAG, "Invalid data upload provided");
-    return (http_client_json_response) JSON_RESPONSE_NULL();
+    return http_local_error();
+}
+
+http_client_json_response http_client_upload(http_client_config config) {
+    return http_retry(config, upload_once, NULL);
 }
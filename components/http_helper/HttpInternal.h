@@ -0,0 +1,52 @@
+#pragma once
+
+#include "HttpHelper.h"
+
+// private helpers shared by the http helper sources
+
+typedef struct {
+    const char* key;
+    const char* value;
+} http_client_header_t;
+
+// opens a pooled connection with extra request headers, content_length < 0 sends a chunked body
+esp_http_client_handle_t open_connection(http_client_config config, int content_length, const http_client_header_t* headers, int header_count);
+
+// empty response for a failure on the device, http_retry does not repeat it
+http_client_json_response http_local_error();
+
+// empty response for a request whose response headers never arrived, marks a reused pooled connection as stale
+http_client_json_response http_no_response(esp_http_client_handle_t client);
+
+esp_http_client_handle_t init_connection(http_client_config config, int content_length);
+
+http_client_json_response read_json_response(response_handler config, esp_http_client_handle_t client);
+
+http_client_json_response read_status_response(esp_http_client_handle_t client);
+
+void http_report_progress(uint32_t sent, uint32_t total, uint32_t step, uint32_t* next_report);
+
+// file upload that reads the next buffer from SD while the previous one is on the network
+http_client_json_response http_client_upload_file_pipelined(http_client_config client_config);
+
+// writes one chunk of a Transfer-Encoding: chunked body
+bool http_write_chunk(esp_http_client_handle_t client, const char* data, int len);
+
+// writes the terminating chunk of a chunked body
+bool http_finish_chunks(esp_http_client_handle_t client);
+
+// upload through a gzip/deflate stage, from a file or from buffer segments
+http_client_json_response http_client_upload_compressed(http_client_config client_config);
+
+typedef http_client_json_response (*http_attempt_fn)(http_client_config config, void* ctx);
+
+// runs attempt under config.retry, the response of the last attempt is returned
+http_client_json_response http_retry(http_client_config config, http_attempt_fn attempt, void* ctx);
+
+// fetches response headers and records the time to first byte
+int64_t http_fetch_headers(esp_http_client_handle_t client);
+
+// records a phase that started at start_us, bytes go to bytes_out for uploads and bytes_in otherwise
+void http_metrics_record(esp_http_client_handle_t client, http_metrics_phase_t phase, int64_t start_us, uint64_t bytes);
+
+void http_metrics_error(esp_http_client_handle_t client);
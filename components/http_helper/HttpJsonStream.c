@@ -0,0 +1,535 @@
+#include "HttpJsonStream.h"
+
+#include "HttpInternal.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+
+static const char* TAG = "Http Json >>> ";
+
+typedef enum {
+    JS_VALUE = 0,
+    JS_OBJECT_START,  // after '{', expects a key or '}'
+    JS_OBJECT_KEY,    // after ',', expects a key
+    JS_KEY,
+    JS_COLON,
+    JS_STRING,
+    JS_NUMBER,
+    JS_LITERAL,
+    JS_ARRAY_START,  // after '[', expects a value or ']'
+    JS_AFTER_VALUE,
+    JS_DONE,
+    JS_ERROR,
+} json_stream_state_t;
+
+typedef struct {
+    char type;  // '{' or '['
+    int index;
+    int path_len;
+    bool path_ok;
+} json_stream_frame_t;
+
+typedef struct {
+    bool in_use;
+    const http_json_field_t* fields;
+    int field_count;
+    json_stream_state_t state;
+    json_stream_frame_t stack[HTTP_JSON_STREAM_MAX_DEPTH];
+    int depth;
+    char path[HTTP_JSON_STREAM_PATH_SIZE];
+    int path_len;
+    bool path_ok;  // false once the path no longer fits, nothing below it can match
+    char token[HTTP_JSON_STREAM_TOKEN_SIZE];
+    int token_len;
+    bool token_truncated;
+    bool capture;  // current value matches a registered field
+    bool escape;
+    int unicode_left;
+    uint32_t unicode;
+    char read_buffer[HTTP_JSON_STREAM_READ_SIZE];
+} json_stream_t;
+
+static json_stream_t stream_pool[HTTP_JSON_STREAM_POOL_SIZE];
+static portMUX_TYPE stream_pool_lock = portMUX_INITIALIZER_UNLOCKED;
+static SemaphoreHandle_t stream_pool_free = NULL;  // counts the buffers not in use
+
+// --------------------- working buffer pool ----------------------------------------
+// created on first use, a task losing the race deletes its own
+static SemaphoreHandle_t stream_pool_semaphore() {
+    if (stream_pool_free == NULL) {
+        SemaphoreHandle_t created = xSemaphoreCreateCounting(HTTP_JSON_STREAM_POOL_SIZE, HTTP_JSON_STREAM_POOL_SIZE);
+
+        portENTER_CRITICAL(&stream_pool_lock);
+        if (stream_pool_free == NULL) {
+            stream_pool_free = created;
+            created = NULL;
+        }
+        portEXIT_CRITICAL(&stream_pool_lock);
+
+        if (created != NULL) {
+            vSemaphoreDelete(created);
+        }
+    }
+
+    return stream_pool_free;
+}
+
+static json_stream_t* stream_acquire() {
+    SemaphoreHandle_t free_count = stream_pool_semaphore();
+
+    // wait up to a second for a buffer held by another request
+    if (free_count == NULL || xSemaphoreTake(free_count, pdMS_TO_TICKS(1000)) != pdTRUE) {
+        return NULL;
+    }
+
+    // the semaphore guarantees a free slot
+    json_stream_t* stream = NULL;
+
+    portENTER_CRITICAL(&stream_pool_lock);
+    for (int i = 0; i < HTTP_JSON_STREAM_POOL_SIZE; i++) {
+        if (!stream_pool[i].in_use) {
+            stream_pool[i].in_use = true;
+            stream = &stream_pool[i];
+            break;
+        }
+    }
+    portEXIT_CRITICAL(&stream_pool_lock);
+
+    return stream;
+}
+
+static void stream_release(json_stream_t* stream) {
+    portENTER_CRITICAL(&stream_pool_lock);
+    stream->in_use = false;
+    portEXIT_CRITICAL(&stream_pool_lock);
+
+    xSemaphoreGive(stream_pool_free);
+}
+
+// --------------------- path handling ----------------------------------------
+static bool path_matches(const char* pattern, const char* path) {
+    while (*pattern != '\0' && *path != '\0') {
+        if (pattern[0] == '[' && pattern[1] == ']' && *path == '[') {
+            path = strchr(path, ']');
+            if (path == NULL) {
+                return false;
+            }
+            pattern += 2;
+            path++;
+            continue;
+        }
+
+        if (*pattern != *path) {
+            return false;
+        }
+        pattern++;
+        path++;
+    }
+
+    return *pattern == *path;
+}
+
+static bool path_registered(json_stream_t* s) {
+    if (!s->path_ok) {
+        return false;
+    }
+
+    for (int i = 0; i < s->field_count; i++) {
+        if (path_matches(s->fields[i].path, s->path)) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+static void set_member_path(json_stream_t* s) {
+    json_stream_frame_t* frame = &s->stack[s->depth - 1];
+    int separator = frame->path_len > 0 ? 1 : 0;
+
+    s->path_len = frame->path_len;
+    s->path[s->path_len] = '\0';
+    s->path_ok = frame->path_ok && !s->token_truncated &&
+                 frame->path_len + separator + s->token_len < HTTP_JSON_STREAM_PATH_SIZE;
+
+    if (!s->path_ok) {
+        return;
+    }
+
+    if (separator) {
+        s->path[s->path_len++] = '.';
+    }
+    memcpy(s->path + s->path_len, s->token, s->token_len);
+    s->path_len += s->token_len;
+    s->path[s->path_len] = '\0';
+}
+
+static void set_element_path(json_stream_t* s) {
+    json_stream_frame_t* frame = &s->stack[s->depth - 1];
+    int available = HTTP_JSON_STREAM_PATH_SIZE - frame->path_len;
+    int written = snprintf(s->path + frame->path_len, available, "[%d]", frame->index);
+
+    s->path_ok = frame->path_ok && written < available;
+    s->path_len = s->path_ok ? frame->path_len + written : frame->path_len;
+    s->path[s->path_len] = '\0';
+}
+
+// --------------------- tokenizer ----------------------------------------
+static void token_append(json_stream_t* s, char c) {
+    if (s->token_len < HTTP_JSON_STREAM_TOKEN_SIZE - 1) {
+        s->token[s->token_len++] = c;
+    } else {
+        s->token_truncated = true;
+    }
+}
+
+static void token_append_utf8(json_stream_t* s, uint32_t code_point) {
+    if (code_point < 0x80) {
+        token_append(s, (char)code_point);
+    } else if (code_point < 0x800) {
+        token_append(s, (char)(0xC0 | (code_point >> 6)));
+        token_append(s, (char)(0x80 | (code_point & 0x3F)));
+    } else {
+        token_append(s, (char)(0xE0 | (code_point >> 12)));
+        token_append(s, (char)(0x80 | ((code_point >> 6) & 0x3F)));
+        token_append(s, (char)(0x80 | (code_point & 0x3F)));
+    }
+}
+
+static void token_reset(json_stream_t* s) {
+    s->token_len = 0;
+    s->token_truncated = false;
+    s->escape = false;
+    s->unicode_left = 0;
+}
+
+static void emit_value(json_stream_t* s, http_json_value_type_t type) {
+    if (!s->capture) {
+        return;
+    }
+
+    s->token[s->token_len] = '\0';
+    http_json_value_t value = {
+        .type = type,
+        .value = s->token,
+        .length = s->token_len,
+        .truncated = s->token_truncated,
+    };
+
+    for (int i = 0; i < s->field_count; i++) {
+        if (path_matches(s->fields[i].path, s->path)) {
+            s->fields[i].callback(s->path, value, s->fields[i].ctx);
+        }
+    }
+}
+
+static void value_done(json_stream_t* s) {
+    s->state = s->depth == 0 ? JS_DONE : JS_AFTER_VALUE;
+}
+
+static void push_container(json_stream_t* s, char type) {
+    if (s->depth >= HTTP_JSON_STREAM_MAX_DEPTH) {
+        s->state = JS_ERROR;
+        return;
+    }
+
+    json_stream_frame_t* frame = &s->stack[s->depth++];
+    frame->type = type;
+    frame->index = 0;
+    frame->path_len = s->path_len;
+    frame->path_ok = s->path_ok;
+
+    s->state = type == '{' ? JS_OBJECT_START : JS_ARRAY_START;
+}
+
+static void pop_container(json_stream_t* s, char close) {
+    char open = close == '}' ? '{' : '[';
+    if (s->depth == 0 || s->stack[s->depth - 1].type != open) {
+        s->state = JS_ERROR;
+        return;
+    }
+
+    s->depth--;
+    value_done(s);
+}
+
+static void begin_value(json_stream_t* s, char c) {
+    token_reset(s);
+    s->capture = path_registered(s);
+
+    if (c == '{' || c == '[') {
+        push_container(s, c);
+    } else if (c == '"') {
+        s->state = JS_STRING;
+    } else if (c == '-' || (c >= '0' && c <= '9')) {
+        s->state = JS_NUMBER;
+        token_append(s, c);
+    } else if (c == 't' || c == 'f' || c == 'n') {
+        s->state = JS_LITERAL;
+        token_append(s, c);
+    } else {
+        s->state = JS_ERROR;
+    }
+}
+
+static void finish_scalar(json_stream_t* s) {
+    s->token[s->token_len] = '\0';
+
+    if (s->state == JS_NUMBER) {
+        emit_value(s, HTTP_JSON_NUMBER);
+    } else if (strcmp(s->token, "true") == 0 || strcmp(s->token, "false") == 0) {
+        emit_value(s, HTTP_JSON_BOOL);
+    } else if (strcmp(s->token, "null") == 0) {
+        emit_value(s, HTTP_JSON_NULL);
+    } else {
+        s->state = JS_ERROR;
+        return;
+    }
+
+    value_done(s);
+}
+
+static int hex_value(char c) {
+    if (c >= '0' && c <= '9') {
+        return c - '0';
+    }
+    if (c >= 'a' && c <= 'f') {
+        return c - 'a' + 10;
+    }
+    if (c >= 'A' && c <= 'F') {
+        return c - 'A' + 10;
+    }
+    return -1;
+}
+
+static void string_char(json_stream_t* s, char c) {
+    // keys are always needed for the path, values only when registered
+    bool keep = s->state == JS_KEY || s->capture;
+
+    if (s->unicode_left > 0) {
+        int v = hex_value(c);
+        if (v < 0) {
+            s->state = JS_ERROR;
+            return;
+        }
+
+        s->unicode = (s->unicode << 4) | v;
+        if (--s->unicode_left == 0 && keep) {
+            token_append_utf8(s, s->unicode);
+        }
+        return;
+    }
+
+    if (s->escape) {
+        s->escape = false;
+
+        switch (c) {
+            case '"':
+            case '\\':
+            case '/':
+                break;
+            case 'b':
+                c = '\b';
+                break;
+            case 'f':
+                c = '\f';
+                break;
+            case 'n':
+                c = '\n';
+                break;
+            case 'r':
+                c = '\r';
+                break;
+            case 't':
+                c = '\t';
+                break;
+            case 'u':
+                s->unicode_left = 4;
+                s->unicode = 0;
+                return;
+            default:
+                s->state = JS_ERROR;
+                return;
+        }
+
+        if (keep) {
+            token_append(s, c);
+        }
+        return;
+    }
+
+    if (c == '\\') {
+        s->escape = true;
+    } else if (c == '"' && s->state == JS_KEY) {
+        set_member_path(s);
+        s->state = JS_COLON;
+    } else if (c == '"') {
+        emit_value(s, HTTP_JSON_STRING);
+        value_done(s);
+    } else if (keep) {
+        token_append(s, c);
+    }
+}
+
+static void structural_char(json_stream_t* s, char c) {
+    if (c == ' ' || c == '\t' || c == '\r' || c == '\n') {
+        return;
+    }
+
+    switch (s->state) {
+        case JS_VALUE:
+            begin_value(s, c);
+            break;
+        case JS_OBJECT_START:
+        case JS_OBJECT_KEY:
+            if (c == '"') {
+                token_reset(s);
+                s->state = JS_KEY;
+            } else if (c == '}' && s->state == JS_OBJECT_START) {
+                pop_container(s, c);
+            } else {
+                s->state = JS_ERROR;
+            }
+            break;
+        case JS_COLON:
+            s->state = c == ':' ? JS_VALUE : JS_ERROR;
+            break;
+        case JS_ARRAY_START:
+            if (c == ']') {
+                pop_container(s, c);
+            } else {
+                set_element_path(s);
+                begin_value(s, c);
+            }
+            break;
+        case JS_AFTER_VALUE:
+            if (c == ',' && s->stack[s->depth - 1].type == '{') {
+                s->state = JS_OBJECT_KEY;
+            } else if (c == ',') {
+                s->stack[s->depth - 1].index++;
+                set_element_path(s);
+                s->state = JS_VALUE;
+            } else if (c == '}' || c == ']') {
+                pop_container(s, c);
+            } else {
+                s->state = JS_ERROR;
+            }
+            break;
+        default:
+            // trailing data after the root value
+            s->state = JS_ERROR;
+            break;
+    }
+}
+
+static void json_stream_begin(json_stream_t* s, const http_json_field_t* fields, int field_count) {
+    s->fields = fields;
+    s->field_count = field_count;
+    s->state = JS_VALUE;
+    s->depth = 0;
+    s->path[0] = '\0';
+    s->path_len = 0;
+    s->path_ok = true;
+    s->capture = false;
+    token_reset(s);
+}
+
+static bool json_stream_feed(json_stream_t* s, const char* data, int len) {
+    for (int i = 0; i < len && s->state != JS_ERROR; i++) {
+        char c = data[i];
+
+        switch (s->state) {
+            case JS_KEY:
+            case JS_STRING:
+                string_char(s, c);
+                break;
+            case JS_NUMBER:
+                if ((c >= '0' && c <= '9') || c == '-' || c == '+' || c == '.' || c == 'e' || c == 'E') {
+                    token_append(s, c);
+                } else {
+                    finish_scalar(s);
+                    structural_char(s, c);
+                }
+                break;
+            case JS_LITERAL:
+                if (c >= 'a' && c <= 'z') {
+                    token_append(s, c);
+                } else {
+                    finish_scalar(s);
+                    structural_char(s, c);
+                }
+                break;
+            default:
+                structural_char(s, c);
+                break;
+        }
+    }
+
+    return s->state != JS_ERROR;
+}
+
+static bool json_stream_finish(json_stream_t* s) {
+    // a root level number or literal has no terminating character
+    if (s->depth == 0 && (s->state == JS_NUMBER || s->state == JS_LITERAL)) {
+        finish_scalar(s);
+    }
+
+    return s->state == JS_DONE;
+}
+
+// --------------------- response handling ----------------------------------------
+http_client_json_response read_json_stream_response(response_handler config, esp_http_client_handle_t client) {
+    http_client_json_response response = JSON_RESPONSE_NULL();
+
+    int64_t resp_length = http_fetch_headers(client);
+    if (resp_length < 0 && !esp_http_client_is_chunked_response(client)) {
+        ESP_LOGE(TAG, "failed to read response headers");
+        return http_no_response(client);
+    }
+
+    int status_code = esp_http_client_get_status_code(client);
+    ESP_LOGI(TAG, "response status code: %d", status_code);
+
+    json_stream_t* stream = stream_acquire();
+    if (stream == NULL) {
+        ESP_LOGE(TAG, "no json working buffer available");
+        return http_local_error();
+    }
+
+    json_stream_begin(stream, config.fields, config.field_count);
+    int64_t start = esp_timer_get_time();
+
+    int read_len;
+    int64_t total_read = 0;
+    bool parsed = true;
+    while ((read_len = esp_http_client_read(client, stream->read_buffer, HTTP_JSON_STREAM_READ_SIZE)) > 0) {
+        total_read += read_len;
+
+        if (!json_stream_feed(stream, stream->read_buffer, read_len)) {
+            ESP_LOGE(TAG, "invalid json near byte %jd", total_read);
+            parsed = false;
+            break;
+        }
+    }
+
+    if (parsed && read_len == 0 && total_read > 0 && !json_stream_finish(stream)) {
+        ESP_LOGE(TAG, "incomplete json body of %jd bytes", total_read);
+        parsed = false;
+    }
+
+    stream_release(stream);
+
+    if (read_len < 0) {
+        ESP_LOGE(TAG, "failed to read response");
+        http_metrics_error(client);
+        return response;
+    }
+
+    http_metrics_record(client, HTTP_PHASE_PARSE, start, total_read);
+
+    response.http_status_code = status_code;
+    response.parse_error = !parsed;
+
+    return response;
+}
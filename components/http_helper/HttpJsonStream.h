@@ -0,0 +1,13 @@
+#pragma once
+
+#include "HttpHelper.h"
+
+// working buffers are reserved once and shared by all requests, no body data lives on the task stack
+#define HTTP_JSON_STREAM_POOL_SIZE 2
+#define HTTP_JSON_STREAM_READ_SIZE 1024
+#define HTTP_JSON_STREAM_TOKEN_SIZE 256
+#define HTTP_JSON_STREAM_PATH_SIZE 128
+#define HTTP_JSON_STREAM_MAX_DEPTH 16
+
+// parses the body while it is read and reports registered fields, works with chunked responses
+http_client_json_response read_json_stream_response(response_handler config, esp_http_client_handle_t client);
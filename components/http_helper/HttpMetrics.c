@@ -0,0 +1,193 @@
+#include "HttpInternal.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+
+static const char* TAG = "Http Metrics >>> ";
+
+#define METRICS_URL_MAX_LEN 256
+
+static const char* phase_names[HTTP_PHASE_COUNT] = {
+    "connect",
+    "ttfb",
+    "upload",
+    "download",
+    "parse",
+};
+
+static http_metrics_snapshot_t metrics;
+static portMUX_TYPE metrics_lock = portMUX_INITIALIZER_UNLOCKED;
+
+static int bucket_index(uint32_t duration_us) {
+    int index = 0;
+    while (duration_us >= 128 && index < HTTP_METRICS_BUCKETS - 1) {
+        duration_us >>= 1;
+        index++;
+    }
+
+    return index;
+}
+
+static void host_key(esp_http_client_handle_t client, char* key) {
+    char url[METRICS_URL_MAX_LEN];
+    if (esp_http_client_get_url(client, url, sizeof(url)) != ESP_OK) {
+        strcpy(key, "unknown");
+        return;
+    }
+
+    const char* start = strstr(url, "://");
+    start = start != NULL ? start + 3 : url;
+
+    size_t len = (start - url) + strcspn(start, "/?#");
+    if (len >= HTTP_METRICS_HOST_LEN) {
+        len = HTTP_METRICS_HOST_LEN - 1;
+    }
+
+    memcpy(key, url, len);
+    key[len] = '\0';
+}
+
+// called with the lock held
+static http_metrics_host_t* find_host(const char* key) {
+    for (int i = 0; i < metrics.host_count; i++) {
+        if (strcmp(metrics.hosts[i].host, key) == 0) {
+            return &metrics.hosts[i];
+        }
+    }
+
+    if (metrics.host_count < HTTP_METRICS_MAX_HOSTS - 1) {
+        http_metrics_host_t* host = &metrics.hosts[metrics.host_count++];
+        strcpy(host->host, key);
+        return host;
+    }
+
+    // table full, everything else lands in the last slot
+    http_metrics_host_t* other = &metrics.hosts[HTTP_METRICS_MAX_HOSTS - 1];
+    if (metrics.host_count < HTTP_METRICS_MAX_HOSTS) {
+        metrics.host_count = HTTP_METRICS_MAX_HOSTS;
+        strcpy(other->host, "other");
+    }
+
+    return other;
+}
+
+void http_metrics_record(esp_http_client_handle_t client, http_metrics_phase_t phase, int64_t start_us, uint64_t bytes) {
+    int64_t elapsed = esp_timer_get_time() - start_us;
+    uint32_t duration_us = elapsed > UINT32_MAX ? UINT32_MAX : (uint32_t)elapsed;
+    int bucket = bucket_index(duration_us);
+
+    char key[HTTP_METRICS_HOST_LEN];
+    host_key(client, key);
+
+    portENTER_CRITICAL(&metrics_lock);
+
+    http_metrics_host_t* host = find_host(key);
+    http_metrics_histogram_t* histogram = &host->phases[phase];
+
+    histogram->count++;
+    histogram->total_us += duration_us;
+    histogram->buckets[bucket]++;
+    if (duration_us > histogram->max_us) {
+        histogram->max_us = duration_us;
+    }
+
+    if (phase == HTTP_PHASE_CONNECT) {
+        host->requests++;
+    } else if (phase == HTTP_PHASE_UPLOAD) {
+        host->bytes_out += bytes;
+    } else {
+        host->bytes_in += bytes;
+    }
+
+    portEXIT_CRITICAL(&metrics_lock);
+}
+
+void http_metrics_error(esp_http_client_handle_t client) {
+    char key[HTTP_METRICS_HOST_LEN];
+    host_key(client, key);
+
+    portENTER_CRITICAL(&metrics_lock);
+    find_host(key)->errors++;
+    portEXIT_CRITICAL(&metrics_lock);
+}
+
+int64_t http_fetch_headers(esp_http_client_handle_t client) {
+    int64_t start = esp_timer_get_time();
+    int64_t content_length = esp_http_client_fetch_headers(client);
+
+    if (content_length >= 0 || esp_http_client_is_chunked_response(client)) {
+        http_metrics_record(client, HTTP_PHASE_TTFB, start, 0);
+    } else {
+        http_metrics_error(client);
+    }
+
+    return content_length;
+}
+
+void http_metrics_snapshot(http_metrics_snapshot_t* snapshot) {
+    portENTER_CRITICAL(&metrics_lock);
+    *snapshot = metrics;
+    portEXIT_CRITICAL(&metrics_lock);
+}
+
+void http_metrics_reset() {
+    portENTER_CRITICAL(&metrics_lock);
+    memset(&metrics, 0, sizeof(metrics));
+    portEXIT_CRITICAL(&metrics_lock);
+}
+
+char* http_metrics_to_json() {
+    http_metrics_snapshot_t* snapshot = malloc(sizeof(http_metrics_snapshot_t));
+    if (snapshot == NULL) {
+        ESP_LOGE(TAG, "Failed to allocate metrics snapshot");
+        return NULL;
+    }
+
+    http_metrics_snapshot(snapshot);
+
+    cJSON* root = cJSON_CreateObject();
+    cJSON* hosts = cJSON_AddArrayToObject(root, "hosts");
+
+    for (int i = 0; i < snapshot->host_count; i++) {
+        http_metrics_host_t* host = &snapshot->hosts[i];
+        cJSON* item = cJSON_CreateObject();
+
+        cJSON_AddStringToObject(item, "host", host->host);
+        cJSON_AddNumberToObject(item, "requests", host->requests);
+        cJSON_AddNumberToObject(item, "errors", host->errors);
+        cJSON_AddNumberToObject(item, "bytes_out", (double)host->bytes_out);
+        cJSON_AddNumberToObject(item, "bytes_in", (double)host->bytes_in);
+
+        cJSON* phases = cJSON_AddObjectToObject(item, "phases");
+        for (int p = 0; p < HTTP_PHASE_COUNT; p++) {
+            http_metrics_histogram_t* histogram = &host->phases[p];
+            if (histogram->count == 0) {
+                continue;
+            }
+
+            cJSON* phase = cJSON_AddObjectToObject(phases, phase_names[p]);
+            cJSON_AddNumberToObject(phase, "count", histogram->count);
+            cJSON_AddNumberToObject(phase, "avg_us", (double)(histogram->total_us / histogram->count));
+            cJSON_AddNumberToObject(phase, "max_us", histogram->max_us);
+
+            // trailing empty buckets are left out to keep the export small
+            int last = HTTP_METRICS_BUCKETS - 1;
+            while (last > 0 && histogram->buckets[last] == 0) {
+                last--;
+            }
+
+            cJSON* buckets = cJSON_AddArrayToObject(phase, "buckets");
+            for (int b = 0; b <= last; b++) {
+                cJSON_AddItemToArray(buckets, cJSON_CreateNumber(histogram->buckets[b]));
+            }
+        }
+
+        cJSON_AddItemToArray(hosts, item);
+    }
+
+    char* json = cJSON_PrintUnformatted(root);
+
+    cJSON_Delete(root);
+    free(snapshot);
+
+    return json;
+}
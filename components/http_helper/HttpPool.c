@@ -0,0 +1,373 @@
+#include "HttpPool.h"
+
+#include <strings.h>
+
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+
+static const char* TAG = "Http Pool >>> ";
+
+#define HTTP_POOL_HOST_MAX_LEN 96
+#define HTTP_POOL_MAX_HEADERS 4
+#define HTTP_POOL_HEADER_KEY_LEN 32
+
+typedef struct {
+    esp_http_client_handle_t client;
+    char host[HTTP_POOL_HOST_MAX_LEN];
+    char headers[HTTP_POOL_MAX_HEADERS][HTTP_POOL_HEADER_KEY_LEN];  // per request headers to drop on release
+    int header_count;
+    http_pool_response_info_t response;  // of the request in flight, cleared when it is sent
+    int64_t last_used;
+    bool in_use;
+    bool healthy;
+    bool reused;  // the request in flight went out on a connection kept from an earlier one
+} http_pool_entry_t;
+
+static http_pool_config_t pool_config;
+static http_pool_entry_t* pool_entries = NULL;
+static SemaphoreHandle_t pool_lock = NULL;
+static http_pool_stats_t pool_stats;
+
+// pool key is "scheme://host:port", everything before the path
+static bool url_host_key(const char* url, char* key, size_t key_size) {
+    if (url == NULL) {
+        return false;
+    }
+
+    const char* start = strstr(url, "://");
+    start = start != NULL ? start + 3 : url;
+
+    size_t len = (start - url) + strcspn(start, "/?#");
+    if (len >= key_size) {
+        return false;
+    }
+
+    memcpy(key, url, len);
+    key[len] = '\0';
+
+    return true;
+}
+
+static void copy_header(char* out, size_t size, const char* value) {
+    strncpy(out, value, size - 1);
+    out[size - 1] = '\0';
+}
+
+// marks the pooled connection as not reusable when the server closes it and keeps the headers
+// a resumed download checks, the client only exposes response headers through this event
+static esp_err_t pool_event_handler(esp_http_client_event_t* evt) {
+    http_pool_entry_t* entry = (http_pool_entry_t*)evt->user_data;
+    if (entry == NULL) {
+        return ESP_OK;
+    }
+
+    if (evt->event_id == HTTP_EVENT_DISCONNECTED) {
+        entry->healthy = false;
+    } else if (evt->event_id == HTTP_EVENT_HEADERS_SENT) {
+        memset(&entry->response, 0, sizeof(entry->response));
+    } else if (evt->event_id == HTTP_EVENT_ON_HEADER) {
+        if (strcasecmp(evt->header_key, "Connection") == 0 && strcasecmp(evt->header_value, "close") == 0) {
+            entry->healthy = false;
+        } else if (strcasecmp(evt->header_key, "ETag") == 0) {
+            copy_header(entry->response.etag, sizeof(entry->response.etag), evt->header_value);
+        } else if (strcasecmp(evt->header_key, "Last-Modified") == 0) {
+            copy_header(entry->response.last_modified, sizeof(entry->response.last_modified), evt->header_value);
+        } else if (strcasecmp(evt->header_key, "Content-Range") == 0) {
+            copy_header(entry->response.content_range, sizeof(entry->response.content_range), evt->header_value);
+        }
+    }
+
+    return ESP_OK;
+}
+
+static esp_http_client_handle_t create_client(const char* url, esp_http_client_method_t method, http_pool_entry_t* entry) {
+    esp_http_client_config_t clientConfig = {
+        .url = url,
+        .method = method,
+    };
+
+    if (pool_lock != NULL) {
+        clientConfig.keep_alive_enable = true;
+        clientConfig.keep_alive_idle = pool_config.keep_alive_idle_s;
+        clientConfig.keep_alive_interval = pool_config.keep_alive_interval_s;
+        clientConfig.keep_alive_count = pool_config.keep_alive_count;
+        clientConfig.event_handler = pool_event_handler;
+        clientConfig.user_data = entry;
+    }
+
+    return esp_http_client_init(&clientConfig);
+}
+
+// called with pool_lock held. a TLS teardown can block, so the cleanup runs without the lock
+// while the slot stays claimed, its DISCONNECTED event still writes to the entry
+static void close_entry(http_pool_entry_t* entry) {
+    entry->in_use = true;
+    xSemaphoreGive(pool_lock);
+
+    esp_http_client_cleanup(entry->client);
+
+    xSemaphoreTake(pool_lock, portMAX_DELAY);
+    memset(entry, 0, sizeof(http_pool_entry_t));
+}
+
+void http_pool_init(http_pool_config_t config) {
+    if (pool_lock != NULL) {
+        ESP_LOGI(TAG, "pool already initialized");
+        return;
+    }
+
+    if (config.max_size <= 0) {
+        ESP_LOGI(TAG, "pool disabled");
+        return;
+    }
+
+    pool_entries = calloc(config.max_size, sizeof(http_pool_entry_t));
+    if (pool_entries == NULL) {
+        ESP_LOGE(TAG, "Failed to allocate pool of %d entries", config.max_size);
+        return;
+    }
+
+    pool_config = config;
+    memset(&pool_stats, 0, sizeof(pool_stats));
+    pool_lock = xSemaphoreCreateMutex();
+
+    ESP_LOGI(TAG, "pool initialized, size %d idle timeout %d ms", config.max_size, config.idle_timeout_ms);
+}
+
+esp_http_client_handle_t http_pool_acquire(const char* url, esp_http_client_method_t method, bool* reused) {
+    char host[HTTP_POOL_HOST_MAX_LEN];
+    *reused = false;
+
+    if (pool_lock == NULL || !url_host_key(url, host, sizeof(host))) {
+        return create_client(url, method, NULL);
+    }
+
+    int64_t now = esp_timer_get_time();
+    int64_t idle_timeout_us = (int64_t)pool_config.idle_timeout_ms * 1000;
+    http_pool_entry_t* match = NULL;
+    http_pool_entry_t* free_slot = NULL;
+
+    xSemaphoreTake(pool_lock, portMAX_DELAY);
+
+    for (int i = 0; i < pool_config.max_size; i++) {
+        http_pool_entry_t* entry = &pool_entries[i];
+
+        if (entry->client != NULL && !entry->in_use && now - entry->last_used > idle_timeout_us) {
+            close_entry(entry);
+            pool_stats.evictions++;
+        }
+    }
+
+    // the lock was dropped while evicting, so the slots are picked in a pass of their own
+    for (int i = 0; i < pool_config.max_size; i++) {
+        http_pool_entry_t* entry = &pool_entries[i];
+
+        if (entry->client == NULL) {
+            if (free_slot == NULL) {
+                free_slot = entry;
+            }
+        } else if (match == NULL && !entry->in_use && strcmp(entry->host, host) == 0) {
+            match = entry;
+        }
+    }
+
+    esp_http_client_handle_t client = NULL;
+
+    if (match != NULL) {
+        match->in_use = true;
+        match->healthy = true;
+        match->reused = true;
+        pool_stats.hits++;
+        client = match->client;
+    } else {
+        pool_stats.misses++;
+        client = create_client(url, method, free_slot);
+
+        if (client != NULL && free_slot != NULL) {
+            free_slot->client = client;
+            strcpy(free_slot->host, host);
+            free_slot->in_use = true;
+            free_slot->healthy = true;
+        } else if (client != NULL) {
+            pool_stats.overflows++;
+        }
+    }
+
+    xSemaphoreGive(pool_lock);
+
+    if (match != NULL) {
+        esp_http_client_set_url(client, url);
+        esp_http_client_set_method(client, method);
+        *reused = true;
+    }
+
+    return client;
+}
+
+void http_pool_release(esp_http_client_handle_t client, bool reusable) {
+    if (client == NULL) {
+        return;
+    }
+
+    if (pool_lock == NULL) {
+        esp_http_client_cleanup(client);
+        return;
+    }
+
+    // drain unread body so the next request starts on a clean stream
+    if (reusable) {
+        int flushed = 0;
+        if (esp_http_client_flush_response(client, &flushed) != ESP_OK ||
+            !esp_http_client_is_complete_data_received(client)) {
+            reusable = false;
+        }
+    }
+
+    xSemaphoreTake(pool_lock, portMAX_DELAY);
+
+    http_pool_entry_t* entry = NULL;
+    for (int i = 0; i < pool_config.max_size; i++) {
+        if (pool_entries[i].client == client) {
+            entry = &pool_entries[i];
+            break;
+        }
+    }
+
+    if (entry != NULL && reusable && entry->healthy) {
+        for (int i = 0; i < entry->header_count; i++) {
+            esp_http_client_delete_header(client, entry->headers[i]);
+        }
+        entry->header_count = 0;
+        entry->in_use = false;
+        entry->last_used = esp_timer_get_time();
+        xSemaphoreGive(pool_lock);
+        return;
+    }
+
+    if (entry != NULL) {
+        close_entry(entry);
+    }
+
+    xSemaphoreGive(pool_lock);
+
+    if (entry == NULL) {
+        esp_http_client_cleanup(client);
+    }
+}
+
+esp_err_t http_pool_set_header(esp_http_client_handle_t client, const char* key, const char* value) {
+    if (pool_lock != NULL) {
+        xSemaphoreTake(pool_lock, portMAX_DELAY);
+
+        for (int i = 0; i < pool_config.max_size; i++) {
+            http_pool_entry_t* entry = &pool_entries[i];
+            if (entry->client != client) {
+                continue;
+            }
+
+            // a header we cannot track would leak into the next request, so the handle is not reused
+            if (entry->header_count < HTTP_POOL_MAX_HEADERS && strlen(key) < HTTP_POOL_HEADER_KEY_LEN) {
+                strcpy(entry->headers[entry->header_count++], key);
+            } else {
+                entry->healthy = false;
+            }
+            break;
+        }
+
+        xSemaphoreGive(pool_lock);
+    }
+
+    return esp_http_client_set_header(client, key, value);
+}
+
+void http_pool_response_info(esp_http_client_handle_t client, http_pool_response_info_t* info) {
+    memset(info, 0, sizeof(*info));
+
+    if (pool_lock == NULL) {
+        return;
+    }
+
+    xSemaphoreTake(pool_lock, portMAX_DELAY);
+
+    for (int i = 0; i < pool_config.max_size; i++) {
+        if (pool_entries[i].client == client) {
+            *info = pool_entries[i].response;
+            break;
+        }
+    }
+
+    xSemaphoreGive(pool_lock);
+}
+
+bool http_pool_is_reused(esp_http_client_handle_t client) {
+    bool reused = false;
+    if (pool_lock == NULL) {
+        return reused;
+    }
+
+    xSemaphoreTake(pool_lock, portMAX_DELAY);
+
+    for (int i = 0; i < pool_config.max_size; i++) {
+        if (pool_entries[i].client == client) {
+            reused = pool_entries[i].reused;
+            break;
+        }
+    }
+
+    xSemaphoreGive(pool_lock);
+
+    return reused;
+}
+
+void http_pool_discard_stale(esp_http_client_handle_t client) {
+    if (pool_lock != NULL) {
+        xSemaphoreTake(pool_lock, portMAX_DELAY);
+        pool_stats.health_failures++;
+        xSemaphoreGive(pool_lock);
+    }
+
+    http_pool_release(client, false);
+}
+
+void http_pool_flush() {
+    if (pool_lock == NULL) {
+        return;
+    }
+
+    xSemaphoreTake(pool_lock, portMAX_DELAY);
+
+    for (int i = 0; i < pool_config.max_size; i++) {
+        if (pool_entries[i].client != NULL && !pool_entries[i].in_use) {
+            close_entry(&pool_entries[i]);
+        }
+    }
+
+    xSemaphoreGive(pool_lock);
+}
+
+http_pool_stats_t http_pool_get_stats() {
+    http_pool_stats_t stats = {0};
+    if (pool_lock == NULL) {
+        return stats;
+    }
+
+    xSemaphoreTake(pool_lock, portMAX_DELAY);
+
+    stats = pool_stats;
+    for (int i = 0; i < pool_config.max_size; i++) {
+        if (pool_entries[i].client == NULL) {
+            continue;
+        }
+
+        if (pool_entries[i].in_use) {
+            stats.active++;
+        } else {
+            stats.idle++;
+        }
+    }
+
+    xSemaphoreGive(pool_lock);
+
+    return stats;
+}
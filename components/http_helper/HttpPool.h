@@ -0,0 +1,30 @@
+#pragma once
+
+#include "HttpHelper.h"
+
+// private connection pool api used by the http helper entry points
+
+// response headers kept for the last request on a handle, empty when absent or the handle is not pooled
+typedef struct {
+    char etag[64];
+    char last_modified[32];
+    char content_range[48];
+} http_pool_response_info_t;
+
+// returns a handle pointed at url, reused is set when the handle already holds an open connection
+esp_http_client_handle_t http_pool_acquire(const char* url, esp_http_client_method_t method, bool* reused);
+
+// gives the handle back, reusable=false closes it instead of keeping it for the next request
+void http_pool_release(esp_http_client_handle_t client, bool reusable);
+
+// true when the request on the handle went out on a connection kept from an earlier request
+bool http_pool_is_reused(esp_http_client_handle_t client);
+
+// closes a reused handle whose connection turned out to be dead
+void http_pool_discard_stale(esp_http_client_handle_t client);
+
+// headers of the response just fetched on the handle
+void http_pool_response_info(esp_http_client_handle_t client, http_pool_response_info_t* info);
+
+// sets a request header that is removed again before the handle goes back to the pool
+esp_err_t http_pool_set_header(esp_http_client_handle_t client, const char* key, const char* value);
@@ -0,0 +1,102 @@
+#include "HttpInternal.h"
+#include "esp_random.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+static const char* TAG = "Http Retry >>> ";
+
+static bool is_idempotent(http_client_config config) {
+    switch (config.method) {
+        case HTTP_METHOD_POST:
+        case HTTP_METHOD_PATCH:
+            return config.retry.idempotency_key != NULL || config.retry.retry_non_idempotent;
+        default:
+            return true;
+    }
+}
+
+static bool is_retryable(http_retry_policy_t policy, http_client_json_response response) {
+    int status_code = response.http_status_code;
+
+    // status 0 without a local error is a transport failure, a local one repeats on every attempt
+    if (status_code == 0) {
+        return !response.local_error;
+    }
+
+    if (status_code == 408 || status_code == 429) {
+        return true;
+    }
+
+    return policy.retry_server_errors && status_code >= 500 && status_code != 501;
+}
+
+// full jitter, a random delay between 0 and the exponential backoff keeps a fleet from retrying in step
+static uint32_t backoff_delay(http_retry_policy_t policy, int attempt) {
+    uint32_t cap = policy.base_delay_ms;
+    for (int i = 1; i < attempt && cap < policy.max_delay_ms; i++) {
+        cap <<= 1;
+    }
+    if (cap > policy.max_delay_ms) {
+        cap = policy.max_delay_ms;
+    }
+
+    return cap > 0 ? esp_random() % (cap + 1) : 0;
+}
+
+http_client_json_response http_retry(http_client_config config, http_attempt_fn attempt, void* ctx) {
+    http_retry_policy_t policy = config.retry;
+    int max_attempts = policy.max_attempts > 1 && is_idempotent(config) ? policy.max_attempts : 1;
+    int timeout_ms = config.timeout_ms > 0 ? config.timeout_ms : HTTP_TIMEOUT_DEFAULT_MS;
+    int64_t deadline = policy.deadline_ms > 0 ? esp_timer_get_time() + (int64_t)policy.deadline_ms * 1000 : 0;
+
+    http_client_json_response response = JSON_RESPONSE_NULL();
+    bool stale_retried = false;
+
+    for (int i = 1;; i++) {
+        // the last attempt never runs past the deadline
+        config.timeout_ms = timeout_ms;
+        if (deadline > 0) {
+            int64_t remaining_ms = (deadline - esp_timer_get_time()) / 1000;
+            if (remaining_ms < config.timeout_ms) {
+                config.timeout_ms = remaining_ms > 0 ? remaining_ms : 1;
+            }
+        }
+
+        response = attempt(config, ctx);
+
+        // a pooled connection the server closed while idle passes the open and fails on the headers.
+        // it is sent once more on a fresh connection, on top of max_attempts and without a backoff
+        if (response.stale_connection && !stale_retried && is_idempotent(config)) {
+            ESP_LOGW(TAG, "no response on a reused connection to [%s], retrying on a fresh one", config.url);
+            stale_retried = true;
+            cJSON_Delete(response.json);
+            response.json = NULL;
+
+            // the other idle connections were parked at least as long as this one
+            http_pool_flush();
+            i--;
+            continue;
+        }
+
+        if (i >= max_attempts || !is_retryable(policy, response)) {
+            break;
+        }
+
+        uint32_t delay_ms = backoff_delay(policy, i);
+        if (deadline > 0 && esp_timer_get_time() + (int64_t)delay_ms * 1000 >= deadline) {
+            ESP_LOGW(TAG, "deadline of %ld ms reached after %d attempt(s)", (long)policy.deadline_ms, i);
+            break;
+        }
+
+        ESP_LOGW(TAG, "attempt %d/%d to [%s] failed with status %d, retrying in %ld ms",
+                 i, max_attempts, config.url, response.http_status_code, (long)delay_ms);
+
+        cJSON_Delete(response.json);
+        response.json = NULL;
+
+        vTaskDelay(pdMS_TO_TICKS(delay_ms));
+    }
+
+    return response;
+}
@@ -0,0 +1,218 @@
+#include "HttpInternal.h"
+#include "HttpPool.h"
+
+#include "esp_random.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+static const char* TAG = "Http Spool >>> ";
+
+typedef struct {
+    http_spool_drainer_config_t config;
+    sdcard_spool_record record;
+    uint8_t* buffer;
+} http_spool_upload_t;
+
+static TaskHandle_t drainer_task = NULL;
+
+// streams one record from the card, the Content-Length is known so the body is not chunked
+static http_client_json_response upload_record(http_client_config config, void* ctx) {
+    http_spool_upload_t* upload = (http_spool_upload_t*)ctx;
+    sdcard_spool_record* record = &upload->record;
+    http_client_json_response response = JSON_RESPONSE_NULL();
+
+    char timestamp[16];
+    snprintf(timestamp, sizeof(timestamp), "%lu", (unsigned long)record->timestamp);
+    http_client_header_t header = {"X-Spool-Timestamp", timestamp};
+
+    esp_http_client_handle_t client = open_connection(config, (int)record->length, &header, 1);
+    if (client == NULL) {
+        return response;
+    }
+
+    int64_t start = esp_timer_get_time();
+    uint32_t sent = 0;
+
+    while (sent < record->length) {
+        int n = sdcard_spool_read(upload->config.spool, record, sent, upload->buffer, upload->config.buffer_size);
+        if (n <= 0) {
+            ESP_LOGE(TAG, "record read failed after %ld/%ld bytes", (long)sent, (long)record->length);
+            http_pool_release(client, false);
+            return http_local_error();
+        }
+        if (esp_http_client_write(client, (const char*)upload->buffer, n) != n) {
+            ESP_LOGE(TAG, "record upload failed after %ld/%ld bytes", (long)sent, (long)record->length);
+            http_metrics_error(client);
+            http_pool_release(client, false);
+            return response;
+        }
+        sent += n;
+    }
+
+    http_metrics_record(client, HTTP_PHASE_UPLOAD, start, sent);
+
+    if (config.response_handler.type != NONE) {
+        response = read_json_response(config.response_handler, client);
+    } else {
+        response = read_status_response(client);
+    }
+
+    http_pool_release(client, response.http_status_code > 0);
+
+    return response;
+}
+
+// doubled after every failed upload, a kick or a success starts over
+static uint32_t next_backoff(http_spool_drainer_config_t config, uint32_t backoff_ms) {
+    if (backoff_ms == 0) {
+        return config.retry_min_ms;
+    }
+
+    return backoff_ms >= config.retry_max_ms / 2 ? config.retry_max_ms : backoff_ms * 2;
+}
+
+// only statuses that say this record can never be accepted. 401 and 403 are usually an expired token
+// or an auth outage, dropping on them would wipe the whole backlog, so they wait like any other failure
+static bool is_rejected(int status) {
+    switch (status) {
+        case 400:  // Bad Request
+        case 404:  // Not Found
+        case 410:  // Gone
+        case 413:  // Content Too Large
+        case 422:  // Unprocessable Content
+            return true;
+        default:
+            return false;
+    }
+}
+
+// jittered wait, a kick cuts it short once the network is back
+static void wait_backoff(http_spool_drainer_config_t config, uint32_t* backoff_ms, const char* what, int status) {
+    *backoff_ms = next_backoff(config, *backoff_ms);
+    uint32_t delay_ms = *backoff_ms / 2 + esp_random() % (*backoff_ms / 2 + 1);
+    ESP_LOGW(TAG, "%s failed (%d), retrying in %ld ms", what, status, (long)delay_ms);
+
+    if (ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(delay_ms)) > 0) {
+        *backoff_ms = 0;
+    }
+}
+
+static void http_spool_drainer_task(void* arg) {
+    http_spool_upload_t upload = {
+        .config = *(http_spool_drainer_config_t*)arg,
+    };
+    free(arg);
+
+    upload.buffer = malloc(upload.config.buffer_size);
+    if (upload.buffer == NULL) {
+        ESP_LOGE(TAG, "Failed to allocate %ld bytes buffer", (long)upload.config.buffer_size);
+        drainer_task = NULL;
+        vTaskDelete(NULL);
+        return;
+    }
+
+    uint8_t mac[6] = {0};
+    esp_read_mac(mac, ESP_MAC_EFUSE_FACTORY);
+
+    uint32_t backoff_ms = 0;
+    uint32_t local_failures = 0;  // of the record at the cursor
+
+    while (true) {
+        esp_err_t ret = sdcard_spool_peek(upload.config.spool, &upload.record);
+        if (ret == ESP_ERR_NOT_FOUND) {
+            // idle until something is appended
+            backoff_ms = 0;
+            ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+            continue;
+        }
+
+        // the card could not be read, the record stays queued
+        if (ret != ESP_OK) {
+            wait_backoff(upload.config, &backoff_ms, "spool read", ret);
+            continue;
+        }
+
+        // the same key on every attempt lets the server drop a record it already stored,
+        // the MAC and the spool id keep it from matching records of other devices or of a wiped spool
+        char key[64];
+        snprintf(key, sizeof(key), "spool-%02x%02x%02x%02x%02x%02x-%08lx-%lu-%lu", mac[0], mac[1], mac[2], mac[3], mac[4],
+                 mac[5], (unsigned long)upload.record.spool_id, (unsigned long)upload.record.generation,
+                 (unsigned long)upload.record.offset);
+
+        http_client_config request = upload.config.request;
+        request.retry.idempotency_key = key;
+
+        http_client_json_response response = http_retry(request, upload_record, &upload);
+        cJSON_Delete(response.json);
+
+        int status = response.http_status_code;
+        if (status >= 200 && status < 300) {
+            ESP_LOGI(TAG, "record %s uploaded, %ld bytes", key, (long)upload.record.length);
+            sdcard_spool_consume(upload.config.spool, &upload.record);
+            backoff_ms = 0;
+            local_failures = 0;
+            continue;
+        }
+
+        // rejected for good, it would hold back everything behind it
+        if (is_rejected(status)) {
+            ESP_LOGW(TAG, "record %s rejected with %d, dropped", key, status);
+            sdcard_spool_consume(upload.config.spool, &upload.record);
+            local_failures = 0;
+            continue;
+        }
+
+        // unreadable or not handled on this device, the network is not to blame and waiting would not help
+        if (response.local_error && ++local_failures >= upload.config.local_attempts) {
+            ESP_LOGW(TAG, "record %s failed locally %ld times, skipped", key, (long)local_failures);
+            sdcard_spool_skip(upload.config.spool, &upload.record);
+            local_failures = 0;
+            continue;
+        }
+
+        // offline or the server is struggling
+        wait_backoff(upload.config, &backoff_ms, key, status);
+    }
+}
+
+static void wake_drainer(void* arg) {
+    http_spool_drainer_kick();
+}
+
+esp_err_t http_spool_drainer_start(http_spool_drainer_config_t config) {
+    if (drainer_task != NULL) {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    if (config.spool == NULL || config.request.url == NULL || config.buffer_size == 0) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    http_spool_drainer_config_t* arg = malloc(sizeof(http_spool_drainer_config_t));
+    if (arg == NULL) {
+        return ESP_ERR_NO_MEM;
+    }
+    *arg = config;
+
+    if (xTaskCreatePinnedToCore(&http_spool_drainer_task, "http_spool", config.stack_size, arg, config.priority, &drainer_task,
+                                config.core_id) != pdPASS) {
+        ESP_LOGE(TAG, "Failed to start drainer task");
+        free(arg);
+        drainer_task = NULL;
+        return ESP_FAIL;
+    }
+
+    sdcard_spool_set_append_callback(config.spool, wake_drainer, NULL);
+
+    ESP_LOGI(TAG, "drainer started [%s]", config.request.url);
+
+    return ESP_OK;
+}
+
+void http_spool_drainer_kick() {
+    TaskHandle_t task = drainer_task;
+    if (task != NULL) {
+        xTaskNotifyGive(task);
+    }
+}
@@ -0,0 +1,162 @@
+#include "HttpInternal.h"
+#include "HttpPool.h"
+#include "esp_timer.h"
+
+static const char* TAG = "Http Stream >>> ";
+
+struct http_stream_t {
+    esp_http_client_handle_t client;
+    response_handler response_handler;
+    char* buffer;  // small writes are collected here so each chunk carries a useful payload
+    uint32_t buffer_size;
+    uint32_t buffered;
+    uint32_t sent;
+    uint32_t progress_step;
+    uint32_t next_progress;
+    int64_t start;
+    bool failed;
+};
+
+static void stream_free(http_stream_handle_t stream) {
+    free(stream->buffer);
+    free(stream);
+}
+
+static bool stream_flush(http_stream_handle_t stream) {
+    if (stream->buffered == 0) {
+        return true;
+    }
+
+    if (!http_write_chunk(stream->client, stream->buffer, stream->buffered)) {
+        return false;
+    }
+
+    stream->buffered = 0;
+
+    return true;
+}
+
+http_stream_handle_t http_stream_open(http_client_config config) {
+    http_stream_handle_t stream = calloc(1, sizeof(struct http_stream_t));
+    if (stream == NULL) {
+        ESP_LOGE(TAG, "Failed to allocate stream");
+        return NULL;
+    }
+
+    stream->response_handler = config.response_handler;
+    stream->progress_step = config.upload.progress_step;
+    stream->buffer_size = config.upload.chunk_size;
+
+    if (stream->buffer_size > 0) {
+        stream->buffer = malloc(stream->buffer_size);
+        if (stream->buffer == NULL) {
+            ESP_LOGE(TAG, "Failed to allocate %ld bytes chunk buffer", (long)stream->buffer_size);
+            stream_free(stream);
+            return NULL;
+        }
+    }
+
+    ESP_LOGI(TAG, "Init http connection [%s], chunked", config.url);
+
+    stream->client = open_connection(config, -1, NULL, 0);
+    if (stream->client == NULL) {
+        stream_free(stream);
+        return NULL;
+    }
+
+    stream->start = esp_timer_get_time();
+
+    return stream;
+}
+
+esp_err_t http_stream_write(http_stream_handle_t stream, const void* data, uint32_t len) {
+    if (stream == NULL || (data == NULL && len > 0)) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (stream->failed) {
+        return ESP_FAIL;
+    }
+    if (len == 0) {
+        return ESP_OK;
+    }
+
+    const char* bytes = (const char*)data;
+    bool ok = true;
+
+    if (stream->buffered + len <= stream->buffer_size) {
+        memcpy(stream->buffer + stream->buffered, bytes, len);
+        stream->buffered += len;
+
+        // a full buffer goes out right away, a partial one waits for more data
+        if (stream->buffered == stream->buffer_size) {
+            ok = stream_flush(stream);
+        }
+    } else {
+        // writes larger than the buffer are sent as their own chunk without a copy
+        ok = stream_flush(stream) && http_write_chunk(stream->client, bytes, len);
+    }
+
+    if (!ok) {
+        ESP_LOGE(TAG, "Failed to send chunk after %ld bytes", (long)stream->sent);
+        stream->failed = true;
+        return ESP_FAIL;
+    }
+
+    stream->sent += len;
+    http_report_progress(stream->sent, 0, stream->progress_step, &stream->next_progress);
+
+    return ESP_OK;
+}
+
+esp_err_t http_stream_flush(http_stream_handle_t stream) {
+    if (stream == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (stream->failed || !stream_flush(stream)) {
+        stream->failed = true;
+        return ESP_FAIL;
+    }
+
+    return ESP_OK;
+}
+
+http_client_json_response http_stream_finish(http_stream_handle_t stream) {
+    http_client_json_response response = JSON_RESPONSE_NULL();
+    if (stream == NULL) {
+        return http_local_error();
+    }
+
+    esp_http_client_handle_t client = stream->client;
+
+    if (stream->failed || !stream_flush(stream) || !http_finish_chunks(client)) {
+        ESP_LOGE(TAG, "stream upload failed after %ld bytes", (long)stream->sent);
+        http_metrics_error(client);
+        http_pool_release(client, false);
+        stream_free(stream);
+        return response;
+    }
+
+    ESP_LOGI(TAG, "stream done: %ld bytes", (long)stream->sent);
+    http_metrics_record(client, HTTP_PHASE_UPLOAD, stream->start, stream->sent);
+
+    if (stream->response_handler.type != NONE) {
+        response = read_json_response(stream->response_handler, client);
+    } else {
+        response = read_status_response(client);
+    }
+
+    http_pool_release(client, response.http_status_code > 0);
+    stream_free(stream);
+
+    return response;
+}
+
+void http_stream_abort(http_stream_handle_t stream) {
+    if (stream == NULL) {
+        return;
+    }
+
+    // the body was never terminated, so the connection cannot be reused
+    http_pool_release(stream->client, false);
+    stream_free(stream);
+}
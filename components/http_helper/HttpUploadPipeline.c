@@ -0,0 +1,207 @@
+#include <sys/stat.h>
+
+#include "HttpInternal.h"
+#include "HttpPool.h"
+#include "esp_heap_caps.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+#include "freertos/task.h"
+
+static const char* TAG = "Http Pipeline >>> ";
+
+#define PIPELINE_MAX_BUFFERS 8
+#define PIPELINE_READER_STACK (4 * 1024)
+
+// a filled buffer, len 0 marks the end of the file and -1 a read error
+typedef struct {
+    int index;
+    int len;
+} pipeline_block_t;
+
+typedef struct {
+    FILE* file;
+    char* buffers[PIPELINE_MAX_BUFFERS];
+    uint32_t buffer_size;
+    QueueHandle_t free_queue;
+    QueueHandle_t full_queue;
+    volatile bool aborted;
+} pipeline_t;
+
+// reads the file into free buffers while the sender works on the full ones
+static void pipeline_reader_task(void* arg) {
+    pipeline_t* pipeline = (pipeline_t*)arg;
+    pipeline_block_t block = {0};
+
+    while (!pipeline->aborted) {
+        xQueueReceive(pipeline->free_queue, &block.index, portMAX_DELAY);
+
+        size_t bytes_read = fread(pipeline->buffers[block.index], 1, pipeline->buffer_size, pipeline->file);
+        if (bytes_read == 0) {
+            block.len = ferror(pipeline->file) ? -1 : 0;
+            break;
+        }
+
+        block.len = bytes_read;
+        xQueueSend(pipeline->full_queue, &block, portMAX_DELAY);
+    }
+
+    fclose(pipeline->file);
+
+    // end marker, also tells the sender the file is closed
+    block.index = -1;
+    xQueueSend(pipeline->full_queue, &block, portMAX_DELAY);
+
+    vTaskDelete(NULL);
+}
+
+static void pipeline_free(pipeline_t* pipeline, int buffer_count) {
+    for (int i = 0; i < buffer_count; i++) {
+        heap_caps_free(pipeline->buffers[i]);
+    }
+
+    if (pipeline->free_queue != NULL) {
+        vQueueDelete(pipeline->free_queue);
+    }
+    if (pipeline->full_queue != NULL) {
+        vQueueDelete(pipeline->full_queue);
+    }
+}
+
+static bool pipeline_alloc(pipeline_t* pipeline, int buffer_count) {
+    pipeline->free_queue = xQueueCreate(buffer_count, sizeof(int));
+    pipeline->full_queue = xQueueCreate(buffer_count + 1, sizeof(pipeline_block_t));
+    if (pipeline->free_queue == NULL || pipeline->full_queue == NULL) {
+        return false;
+    }
+
+    for (int i = 0; i < buffer_count; i++) {
+        // DMA capable memory lets the SD driver read without a bounce buffer
+        pipeline->buffers[i] = heap_caps_malloc(pipeline->buffer_size, MALLOC_CAP_DMA);
+        if (pipeline->buffers[i] == NULL) {
+            pipeline->buffers[i] = heap_caps_malloc(pipeline->buffer_size, MALLOC_CAP_DEFAULT);
+        }
+        if (pipeline->buffers[i] == NULL) {
+            return false;
+        }
+
+        xQueueSend(pipeline->free_queue, &i, 0);
+    }
+
+    return true;
+}
+
+http_client_json_response http_client_upload_file_pipelined(http_client_config client_config) {
+    http_client_json_response response = JSON_RESPONSE_NULL();
+    http_client_upload_file_t config = client_config.upload.file_config;
+
+    int buffer_count = config.pipeline_buffers;
+    if (buffer_count > PIPELINE_MAX_BUFFERS) {
+        buffer_count = PIPELINE_MAX_BUFFERS;
+    }
+
+    // one cluster per read keeps every SD transfer aligned
+    uint32_t buffer_size = config.pipeline_buffer_size > 0 ? config.pipeline_buffer_size : sdcard_allocation_unit();
+    pipeline_t pipeline = {
+        .buffer_size = buffer_size > 0 ? buffer_size : HTTP_UPLOAD_PIPELINE_BUFFER_SIZE_DEFAULT,
+    };
+
+    ESP_LOGI(TAG, "Opening file [%s]", config.path);
+
+    struct stat st;
+    if (stat(config.path, &st) != 0) {
+        ESP_LOGE(TAG, "Failed to open file for reading");
+        return http_local_error();
+    }
+
+    if (!pipeline_alloc(&pipeline, buffer_count)) {
+        ESP_LOGE(TAG, "Failed to allocate %d x %ld bytes pipeline", buffer_count, (long)pipeline.buffer_size);
+        pipeline_free(&pipeline, buffer_count);
+        return http_local_error();
+    }
+
+    pipeline.file = fopen(config.path, "rb");
+    if (pipeline.file == NULL) {
+        ESP_LOGE(TAG, "Failed to open file for reading");
+        pipeline_free(&pipeline, buffer_count);
+        return http_local_error();
+    }
+
+    // large stdio buffering would only add a copy, reads already come in whole buffers
+    setvbuf(pipeline.file, NULL, _IONBF, 0);
+
+    uint32_t content_length = st.st_size;
+    ESP_LOGI(TAG, "upload size: %ld, %d x %ld bytes buffers", (long)content_length, buffer_count, (long)pipeline.buffer_size);
+
+    esp_http_client_handle_t client = init_connection(client_config, (int)content_length);
+    if (client == NULL) {
+        fclose(pipeline.file);
+        pipeline_free(&pipeline, buffer_count);
+        return response;
+    }
+
+    if (xTaskCreate(&pipeline_reader_task, "http_sd_reader", PIPELINE_READER_STACK, &pipeline,
+                    uxTaskPriorityGet(NULL), NULL) != pdPASS) {
+        ESP_LOGE(TAG, "Failed to start reader task");
+        fclose(pipeline.file);
+        pipeline_free(&pipeline, buffer_count);
+        http_pool_release(client, false);
+        return http_local_error();
+    }
+
+    uint32_t counter = 0;
+    uint32_t next_progress = 0;
+    bool failed = false;
+    bool read_failed = false;
+    int64_t start = esp_timer_get_time();
+    pipeline_block_t block;
+
+    while (true) {
+        xQueueReceive(pipeline.full_queue, &block, portMAX_DELAY);
+        if (block.index < 0) {
+            read_failed = block.len < 0;
+            failed = failed || read_failed;
+            break;
+        }
+
+        // after a failure the remaining blocks are only recycled until the reader stops
+        if (!failed) {
+            int http_ret = esp_http_client_write(client, pipeline.buffers[block.index], block.len);
+            if (http_ret < 0) {
+                ESP_LOGE(TAG, "Failed to send chunk: %s", esp_err_to_name(http_ret));
+                failed = true;
+                pipeline.aborted = true;
+            } else {
+                counter += block.len;
+                http_report_progress(counter, content_length, client_config.upload.progress_step, &next_progress);
+            }
+        }
+
+        xQueueSend(pipeline.free_queue, &block.index, portMAX_DELAY);
+    }
+
+    pipeline_free(&pipeline, buffer_count);
+
+    if (failed || counter != content_length) {
+        ESP_LOGE(TAG, "file upload failed after %ld/%ld bytes", (long)counter, (long)content_length);
+        http_metrics_error(client);
+        http_pool_release(client, false);
+
+        // a read error or a file that changed size fails again on the next attempt
+        return read_failed || (!failed && counter != content_length) ? http_local_error() : response;
+    }
+
+    ESP_LOGI(TAG, "upload done: %ld bytes", (long)counter);
+    http_metrics_record(client, HTTP_PHASE_UPLOAD, start, counter);
+
+    // read response if one is expected
+    if (client_config.response_handler.type != NONE) {
+        response = read_json_response(client_config.response_handler, client);
+    } else {
+        response = read_status_response(client);
+    }
+
+    http_pool_release(client, response.http_status_code > 0);
+
+    return response;
+}
@@ -5,37 +5,147 @@
 #include "esp_log.h"
 #include "esp_mac.h"
 #include "esp_vfs_fat.h"
+#include "SdCardHelper.h"
 
 // Response type enumeration
 typedef enum {
     NONE = 0x00,
     JSON = 0x01,
+    JSON_STREAM = 0x02,  // body is parsed while it is read, registered fields are reported through callbacks
 } http_response_type;
 
+// Streamed JSON value type
+typedef enum {
+    HTTP_JSON_STRING = 0,
+    HTTP_JSON_NUMBER,
+    HTTP_JSON_BOOL,
+    HTTP_JSON_NULL,
+} http_json_value_type_t;
+
+// Streamed JSON scalar, value is NUL terminated and only valid inside the callback
+typedef struct {
+    http_json_value_type_t type;
+    const char* value;
+    int length;
+    bool truncated;  // value was longer than HTTP_JSON_STREAM_TOKEN_SIZE
+} http_json_value_t;
+
+typedef void (*http_json_field_cb)(const char* path, http_json_value_t value, void* ctx);
+
+// Field of interest, path is dot separated with array indexes, e.g. "result.items[0].id",
+// "[]" matches any index, e.g. "result.items[].id"
+typedef struct {
+    const char* path;
+    http_json_field_cb callback;
+    void* ctx;
+} http_json_field_t;
+
 // Response handler configuration
 typedef struct {
     http_response_type type;
-    int size;
+    int size;                         // max body size for JSON
+    const http_json_field_t* fields;  // fields reported in JSON_STREAM mode
+    int field_count;
 } response_handler;
 
 // File upload configuration (unused in buffer mode)
 typedef struct {
     const char* path;
+    int pipeline_buffers;           // >= 2 reads the next buffer from SD while the previous one is sent, off by default
+    uint32_t pipeline_buffer_size;  // 0 uses the cluster size of the mounted card
 } http_client_upload_file_t;
 
+// opt in with pipeline_buffers = HTTP_UPLOAD_PIPELINE_BUFFERS_DEFAULT, the size applies while no card is mounted
+#define HTTP_UPLOAD_PIPELINE_BUFFERS_DEFAULT 2
+#define HTTP_UPLOAD_PIPELINE_BUFFER_SIZE_DEFAULT (16 * 1024)
+
+// Scatter/gather segment, e.g. a WAV header followed by the PCM body
+typedef struct {
+    const uint8_t* data;
+    uint32_t size;
+} http_client_upload_segment_t;
+
+// Buffer upload configuration, data is written straight from the caller's memory
 typedef struct {
     uint8_t* data_buffer;
     uint32_t data_buffer_size;
+    const http_client_upload_segment_t* segments;  // used instead of data_buffer when set
+    int segment_count;
 } http_client_upload_buffer_t;
 
+#define HTTP_UPLOAD_CHUNK_SIZE_DEFAULT (8 * 1024)
+
+// Upload body compression, the body is sent chunked since its final size is not known up front
+typedef enum {
+    HTTP_COMPRESSION_NONE = 0,
+    HTTP_COMPRESSION_GZIP,     // Content-Encoding: gzip
+    HTTP_COMPRESSION_DEFLATE,  // Content-Encoding: deflate (zlib wrapped)
+} http_compression_type_t;
+
+typedef struct {
+    http_compression_type_t type;
+    int level;        // 1 fastest .. 9 smallest
+    int window_bits;  // 9..15, window memory is 1 << (window_bits + 2) bytes
+    int mem_level;    // 1..9, hash memory is 1 << (mem_level + 9) bytes
+} http_compression_t;
+
+#define HTTP_COMPRESSION_DEFAULT()     \
+    {                                  \
+        .type = HTTP_COMPRESSION_NONE, \
+        .level = 3,                    \
+        .window_bits = 11,             \
+        .mem_level = 4,                \
+    }
+
+// Result of http_compress_benchmark
+typedef struct {
+    uint32_t input_bytes;
+    uint32_t output_bytes;
+    float ratio;            // input / output
+    float throughput_kbps;  // input kilobytes per second
+    int64_t duration_us;
+} http_compress_stats_t;
+
+// Retry policy shared by all requests. A transport failure (status 0 without local_error), 408, 429 and 5xx
+// are retried with exponential backoff and full jitter until max_attempts or the deadline is reached
+// a retryable request without a response on a reused pooled connection is sent once more on a fresh one,
+// even with max_attempts = 1
+typedef struct {
+    int max_attempts;             // 1 disables retries
+    uint32_t base_delay_ms;       // first backoff, doubled on every retry
+    uint32_t max_delay_ms;        // backoff cap
+    uint32_t deadline_ms;         // budget for all attempts including backoff, 0 for none
+    bool retry_server_errors;     // retry 5xx responses, transport failures are always retried
+    bool retry_non_idempotent;    // also retry POST and PATCH without an idempotency key
+    const char* idempotency_key;  // sent as Idempotency-Key on every attempt, makes POST and PATCH retryable
+} http_retry_policy_t;
+
+#define HTTP_TIMEOUT_DEFAULT_MS 5000
+
+#define HTTP_RETRY_POLICY_DEFAULT()       \
+    {                                     \
+        .max_attempts = 1,                \
+        .base_delay_ms = 200,             \
+        .max_delay_ms = 5000,             \
+        .deadline_ms = 0,                 \
+        .retry_server_errors = true,      \
+        .retry_non_idempotent = false,    \
+        .idempotency_key = NULL,          \
+    }
+
 // HTTP client configuration
 typedef struct {
     bool enable_read_logs;
     const char* url;
     esp_http_client_method_t method;
+    int timeout_ms;  // network timeout per attempt, 0 for HTTP_TIMEOUT_DEFAULT_MS
+    http_retry_policy_t retry;
     struct http_client_upload_t {
         http_client_upload_file_t file_config;
         http_client_upload_buffer_t buffer_config;
+        uint32_t chunk_size;     // bytes per esp_http_client_write
+        uint32_t progress_step;  // bytes between HTTP_UPLOAD_PROGRESS events, 0 disables them
+        http_compression_t compression;
     } upload;
     struct http_client_download_t {
         http_client_upload_file_t file_config;
@@ -46,14 +156,20 @@ typedef struct {
 
 // HTTP client JSON response
 typedef struct {
-    int http_status_code;
+    int http_status_code;   // 0 when no response was received
     cJSON* json;
+    bool local_error;       // failed on the device (SD card, memory, configuration), a retry would fail the same way
+    bool parse_error;       // the body was received but is not valid json, tells it apart from a missing match
+    bool stale_connection;  // no response on a reused pooled connection, most likely closed by the server while idle
 } http_client_json_response;
 
-#define JSON_RESPONSE_NULL()   \
-    {                          \
-        .http_status_code = 0, \
-        .json = NULL,          \
+#define JSON_RESPONSE_NULL()       \
+    {                              \
+        .http_status_code = 0,     \
+        .json = NULL,              \
+        .local_error = false,      \
+        .parse_error = false,      \
+        .stale_connection = false, \
     }
 
 #define HTTP_CLIENT_CONFIG_DEFAULT()       \
@@ -61,20 +177,36 @@ typedef struct {
         .enable_read_logs = false,         \
         .url = NULL,                       \
         .method = HTTP_METHOD_GET,         \
+        .timeout_ms = 0,                   \
+        .retry = HTTP_RETRY_POLICY_DEFAULT(), \
         .response_handler = {              \
             .type = NONE,                  \
             .size = 1024,                  \
+            .fields = NULL,                \
+            .field_count = 0,              \
         },                                 \
         .upload = {                        \
-            .file_config = {.path = NULL}, \
+            .file_config = {               \
+                .path = NULL,              \
+                .pipeline_buffers = 0,     \
+                .pipeline_buffer_size = 0, \
+            },                             \
             .buffer_config = {             \
                 .data_buffer = NULL,       \
                 .data_buffer_size = 0,     \
+                .segments = NULL,          \
+                .segment_count = 0,        \
             },                             \
+            .chunk_size = HTTP_UPLOAD_CHUNK_SIZE_DEFAULT, \
+            .progress_step = 0,            \
+            .compression = HTTP_COMPRESSION_DEFAULT(), \
         },                                 \
         .download = {                      \
             .file_config = {               \
-                .path = NULL},             \
+                .path = NULL,              \
+                .pipeline_buffers = 0,     \
+                .pipeline_buffer_size = 0, \
+            },                             \
             .buffer_config = {             \
                 .data_buffer = NULL,       \
                 .data_buffer_size = 0,     \
@@ -82,16 +214,246 @@ typedef struct {
         }                                  \
     }
 
+// Connection pool configuration
+typedef struct {
+    int max_size;             // max pooled handles across all hosts, 0 disables pooling
+    int idle_timeout_ms;      // idle handles older than this are closed on next acquire
+    int keep_alive_idle_s;    // TCP keep-alive idle time
+    int keep_alive_interval_s;
+    int keep_alive_count;
+} http_pool_config_t;
+
+#define HTTP_POOL_CONFIG_DEFAULT()    \
+    {                                 \
+        .max_size = 4,                \
+        .idle_timeout_ms = 5000,      \
+        .keep_alive_idle_s = 5,       \
+        .keep_alive_interval_s = 5,   \
+        .keep_alive_count = 3,        \
+    }
+
+// Connection pool counters
+typedef struct {
+    uint32_t hits;             // requests served by an already connected handle
+    uint32_t misses;           // requests that needed a fresh handle
+    uint32_t evictions;        // idle handles closed after idle timeout
+    uint32_t health_failures;  // pooled handles found dead when reused
+    uint32_t overflows;        // fresh handles not pooled because the pool was full
+    uint32_t active;
+    uint32_t idle;
+} http_pool_stats_t;
+
+// Integrity check run on a completed download
+typedef enum {
+    HTTP_DOWNLOAD_VERIFY_NONE = 0,
+    HTTP_DOWNLOAD_VERIFY_SHA256,
+    HTTP_DOWNLOAD_VERIFY_CRC32,
+} http_download_verify_t;
+
+#define HTTP_DOWNLOAD_MAX_CONNECTIONS 4
+
+// Ranged download configuration
+typedef struct {
+    int connections;              // parallel ranges over separate connections, 1 downloads sequentially
+    uint32_t buffer_size;         // per connection write buffer, rounded up to cluster_size
+    uint32_t cluster_size;        // FAT allocation unit the writes are aligned to
+    bool resume;                  // continue a partial file when the server confirms its ETag or Last-Modified
+    http_download_verify_t verify;
+    const char* expected_digest;  // hex sha256 or crc32
+    int task_stack_size;          // stack of the extra range tasks
+    uint32_t checkpoint_bytes;    // parallel progress is saved for resume after this many bytes, 0 on every write
+} http_download_options_t;
+
+#define HTTP_DOWNLOAD_OPTIONS_DEFAULT()       \
+    {                                         \
+        .connections = 1,                     \
+        .buffer_size = 32 * 1024,             \
+        .cluster_size = 16 * 1024,            \
+        .resume = true,                       \
+        .verify = HTTP_DOWNLOAD_VERIFY_NONE,  \
+        .expected_digest = NULL,              \
+        .task_stack_size = 6 * 1024,          \
+        .checkpoint_bytes = 1024 * 1024,      \
+    }
+
+// Transfer phases measured per host. DNS, TCP and TLS setup all happen inside
+// esp_http_client_open, so they are reported together as connect.
+typedef enum {
+    HTTP_PHASE_CONNECT = 0,  // connection setup and request headers, near zero on a pooled connection
+    HTTP_PHASE_TTFB,         // request sent until response headers received
+    HTTP_PHASE_UPLOAD,       // request body
+    HTTP_PHASE_DOWNLOAD,     // response body written to a file
+    HTTP_PHASE_PARSE,        // response body read and parsed as JSON
+    HTTP_PHASE_COUNT,
+} http_metrics_phase_t;
+
+// bucket 0 counts durations below 128 us, bucket i below 2^(i + 7) us, the last one everything above
+#define HTTP_METRICS_BUCKETS 20
+#define HTTP_METRICS_MAX_HOSTS 8
+#define HTTP_METRICS_HOST_LEN 64
+
+typedef struct {
+    uint32_t count;
+    uint64_t total_us;
+    uint32_t max_us;
+    uint32_t buckets[HTTP_METRICS_BUCKETS];
+} http_metrics_histogram_t;
+
+typedef struct {
+    char host[HTTP_METRICS_HOST_LEN];  // "scheme://host:port", the last slot collects overflow hosts as "other"
+    uint32_t requests;
+    uint32_t errors;
+    uint64_t bytes_out;
+    uint64_t bytes_in;
+    http_metrics_histogram_t phases[HTTP_PHASE_COUNT];
+} http_metrics_host_t;
+
+typedef struct {
+    int host_count;
+    http_metrics_host_t hosts[HTTP_METRICS_MAX_HOSTS];
+} http_metrics_snapshot_t;
+
+// Asynchronous request worker configuration
+typedef struct {
+    int worker_count;
+    int core_id;  // tskNO_AFFINITY to let the scheduler pick
+    int priority;
+    int stack_size;
+    int queue_length;
+} http_async_config_t;
+
+#define HTTP_ASYNC_CONFIG_DEFAULT()  \
+    {                                \
+        .worker_count = 1,           \
+        .core_id = 0,                \
+        .priority = 5,               \
+        .stack_size = 6 * 1024,      \
+        .queue_length = 8,           \
+    }
+
+typedef enum {
+    HTTP_ASYNC_REQUEST = 0,  // http_client_request
+    HTTP_ASYNC_UPLOAD,       // http_client_upload, buffer or file
+    HTTP_ASYNC_DOWNLOAD,     // http_client_download
+} http_async_type_t;
+
+// Background upload of an SD spool. Each record is sent as one request body with its append time
+// in X-Spool-Timestamp and an Idempotency-Key naming the record, and is consumed once the server accepts it
+typedef struct {
+    sdcard_spool_handle spool;
+    http_client_config request;  // url, method, retry and response handling, the upload fields are unused
+    uint32_t buffer_size;        // bytes read from SD per write
+    uint32_t retry_min_ms;       // wait after a failed upload, doubled up to retry_max_ms
+    uint32_t retry_max_ms;
+    uint32_t local_attempts;     // a record failing this often on the device side is skipped
+    int stack_size;
+    int priority;
+    int core_id;
+} http_spool_drainer_config_t;
+
+#define HTTP_SPOOL_DRAINER_CONFIG_DEFAULT()     \
+    {                                           \
+        .spool = NULL,                          \
+        .request = HTTP_CLIENT_CONFIG_DEFAULT(), \
+        .buffer_size = 16 * 1024,               \
+        .retry_min_ms = 2000,                   \
+        .retry_max_ms = 5 * 60 * 1000,          \
+        .local_attempts = 3,                    \
+        .stack_size = 6 * 1024,                 \
+        .priority = 3,                          \
+        .core_id = 0,                           \
+    }
+
 // events setup
+ESP_EVENT_DECLARE_BASE(HTTP_EVENT);
+
 typedef enum {
     FILE_UPLOAD_SUCCESS = 0,
     FILE_UPLOAD_FAIL,
+    HTTP_UPLOAD_PROGRESS,
+    HTTP_REQUEST_DONE,
 } http_event_t;
 
+// Result of an asynchronous request. The json has exactly one owner, the callback given to
+// http_async_submit, which frees it with cJSON_Delete. without a callback the worker frees it.
+// the HTTP_REQUEST_DONE event carries a copy with json set to NULL, handlers only see the status
+typedef struct {
+    uint32_t request_id;
+    http_async_type_t type;
+    int http_status_code;
+    cJSON* json;
+} http_async_result_t;
+
+// runs on the worker task before HTTP_REQUEST_DONE is posted
+typedef void (*http_async_callback_t)(http_async_result_t* result, void* ctx);
+
+// HTTP_UPLOAD_PROGRESS event data
+typedef struct {
+    uint32_t sent;
+    uint32_t total;  // 0 for streamed uploads
+} http_upload_progress_t;
+
+// chunked upload whose length is not known when it starts
+typedef struct http_stream_t* http_stream_handle_t;
+
 http_client_json_response http_client_upload(http_client_config config);
 
 void http_client_download_file(http_client_config config);
 
+// same as http_client_download_file, reports the status code of the transfer (0 on failure)
+http_client_json_response http_client_download(http_client_config config);
+
+// downloads with HTTP Range requests into download.file_config.path, resumable after a failure,
+// reports the status code of the transfer (0 on failure)
+http_client_json_response http_client_download_ranged(http_client_config config, http_download_options_t options);
+
 http_client_json_response http_client_request(http_client_config config);
 
 void http_register_callback(esp_event_handler_t callback);
+
+// connection pool, without http_pool_init every request opens and closes its own connection
+void http_pool_init(http_pool_config_t config);
+
+void http_pool_flush();
+
+http_pool_stats_t http_pool_get_stats();
+
+// streaming upload with Transfer-Encoding: chunked, e.g. audio sent while it is still recorded.
+// writes smaller than upload.chunk_size are collected and sent as one chunk
+http_stream_handle_t http_stream_open(http_client_config config);
+
+esp_err_t http_stream_write(http_stream_handle_t stream, const void* data, uint32_t len);
+
+// sends whatever is buffered without waiting for a full chunk
+esp_err_t http_stream_flush(http_stream_handle_t stream);
+
+// terminates the body and reads the response, the stream is freed in any case
+http_client_json_response http_stream_finish(http_stream_handle_t stream);
+
+// drops the request without a response, the stream is freed
+void http_stream_abort(http_stream_handle_t stream);
+
+// compresses data in memory without sending it, to compare levels on real payloads
+esp_err_t http_compress_benchmark(const uint8_t* data, uint32_t size, http_compression_t compression, http_compress_stats_t* stats);
+
+// transfer metrics
+void http_metrics_snapshot(http_metrics_snapshot_t* snapshot);
+
+void http_metrics_reset();
+
+// compact JSON export of the current metrics, free the result with cJSON_free
+char* http_metrics_to_json();
+
+// asynchronous requests, completion is reported as HTTP_REQUEST_DONE
+void http_async_init(http_async_config_t config);
+
+// queues a request and returns its id, 0 when the queue is full or not initialized,
+// url and upload data must stay valid until HTTP_REQUEST_DONE for that id. callback may be NULL
+uint32_t http_async_submit(http_async_type_t type, http_client_config config, http_async_callback_t callback, void* ctx);
+
+// uploads the spool backlog in the background, woken by every append. 400, 404, 410, 413 and 422 drop the
+// record, a record that keeps failing locally is skipped, any other failure (401 and 403 included) is retried with backoff
+esp_err_t http_spool_drainer_start(http_spool_drainer_config_t config);
+
+// retries right away, e.g. from the IP_EVENT_STA_GOT_IP handler once connectivity is back
+void http_spool_drainer_kick();
@@ -0,0 +1,300 @@
+#include "SdCardHelper.h"
+
+#include <sys/stat.h>
+
+#include "esp_heap_caps.h"
+#include "esp_random.h"
+#include "esp_timer.h"
+
+static const char *TAG = "SdCard Bench >>> ";
+
+#define BENCHMARK_RANDOM_BLOCK (4 * 1024)
+
+static const char *bus_name(sdcard_bus bus) {
+    switch (bus) {
+        case SDCARD_BUS_SDMMC_1BIT:
+            return "SDMMC 1-bit";
+        case SDCARD_BUS_SDMMC_4BIT:
+            return "SDMMC 4-bit";
+        default:
+            return "SPI";
+    }
+}
+
+static float mbps(uint64_t bytes, int64_t elapsed_us) {
+    return elapsed_us > 0 ? (float)bytes / (float)elapsed_us : 0;
+}
+
+// offset of a random 4 KB block inside the file
+static long random_offset(uint32_t file_size) {
+    return (long)(esp_random() % (file_size / BENCHMARK_RANDOM_BLOCK)) * BENCHMARK_RANDOM_BLOCK;
+}
+
+static esp_err_t sequential_write(const char *path, uint8_t *buffer, uint32_t block_size, uint32_t file_size, float *result) {
+    FILE *file = fopen(path, "wb");
+    if (!file) {
+        ESP_LOGE(TAG, "Failed to create %s", path);
+        return ESP_FAIL;
+    }
+
+    // whole blocks go to the driver, stdio buffering would only add a copy
+    setvbuf(file, NULL, _IONBF, 0);
+
+    int64_t start = esp_timer_get_time();
+    uint32_t written = 0;
+    while (written < file_size) {
+        if (fwrite(buffer, 1, block_size, file) != block_size) {
+            ESP_LOGE(TAG, "Write failed at %ld", (long)written);
+            fclose(file);
+            return ESP_FAIL;
+        }
+        written += block_size;
+    }
+    fsync(fileno(file));
+    *result = mbps(written, esp_timer_get_time() - start);
+
+    fclose(file);
+
+    return ESP_OK;
+}
+
+static esp_err_t sequential_read(const char *path, uint8_t *buffer, uint32_t block_size, float *result) {
+    FILE *file = fopen(path, "rb");
+    if (!file) {
+        ESP_LOGE(TAG, "Failed to open %s", path);
+        return ESP_FAIL;
+    }
+
+    setvbuf(file, NULL, _IONBF, 0);
+
+    int64_t start = esp_timer_get_time();
+    uint64_t total = 0;
+    size_t n;
+    while ((n = fread(buffer, 1, block_size, file)) > 0) {
+        total += n;
+    }
+    *result = mbps(total, esp_timer_get_time() - start);
+
+    fclose(file);
+
+    return ESP_OK;
+}
+
+static esp_err_t random_io(const char *path, uint8_t *buffer, uint32_t file_size, uint32_t ops, bool write, float *result) {
+    FILE *file = fopen(path, write ? "r+b" : "rb");
+    if (!file) {
+        ESP_LOGE(TAG, "Failed to open %s", path);
+        return ESP_FAIL;
+    }
+
+    setvbuf(file, NULL, _IONBF, 0);
+
+    int64_t start = esp_timer_get_time();
+    for (uint32_t i = 0; i < ops; i++) {
+        size_t n;
+        if (fseek(file, random_offset(file_size), SEEK_SET) != 0) {
+            n = 0;
+        } else if (write) {
+            n = fwrite(buffer, 1, BENCHMARK_RANDOM_BLOCK, file);
+        } else {
+            n = fread(buffer, 1, BENCHMARK_RANDOM_BLOCK, file);
+        }
+
+        if (n != BENCHMARK_RANDOM_BLOCK) {
+            ESP_LOGE(TAG, "Random %s failed", write ? "write" : "read");
+            fclose(file);
+            return ESP_FAIL;
+        }
+    }
+    if (write) {
+        fsync(fileno(file));
+    }
+    *result = mbps((uint64_t)ops * BENCHMARK_RANDOM_BLOCK, esp_timer_get_time() - start);
+
+    fclose(file);
+
+    return ESP_OK;
+}
+
+esp_err_t sdcard_benchmark(SdCard *card, sdcard_benchmark_config config, sdcard_benchmark_result *result) {
+    if (!card || card->err || !result) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    uint32_t block_size = config.block_size > 0 ? config.block_size : 32 * 1024;
+    uint32_t file_size = config.file_size > 0 ? config.file_size : 4 * 1024 * 1024;
+    uint32_t random_ops = config.random_ops > 0 ? config.random_ops : 256;
+
+    // whole blocks, and at least one random block
+    if (block_size < BENCHMARK_RANDOM_BLOCK) {
+        block_size = BENCHMARK_RANDOM_BLOCK;
+    }
+    file_size -= file_size % block_size;
+    if (file_size < block_size) {
+        file_size = block_size;
+    }
+
+    // DMA capable memory lets the driver skip its bounce buffer, as the recorder does
+    uint8_t *buffer = heap_caps_malloc(block_size, MALLOC_CAP_DMA);
+    if (!buffer) {
+        ESP_LOGE(TAG, "Failed to allocate %ld bytes buffer", (long)block_size);
+        return ESP_ERR_NO_MEM;
+    }
+    esp_fill_random(buffer, block_size);
+
+    char path[32];
+    snprintf(path, sizeof(path), "%s/bench.bin", card->config.mount_point);
+
+    ESP_LOGI(TAG, "%s at %d kHz: %ld KB file, %ld KB blocks, %ld random 4 KB operations",
+             bus_name(card->config.bus), card->card->real_freq_khz, (long)(file_size / 1024),
+             (long)(block_size / 1024), (long)random_ops);
+
+    esp_err_t ret = sequential_write(path, buffer, block_size, file_size, &result->seq_write_mbps);
+    if (ret == ESP_OK) {
+        ret = sequential_read(path, buffer, block_size, &result->seq_read_mbps);
+    }
+    if (ret == ESP_OK) {
+        ret = random_io(path, buffer, file_size, random_ops, true, &result->rand_write_mbps);
+    }
+    if (ret == ESP_OK) {
+        ret = random_io(path, buffer, file_size, random_ops, false, &result->rand_read_mbps);
+    }
+
+    unlink(path);
+    heap_caps_free(buffer);
+
+    if (ret != ESP_OK) {
+        return ret;
+    }
+
+    ESP_LOGI(TAG, "%s: sequential write %.2f MB/s, read %.2f MB/s, 4 KB random write %.2f MB/s, read %.2f MB/s",
+             bus_name(card->config.bus), result->seq_write_mbps, result->seq_read_mbps,
+             result->rand_write_mbps, result->rand_read_mbps);
+
+    return ESP_OK;
+}
+
+// --------------------- file operations ------------------------------------
+#define BENCHMARK_SMALL_FILE 512
+
+static float ops_per_s(uint32_t ops, int64_t start_us) {
+    int64_t elapsed_us = esp_timer_get_time() - start_us;
+    return elapsed_us > 0 ? (float)ops * 1000000 / (float)elapsed_us : 0;
+}
+
+static esp_err_t file_ops(SdCard *card, uint32_t files, uint8_t *buffer, sdcard_file_ops_result *result) {
+    char path[SDCARD_PATH_MAX];
+    char target[SDCARD_PATH_MAX];
+    char relative[32];
+    struct stat st;
+
+    int64_t start = esp_timer_get_time();
+    for (uint32_t i = 0; i < files; i++) {
+        snprintf(relative, sizeof(relative), "bench/f%03ld.bin", (long)i);
+        if (sdcard_path(card, relative, path, sizeof(path)) != ESP_OK) {
+            return ESP_ERR_INVALID_SIZE;
+        }
+
+        FILE *file = fopen(path, "wb");
+        if (!file || fwrite(buffer, 1, BENCHMARK_SMALL_FILE, file) != BENCHMARK_SMALL_FILE) {
+            ESP_LOGE(TAG, "Failed to create %s", path);
+            if (file) {
+                fclose(file);
+            }
+            return ESP_FAIL;
+        }
+        fclose(file);
+    }
+    result->create_per_s = ops_per_s(files, start);
+
+    start = esp_timer_get_time();
+    for (uint32_t i = 0; i < files; i++) {
+        snprintf(relative, sizeof(relative), "bench/f%03ld.bin", (long)i);
+        sdcard_path(card, relative, path, sizeof(path));
+        if (stat(path, &st) != 0) {
+            ESP_LOGE(TAG, "Failed to stat %s", path);
+            return ESP_FAIL;
+        }
+    }
+    result->stat_per_s = ops_per_s(files, start);
+
+    start = esp_timer_get_time();
+    for (uint32_t i = 0; i < files; i++) {
+        snprintf(relative, sizeof(relative), "bench/f%03ld.bin", (long)i);
+        sdcard_path(card, relative, path, sizeof(path));
+        snprintf(relative, sizeof(relative), "bench/r%03ld.bin", (long)i);
+        sdcard_path(card, relative, target, sizeof(target));
+        if (rename(path, target) != 0) {
+            ESP_LOGE(TAG, "Failed to rename %s", path);
+            return ESP_FAIL;
+        }
+    }
+    result->rename_per_s = ops_per_s(files, start);
+
+    start = esp_timer_get_time();
+    for (uint32_t i = 0; i < files; i++) {
+        snprintf(relative, sizeof(relative), "bench/r%03ld.bin", (long)i);
+        esp_err_t ret = sdcard_replace_file(card, relative, buffer, BENCHMARK_SMALL_FILE);
+        if (ret != ESP_OK) {
+            return ret;
+        }
+    }
+    result->replace_per_s = ops_per_s(files, start);
+
+    start = esp_timer_get_time();
+    for (uint32_t i = 0; i < files; i++) {
+        snprintf(relative, sizeof(relative), "bench/r%03ld.bin", (long)i);
+        sdcard_path(card, relative, path, sizeof(path));
+        if (unlink(path) != 0) {
+            ESP_LOGE(TAG, "Failed to remove %s", path);
+            return ESP_FAIL;
+        }
+    }
+    result->unlink_per_s = ops_per_s(files, start);
+
+    return ESP_OK;
+}
+
+esp_err_t sdcard_file_ops_benchmark(SdCard *card, uint32_t files, sdcard_file_ops_result *result) {
+    if (!card || card->err || !result) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    if (files == 0) {
+        files = 64;
+    }
+
+    char dir[SDCARD_PATH_MAX];
+    esp_err_t ret = sdcard_path(card, "bench", dir, sizeof(dir));
+    if (ret != ESP_OK) {
+        return ret;
+    }
+    mkdir(dir, 0755);
+
+    uint8_t buffer[BENCHMARK_SMALL_FILE];
+    esp_fill_random(buffer, sizeof(buffer));
+
+    ret = file_ops(card, files, buffer, result);
+
+    // whatever a failed run left behind
+    char path[SDCARD_PATH_MAX];
+    char relative[32];
+    for (uint32_t i = 0; i < files; i++) {
+        snprintf(relative, sizeof(relative), "bench/f%03ld.bin", (long)i);
+        sdcard_path(card, relative, path, sizeof(path));
+        unlink(path);
+        snprintf(relative, sizeof(relative), "bench/r%03ld.bin", (long)i);
+        sdcard_path(card, relative, path, sizeof(path));
+        unlink(path);
+    }
+    rmdir(dir);
+
+    if (ret != ESP_OK) {
+        return ret;
+    }
+
+    ESP_LOGI(TAG, "%ld files: create %.0f/s, stat %.0f/s, rename %.0f/s, replace %.0f/s, unlink %.0f/s", (long)files,
+             result->create_per_s, result->stat_per_s, result->rename_per_s, result->replace_per_s, result->unlink_per_s);
+
+    return ESP_OK;
+}
@@ -1,4 +1,6 @@
-#include "SdCardHelper.h"
+#include "SdCardInternal.h"
+
+#include "diskio_sdmmc.h"
 
 #ifndef DEBUG_ENABLED
 #define DEBUG_ENABLED
@@ -8,56 +10,112 @@
 static const char *TAG = "SdCard >>> ";
 #endif
 
-SdCard sdcard_mount(sdcard_config config) {
-    SdCard sd_card;
-    esp_err_t ret;
+// the mounted card, its cluster size is read from the volume on first use
+static sdmmc_card_t *mounted_card = NULL;
+static uint32_t allocation_unit = 0;
 
-    gpio_pullup_en(config.pin_mode.miso);
-    gpio_pullup_en(config.pin_mode.cs);
-    gpio_pullup_dis(config.pin_mode.clk);
-    gpio_pullup_dis(config.pin_mode.mosi);
+// SPI mode, 1 data line at up to 20 MHz
+static esp_err_t mount_spi(sdcard_config *config, const esp_vfs_fat_sdmmc_mount_config_t *mount_config,
+                           sdmmc_host_t *host, sdmmc_card_t **card) {
+    esp_err_t ret;
 
-    gpio_pulldown_dis(config.pin_mode.clk);
-    gpio_pulldown_dis(config.pin_mode.mosi);
-    gpio_pulldown_dis(config.pin_mode.miso);
-    gpio_pulldown_dis(config.pin_mode.cs);
+    gpio_pullup_en(config->pin_mode.miso);
+    gpio_pullup_en(config->pin_mode.cs);
+    gpio_pullup_dis(config->pin_mode.clk);
+    gpio_pullup_dis(config->pin_mode.mosi);
 
-    esp_vfs_fat_sdmmc_mount_config_t mount_config = {
-        .format_if_mount_failed = false,
-        .max_files = 5,
-        .allocation_unit_size = 16 * 1024,
-    };
+    gpio_pulldown_dis(config->pin_mode.clk);
+    gpio_pulldown_dis(config->pin_mode.mosi);
+    gpio_pulldown_dis(config->pin_mode.miso);
+    gpio_pulldown_dis(config->pin_mode.cs);
 
-    sdmmc_card_t *card;
-    ESP_LOGI(TAG, "Initializing SD card");
     ESP_LOGI(TAG, "Using SPI peripheral");
 
-    sdmmc_host_t host = SDSPI_HOST_DEFAULT();
-    host.max_freq_khz = config.max_req_khz;
-    host.command_timeout_ms = 3000;
+    *host = (sdmmc_host_t)SDSPI_HOST_DEFAULT();
+    if (config->max_req_khz > 0) {
+        host->max_freq_khz = config->max_req_khz;
+    }
+    host->command_timeout_ms = 3000;
 
     spi_bus_config_t bus_cfg = {
-        .mosi_io_num = config.pin_mode.mosi,
-        .miso_io_num = config.pin_mode.miso,
-        .sclk_io_num = config.pin_mode.clk,
+        .mosi_io_num = config->pin_mode.mosi,
+        .miso_io_num = config->pin_mode.miso,
+        .sclk_io_num = config->pin_mode.clk,
         .quadwp_io_num = -1,
         .quadhd_io_num = -1,
-        .max_transfer_sz = 8192,
+        .max_transfer_sz = config->max_transfer_sz > 0 ? config->max_transfer_sz : 8192,
     };
 
-    ret = spi_bus_initialize(host.slot, &bus_cfg, SDSPI_DEFAULT_DMA);
+    ret = spi_bus_initialize(host->slot, &bus_cfg, SDSPI_DEFAULT_DMA);
     if (ret != ESP_OK) {
         ESP_LOGE(TAG, "Failed to initialize bus.");
-        sd_card.err = true;
-        return sd_card;
+        return ret;
     }
 
     sdspi_device_config_t slot_config = SDSPI_DEVICE_CONFIG_DEFAULT();
-    slot_config.gpio_cs = config.pin_mode.cs;
-    slot_config.host_id = host.slot;
+    slot_config.gpio_cs = config->pin_mode.cs;
+    slot_config.host_id = host->slot;
 
     ESP_LOGI(TAG, "Mounting filesystem");
-    ret = esp_vfs_fat_sdspi_mount(config.mount_point, &host, &slot_config, &mount_config, &card);
+    ret = esp_vfs_fat_sdspi_mount(config->mount_point, host, &slot_config, mount_config, card);
+    if (ret != ESP_OK) {
+        spi_bus_free(host->slot);
+    }
+
+    return ret;
+}
+
+// SDMMC host, 1 or 4 data lines at up to 40 MHz with DMA straight from the file buffers
+static esp_err_t mount_sdmmc(sdcard_config *config, const esp_vfs_fat_sdmmc_mount_config_t *mount_config,
+                             sdmmc_host_t *host, sdmmc_card_t **card) {
+    bool wide = config->bus == SDCARD_BUS_SDMMC_4BIT;
+
+    ESP_LOGI(TAG, "Using SDMMC peripheral, %d-bit bus", wide ? 4 : 1);
+
+    *host = (sdmmc_host_t)SDMMC_HOST_DEFAULT();
+    if (config->max_req_khz > 0) {
+        host->max_freq_khz = config->max_req_khz;
+    }
+    host->command_timeout_ms = 3000;
+
+    sdmmc_slot_config_t slot_config = SDMMC_SLOT_CONFIG_DEFAULT();
+    slot_config.width = wide ? 4 : 1;
+    slot_config.clk = config->sdmmc_pins.clk;
+    slot_config.cmd = config->sdmmc_pins.cmd;
+    slot_config.d0 = config->sdmmc_pins.d0;
+    if (wide) {
+        slot_config.d1 = config->sdmmc_pins.d1;
+        slot_config.d2 = config->sdmmc_pins.d2;
+        slot_config.d3 = config->sdmmc_pins.d3;
+    }
+
+    // the internal pull-ups are weak, boards should still have external ones
+    slot_config.flags |= SDMMC_SLOT_FLAG_INTERNAL_PULLUP;
+
+    ESP_LOGI(TAG, "Mounting filesystem");
+
+    return esp_vfs_fat_sdmmc_mount(config->mount_point, host, &slot_config, mount_config, card);
+}
+
+SdCard sdcard_mount(sdcard_config config) {
+    SdCard sd_card = {0};
+    esp_err_t ret;
+
+    esp_vfs_fat_sdmmc_mount_config_t mount_config = {
+        .format_if_mount_failed = false,
+        .max_files = config.max_files > 0 ? config.max_files : 5,
+        .allocation_unit_size = config.allocation_unit_size > 0 ? config.allocation_unit_size : 16 * 1024,
+    };
+
+    sdmmc_card_t *card;
+    sdmmc_host_t host;
+    ESP_LOGI(TAG, "Initializing SD card");
+
+    if (config.bus == SDCARD_BUS_SPI) {
+        ret = mount_spi(&config, &mount_config, &host, &card);
+    } else {
+        ret = mount_sdmmc(&config, &mount_config, &host, &card);
+    }
 
     if (ret != ESP_OK) {
         if (ret == ESP_FAIL) {
@@ -71,6 +129,7 @@ SdCard sdcard_mount(sdcard_config config) {
                      esp_err_to_name(ret));
         }
 
+        sdcard_stats_mount_failed(ret);
         sd_card.err = true;
         return sd_card;
     }
@@ -78,18 +137,59 @@ SdCard sdcard_mount(sdcard_config config) {
 
     sdmmc_card_print_info(stdout, card);
 
-    sd_card.config = &config;
+    // kept by value, the argument is gone once this returns
+    sd_card.config = config;
     sd_card.host = host;
     sd_card.card = card;
     sd_card.err = false;
 
+    mounted_card = card;
+    allocation_unit = 0;
+
     return sd_card;
 }
 
 void sdcard_unmount(SdCard *card) {
-    esp_vfs_fat_sdcard_unmount(card->config->mount_point, card->card);
+    esp_vfs_fat_sdcard_unmount(card->config.mount_point, card->card);
     ESP_LOGI(TAG, "Card unmounted");
-    spi_bus_free(card->host.slot);
+
+    if (mounted_card == card->card) {
+        mounted_card = NULL;
+        allocation_unit = 0;
+    }
+
+    // the SDMMC host is deinitialized by the unmount
+    if (card->config.bus == SDCARD_BUS_SPI) {
+        spi_bus_free(card->host.slot);
+    }
+}
+
+uint32_t sdcard_allocation_unit() {
+    if (allocation_unit > 0 || mounted_card == NULL) {
+        return allocation_unit;
+    }
+
+    BYTE pdrv = ff_diskio_get_pdrv_card(mounted_card);
+    if (pdrv == 0xFF) {
+        return 0;
+    }
+
+    // a card formatted elsewhere keeps its own cluster size, not the configured allocation_unit_size
+    char drive[3] = {(char)('0' + pdrv), ':', '\0'};
+    DWORD free_clusters;
+    FATFS *fs;
+    if (f_getfree(drive, &free_clusters, &fs) != FR_OK) {
+        ESP_LOGW(TAG, "Failed to read the cluster size of %s", drive);
+        return 0;
+    }
+
+#if FF_MAX_SS != FF_MIN_SS
+    allocation_unit = (uint32_t)fs->csize * fs->ssize;
+#else
+    allocation_unit = (uint32_t)fs->csize * FF_MAX_SS;
+#endif
+
+    return allocation_unit;
 }
 
 void sdcard_create_dir(const char *path) {
@@ -102,7 +202,14 @@ void sdcard_create_dir(const char *path) {
 
 void sdcard_create_file(SdCard *card, const char *file_path) {
     struct stat st = {0};
-    char *dir_path = strdup(file_path);
+    char dir_path[SDCARD_PATH_MAX];
+
+    int len = snprintf(dir_path, sizeof(dir_path), "%s", file_path);
+    if (len < 0 || len >= sizeof(dir_path)) {
+        ESP_LOGE(TAG, "Error: Path too long: %s\n", file_path);
+        return;
+    }
+
     char *last_slash = strrchr(dir_path, '/');
 
     if (last_slash != NULL) {
@@ -111,7 +218,6 @@ void sdcard_create_file(SdCard *card, const char *file_path) {
         if (stat(dir_path, &st) == -1) {
             sdcard_create_dir(dir_path);
         }
-        free(dir_path);
 
         FILE *file = fopen(file_path, "w");
         if (file) {
@@ -122,54 +228,14 @@ void sdcard_create_file(SdCard *card, const char *file_path) {
         }
     } else {
         ESP_LOGE(TAG, "Error: No directory separator found in the path.\n");
-        free(dir_path);
     }
 }
 
 void sdcard_delete_file(SdCard *card, const char *file_path) {
-    struct stat hSt;
-
-    if (stat(file_path, &hSt) == 0) {
-        // Delete it if it exists
-        unlink(file_path);
+    // unlink reports a missing file itself, a stat first would only cost another directory lookup
+    if (unlink(file_path) == 0) {
         ESP_LOGI(TAG, "File deleted!");
     } else {
         ESP_LOGI(TAG, "File not found or failed to delete!");
     }
 }
-
-void sdcard_move_file(SdCard *card, const char *source_file_path, const char *destination_file_path) {
-    struct stat st;
-    char *oldFilePath = malloc(strlen(source_file_path) + strlen(card->config->mount_point));
-    char *newFilePath = malloc(strlen(destination_file_path) + strlen(card->config->mount_point));
-
-    if (!oldFilePath || !newFilePath) {
-        ESP_LOGE(TAG, "Error: Memory allocation failed.\n");
-        free(oldFilePath);
-        free(newFilePath);
-        return;
-    }
-
-    sprintf(oldFilePath, "%s%s", card->config->mount_point, source_file_path);
-    sprintf(newFilePath, "%s%s", card->config->mount_point, destination_file_path);
-
-    if (access(oldFilePath, F_OK) != 0) {
-        ESP_LOGE(TAG, "Error: Source file does not exist.\n");
-        free(oldFilePath);
-        free(newFilePath);
-        return;
-    }
-
-    ESP_LOGI(TAG, "rename file[ %s ] to [ %s ]", oldFilePath, newFilePath);
-
-    sdcard_delete_file(card, newFilePath);
-
-    // Rename original file
-    if (rename(oldFilePath, newFilePath) != 0) {
-        ESP_LOGE(TAG, "Rename failed [ %d ]", errno);
-        return;
-    }
-
-    free(oldFilePath);
-    free(newFilePath);
-}
\ No newline at end of file
@@ -0,0 +1,25 @@
+#pragma once
+
+#include "SdCardHelper.h"
+
+// private helpers shared by the sdcard helper sources
+
+void sdcard_stats_mount_failed(esp_err_t err);
+
+// records an operation that started at start_us, bytes count for reads and writes
+void sdcard_stats_record(sdcard_op op, int64_t start_us, uint32_t bytes);
+
+// records a failed operation with its errno
+void sdcard_stats_error(sdcard_op op, int err);
+
+// stdio calls timed into sdcard_stats, failures are counted with their errno
+FILE *sdcard_io_open(const char *path, const char *mode);
+
+size_t sdcard_io_read(void *data, size_t len, FILE *file);
+
+size_t sdcard_io_write(const void *data, size_t len, FILE *file);
+
+// fflush and fsync, 0 on success
+int sdcard_io_sync(FILE *file);
+
+int sdcard_io_rename(const char *from, const char *to);
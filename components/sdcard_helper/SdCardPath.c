@@ -0,0 +1,155 @@
+#include "SdCardInternal.h"
+
+#include <string.h>
+#include <strings.h>
+#include <sys/stat.h>
+
+static const char *TAG = "SdCard Path >>> ";
+
+esp_err_t sdcard_path(const SdCard *card, const char *relative, char *path, size_t size) {
+    if (!card || !relative || !path || size == 0) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    const char *separator = relative[0] == '/' ? "" : "/";
+    int len = snprintf(path, size, "%s%s%s", card->config.mount_point, separator, relative);
+    if (len < 0 || (size_t)len >= size) {
+        ESP_LOGE(TAG, "Path too long: %s%s%s", card->config.mount_point, separator, relative);
+        path[0] = '\0';
+        return ESP_ERR_INVALID_SIZE;
+    }
+
+    return ESP_OK;
+}
+
+esp_err_t sdcard_path_swap_ext(const char *path, const char *ext, char *out, size_t size) {
+    if (!path || !ext || !out || size == 0) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    // the extension is whatever follows the last dot of the file name, not of a directory
+    const char *name = strrchr(path, '/');
+    name = name != NULL ? name + 1 : path;
+    const char *dot = strrchr(name, '.');
+    int base_len = dot != NULL ? (int)(dot - path) : (int)strlen(path);
+
+    if (dot != NULL && strcasecmp(dot + 1, ext) == 0) {
+        ESP_LOGE(TAG, "%s already has the extension %s", path, ext);
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    int len = snprintf(out, size, "%.*s.%s", base_len, path, ext);
+    if (len < 0 || (size_t)len >= size) {
+        ESP_LOGE(TAG, "Path too long: %.*s.%s", base_len, path, ext);
+        out[0] = '\0';
+        return ESP_ERR_INVALID_SIZE;
+    }
+
+    return ESP_OK;
+}
+
+static esp_err_t replace_paths(SdCard *card, const char *relative, char *path, char *temp_path, char *new_path) {
+    esp_err_t ret = sdcard_path(card, relative, path, SDCARD_PATH_MAX);
+    if (ret == ESP_OK) {
+        ret = sdcard_path_swap_ext(path, "tmp", temp_path, SDCARD_PATH_MAX);
+    }
+    if (ret == ESP_OK) {
+        ret = sdcard_path_swap_ext(path, "new", new_path, SDCARD_PATH_MAX);
+    }
+
+    return ret;
+}
+
+// FAT refuses to rename onto an existing file, the target is only removed when it is in the way
+static bool rename_over(const char *from, const char *to) {
+    if (sdcard_io_rename(from, to) == 0) {
+        return true;
+    }
+
+    return errno == EEXIST && unlink(to) == 0 && sdcard_io_rename(from, to) == 0;
+}
+
+void sdcard_move_file(SdCard *card, const char *source_file_path, const char *destination_file_path) {
+    char old_path[SDCARD_PATH_MAX];
+    char new_path[SDCARD_PATH_MAX];
+
+    if (sdcard_path(card, source_file_path, old_path, sizeof(old_path)) != ESP_OK ||
+        sdcard_path(card, destination_file_path, new_path, sizeof(new_path)) != ESP_OK) {
+        return;
+    }
+
+    ESP_LOGI(TAG, "rename file[ %s ] to [ %s ]", old_path, new_path);
+
+    if (!rename_over(old_path, new_path)) {
+        ESP_LOGE(TAG, "Rename failed [ %d ]", errno);
+    }
+}
+
+// --------------------- atomic replace -------------------------------------
+// data goes to "<path>.tmp" and is synced, then "<path>.tmp" becomes "<path>.new" in one rename.
+// a ".new" file is always complete, a ".tmp" file may be torn
+esp_err_t sdcard_replace_file(SdCard *card, const char *relative, const void *data, size_t len) {
+    char path[SDCARD_PATH_MAX];
+    char temp_path[SDCARD_PATH_MAX];
+    char new_path[SDCARD_PATH_MAX];
+
+    if (!data && len > 0) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    esp_err_t ret = replace_paths(card, relative, path, temp_path, new_path);
+    if (ret != ESP_OK) {
+        return ret;
+    }
+
+    FILE *file = sdcard_io_open(temp_path, "wb");
+    if (!file) {
+        ESP_LOGE(TAG, "Failed to create %s [ %d ]", temp_path, errno);
+        return ESP_FAIL;
+    }
+
+    bool ok = sdcard_io_write(data, len, file) == len && sdcard_io_sync(file) == 0;
+    ok = fclose(file) == 0 && ok;
+
+    if (!ok) {
+        ESP_LOGE(TAG, "Failed to write %s [ %d ]", temp_path, errno);
+        unlink(temp_path);
+        return ESP_FAIL;
+    }
+
+    // a ".new" left by an earlier interrupted replace is older than this one
+    if (!rename_over(temp_path, new_path) || !rename_over(new_path, path)) {
+        ESP_LOGE(TAG, "Failed to replace %s [ %d ]", path, errno);
+        return ESP_FAIL;
+    }
+
+    return ESP_OK;
+}
+
+esp_err_t sdcard_replace_recover(SdCard *card, const char *relative) {
+    char path[SDCARD_PATH_MAX];
+    char temp_path[SDCARD_PATH_MAX];
+    char new_path[SDCARD_PATH_MAX];
+
+    esp_err_t ret = replace_paths(card, relative, path, temp_path, new_path);
+    if (ret != ESP_OK) {
+        return ret;
+    }
+
+    // possibly torn, the file it was meant to replace is still in place
+    unlink(temp_path);
+
+    struct stat st;
+    if (stat(new_path, &st) != 0) {
+        return ESP_OK;
+    }
+
+    ESP_LOGW(TAG, "finishing interrupted replace of %s", path);
+
+    if (!rename_over(new_path, path)) {
+        ESP_LOGE(TAG, "Failed to replace %s [ %d ]", path, errno);
+        return ESP_FAIL;
+    }
+
+    return ESP_OK;
+}
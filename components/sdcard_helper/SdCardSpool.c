@@ -0,0 +1,738 @@
+#include "SdCardInternal.h"
+
+#include <stddef.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+
+#include "esp_random.h"
+#include "esp_rom_crc.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+
+static const char *TAG = "SdCard Spool >>> ";
+
+#define SPOOL_SEGMENT_MAGIC 0x314c5053  // "SPL1"
+#define SPOOL_RECORD_MAGIC 0x31434552   // "REC1"
+#define SPOOL_PATH_MAX 64
+#define SPOOL_SCRATCH_SIZE (4 * 1024)
+
+// written when a segment file is (re)used, generations only grow so the newest one is the head
+typedef struct {
+    uint32_t magic;
+    uint32_t generation;
+    uint32_t crc;
+} spool_segment_header;
+
+typedef struct {
+    uint32_t magic;
+    uint32_t generation;  // of its segment, records left over from an earlier use of the file do not match
+    uint32_t length;      // payload bytes
+    uint32_t timestamp;
+    uint32_t crc;         // over the fields above and the payload
+} spool_record_header;
+
+// two slots written in turn, a torn write leaves the other one intact
+typedef struct {
+    uint32_t sequence;
+    uint32_t generation;
+    uint32_t offset;
+    uint32_t crc;
+} spool_cursor_slot;
+
+typedef struct {
+    uint32_t generation;
+    uint32_t offset;
+} spool_position;
+
+struct sdcard_spool {
+    sdcard_spool_config config;
+    char *dir;
+    uint32_t id;  // drawn when the directory is first used, a wiped spool starts with a new one
+    SemaphoreHandle_t lock;
+    uint32_t *generations;  // per segment file, 0 while it holds none
+
+    spool_position head;  // where the next record goes, generation 0 until the first append
+    FILE *head_file;
+    FILE *read_file;      // an older segment the consumer is reading
+    uint32_t read_generation;
+
+    spool_position cursor;  // oldest record not consumed yet
+    uint32_t cursor_sequence;
+
+    uint8_t *scratch;
+    sdcard_spool_stats stats;
+
+    sdcard_spool_callback on_append;
+    void *on_append_arg;
+};
+
+// --------------------- layout ---------------------------------------------
+static uint32_t record_stride(uint32_t length) {
+    return (sizeof(spool_record_header) + length + 3) & ~3u;
+}
+
+static uint32_t segment_index(sdcard_spool_handle spool, uint32_t generation) {
+    return generation % spool->config.segment_count;
+}
+
+static void segment_path(sdcard_spool_handle spool, uint32_t index, char *path) {
+    snprintf(path, SPOOL_PATH_MAX, "%s/seg%03ld.log", spool->dir, (long)index);
+}
+
+static void cursor_path(sdcard_spool_handle spool, char *path) {
+    snprintf(path, SPOOL_PATH_MAX, "%s/cursor.bin", spool->dir);
+}
+
+static void id_path(sdcard_spool_handle spool, char *path) {
+    snprintf(path, SPOOL_PATH_MAX, "%s/spool.id", spool->dir);
+}
+
+static uint32_t segment_crc(const spool_segment_header *header) {
+    return esp_rom_crc32_le(0, (const uint8_t *)header, offsetof(spool_segment_header, crc));
+}
+
+static uint32_t cursor_crc(const spool_cursor_slot *slot) {
+    return esp_rom_crc32_le(0, (const uint8_t *)slot, offsetof(spool_cursor_slot, crc));
+}
+
+static bool is_empty(sdcard_spool_handle spool) {
+    return spool->cursor.generation == spool->head.generation && spool->cursor.offset == spool->head.offset;
+}
+
+// --------------------- file access ----------------------------------------
+static bool read_at(FILE *file, uint32_t offset, void *data, uint32_t len) {
+    return fseek(file, offset, SEEK_SET) == 0 && sdcard_io_read(data, len, file) == len;
+}
+
+static bool sync_file(FILE *file) {
+    return sdcard_io_sync(file) == 0;
+}
+
+static void close_read_file(sdcard_spool_handle spool) {
+    if (spool->read_file != NULL) {
+        fclose(spool->read_file);
+        spool->read_file = NULL;
+    }
+}
+
+// the head segment is read through the append handle, an older one through a cached handle
+static FILE *segment_file(sdcard_spool_handle spool, uint32_t generation) {
+    if (generation == spool->head.generation) {
+        return spool->head_file;
+    }
+
+    if (spool->read_file != NULL && spool->read_generation == generation) {
+        return spool->read_file;
+    }
+
+    close_read_file(spool);
+
+    char path[SPOOL_PATH_MAX];
+    segment_path(spool, segment_index(spool, generation), path);
+    spool->read_file = sdcard_io_open(path, "rb");
+    spool->read_generation = generation;
+    if (spool->read_file == NULL) {
+        ESP_LOGE(TAG, "Failed to open %s", path);
+    }
+
+    return spool->read_file;
+}
+
+// header of the record at offset, ESP_ERR_NOT_FOUND at the end of the records in the segment.
+// segments are allocated at full size, so a failed read is an I/O error and not the end
+static esp_err_t read_record_header(sdcard_spool_handle spool, FILE *file, spool_position at, spool_record_header *header) {
+    if (at.offset + sizeof(spool_record_header) > spool->config.segment_size) {
+        return ESP_ERR_NOT_FOUND;
+    }
+    if (file == NULL || !read_at(file, at.offset, header, sizeof(spool_record_header))) {
+        return ESP_FAIL;
+    }
+
+    bool valid = header->magic == SPOOL_RECORD_MAGIC && header->generation == at.generation &&
+                 at.offset + record_stride(header->length) <= spool->config.segment_size;
+
+    return valid ? ESP_OK : ESP_ERR_NOT_FOUND;
+}
+
+// ESP_ERR_INVALID_CRC when the record is damaged, ESP_FAIL when it could not be read
+static esp_err_t verify_record(sdcard_spool_handle spool, FILE *file, spool_position at, const spool_record_header *header) {
+    if (file == NULL) {
+        return ESP_FAIL;
+    }
+
+    uint32_t crc = esp_rom_crc32_le(0, (const uint8_t *)header, offsetof(spool_record_header, crc));
+    uint32_t offset = at.offset + sizeof(spool_record_header);
+    uint32_t left = header->length;
+
+    while (left > 0) {
+        uint32_t n = left < SPOOL_SCRATCH_SIZE ? left : SPOOL_SCRATCH_SIZE;
+        if (!read_at(file, offset, spool->scratch, n)) {
+            return ESP_FAIL;
+        }
+        crc = esp_rom_crc32_le(crc, spool->scratch, n);
+        offset += n;
+        left -= n;
+    }
+
+    return crc == header->crc ? ESP_OK : ESP_ERR_INVALID_CRC;
+}
+
+// every segment file is allocated once at full size, appends never grow a file or touch the directory
+static esp_err_t prepare_segment(sdcard_spool_handle spool, uint32_t index) {
+    char path[SPOOL_PATH_MAX];
+    segment_path(spool, index, path);
+
+    struct stat st;
+    if (stat(path, &st) == 0 && st.st_size == spool->config.segment_size) {
+        return ESP_OK;
+    }
+
+    ESP_LOGI(TAG, "allocating %s, %ld bytes", path, (long)spool->config.segment_size);
+
+    // the allocated clusters keep stale data, records are told apart by magic, generation and CRC
+    FILE *file = sdcard_io_open(path, "wb");
+    if (file == NULL) {
+        ESP_LOGE(TAG, "Failed to create %s", path);
+        return ESP_FAIL;
+    }
+
+    bool ok = fseek(file, spool->config.segment_size - 1, SEEK_SET) == 0 && fputc(0, file) != EOF && sync_file(file);
+    fclose(file);
+
+    if (!ok) {
+        ESP_LOGE(TAG, "Failed to allocate %s", path);
+        unlink(path);
+        return ESP_FAIL;
+    }
+
+    return ESP_OK;
+}
+
+static uint32_t read_segment_generation(sdcard_spool_handle spool, uint32_t index) {
+    char path[SPOOL_PATH_MAX];
+    segment_path(spool, index, path);
+
+    FILE *file = sdcard_io_open(path, "rb");
+    if (file == NULL) {
+        return 0;
+    }
+
+    spool_segment_header header;
+    bool ok = read_at(file, 0, &header, sizeof(header));
+    fclose(file);
+
+    if (!ok || header.magic != SPOOL_SEGMENT_MAGIC || header.crc != segment_crc(&header) ||
+        segment_index(spool, header.generation) != index) {
+        return 0;
+    }
+
+    return header.generation;
+}
+
+// --------------------- cursor ---------------------------------------------
+static bool cursor_valid(sdcard_spool_handle spool, spool_position at) {
+    if (at.generation == 0 || at.generation > spool->head.generation ||
+        spool->generations[segment_index(spool, at.generation)] != at.generation ||
+        at.offset < sizeof(spool_segment_header) || at.offset > spool->config.segment_size) {
+        return false;
+    }
+
+    return at.generation < spool->head.generation || at.offset <= spool->head.offset;
+}
+
+static esp_err_t save_cursor(sdcard_spool_handle spool) {
+    char path[SPOOL_PATH_MAX];
+    cursor_path(spool, path);
+
+    // missing until the first consume, a file without a valid slot is rewritten as well
+    FILE *file = spool->cursor_sequence > 0 ? sdcard_io_open(path, "r+b") : NULL;
+    if (file == NULL) {
+        file = sdcard_io_open(path, "w+b");
+    }
+    if (file == NULL) {
+        ESP_LOGE(TAG, "Failed to open %s", path);
+        return ESP_FAIL;
+    }
+
+    spool_cursor_slot slot = {
+        .sequence = spool->cursor_sequence + 1,
+        .generation = spool->cursor.generation,
+        .offset = spool->cursor.offset,
+    };
+    slot.crc = cursor_crc(&slot);
+
+    bool ok = fseek(file, (slot.sequence & 1) * sizeof(slot), SEEK_SET) == 0 &&
+              sdcard_io_write(&slot, sizeof(slot), file) == sizeof(slot) && sync_file(file);
+    fclose(file);
+
+    if (!ok) {
+        ESP_LOGE(TAG, "Failed to write %s", path);
+        return ESP_FAIL;
+    }
+
+    spool->cursor_sequence = slot.sequence;
+
+    return ESP_OK;
+}
+
+static void load_cursor(sdcard_spool_handle spool, uint32_t oldest) {
+    char path[SPOOL_PATH_MAX];
+    cursor_path(spool, path);
+
+    spool_cursor_slot slots[2];
+    memset(slots, 0, sizeof(slots));
+
+    // a missing file is not counted as a failed open
+    struct stat st;
+    FILE *file = stat(path, &st) == 0 ? sdcard_io_open(path, "rb") : NULL;
+    if (file != NULL) {
+        sdcard_io_read(slots, sizeof(slots), file);
+        fclose(file);
+    }
+
+    const spool_cursor_slot *newest = NULL;
+    for (int i = 0; i < 2; i++) {
+        if (slots[i].crc == cursor_crc(&slots[i]) && slots[i].sequence > 0 &&
+            (newest == NULL || (int32_t)(slots[i].sequence - newest->sequence) > 0)) {
+            newest = &slots[i];
+        }
+    }
+
+    if (newest != NULL) {
+        spool->cursor_sequence = newest->sequence;
+        spool->cursor = (spool_position){newest->generation, newest->offset};
+
+        // consumed past a torn tail that recovery dropped
+        if (spool->cursor.generation == spool->head.generation && spool->cursor.offset > spool->head.offset) {
+            spool->cursor = spool->head;
+        }
+    }
+
+    if (spool->head.generation == 0) {
+        spool->cursor = spool->head;
+    } else if (newest == NULL || !cursor_valid(spool, spool->cursor)) {
+        // the segment it pointed into was reused, everything still on the card is pending
+        if (newest != NULL) {
+            ESP_LOGW(TAG, "cursor %ld:%ld is stale, restarting at segment %ld", (long)spool->cursor.generation,
+                     (long)spool->cursor.offset, (long)oldest);
+        }
+        spool->cursor = (spool_position){oldest, sizeof(spool_segment_header)};
+    }
+}
+
+// moves the cursor onto the next record, across segment ends, ESP_ERR_NOT_FOUND when nothing is pending.
+// an I/O error leaves the cursor where it is, the segment is not given up on
+static esp_err_t advance_cursor(sdcard_spool_handle spool, spool_record_header *header) {
+    while (!is_empty(spool)) {
+        FILE *file = segment_file(spool, spool->cursor.generation);
+        esp_err_t ret = read_record_header(spool, file, spool->cursor, header);
+        if (ret == ESP_FAIL) {
+            close_read_file(spool);
+        }
+        if (ret != ESP_ERR_NOT_FOUND) {
+            return ret;
+        }
+
+        if (spool->cursor.generation == spool->head.generation) {
+            spool->cursor = spool->head;
+            break;
+        }
+
+        // end of an older segment, continue with the next one still on the card
+        uint32_t next = spool->cursor.generation + 1;
+        while (next < spool->head.generation && spool->generations[segment_index(spool, next)] != next) {
+            next++;
+        }
+        spool->cursor = (spool_position){next, sizeof(spool_segment_header)};
+    }
+
+    close_read_file(spool);
+
+    return ESP_ERR_NOT_FOUND;
+}
+
+// --------------------- recovery -------------------------------------------
+// the id and its CRC, a damaged file gets a new id like a fresh spool
+static esp_err_t load_id(sdcard_spool_handle spool) {
+    char path[SPOOL_PATH_MAX];
+    id_path(spool, path);
+
+    uint32_t stored[2] = {0, 0};
+    struct stat st;
+    FILE *file = stat(path, &st) == 0 ? sdcard_io_open(path, "rb") : NULL;
+    if (file != NULL) {
+        sdcard_io_read(stored, sizeof(stored), file);
+        fclose(file);
+    }
+
+    if (stored[0] != 0 && stored[1] == esp_rom_crc32_le(0, (const uint8_t *)&stored[0], sizeof(stored[0]))) {
+        spool->id = stored[0];
+        return ESP_OK;
+    }
+
+    do {
+        stored[0] = esp_random();
+    } while (stored[0] == 0);
+    stored[1] = esp_rom_crc32_le(0, (const uint8_t *)&stored[0], sizeof(stored[0]));
+
+    file = sdcard_io_open(path, "wb");
+    bool ok = file != NULL && sdcard_io_write(stored, sizeof(stored), file) == sizeof(stored) && sync_file(file);
+    if (file != NULL) {
+        fclose(file);
+    }
+
+    if (!ok) {
+        ESP_LOGE(TAG, "Failed to write %s", path);
+        return ESP_FAIL;
+    }
+
+    spool->id = stored[0];
+
+    return ESP_OK;
+}
+
+static esp_err_t open_head(sdcard_spool_handle spool) {
+    char path[SPOOL_PATH_MAX];
+    segment_path(spool, segment_index(spool, spool->head.generation), path);
+
+    spool->head_file = sdcard_io_open(path, "r+b");
+    if (spool->head_file == NULL) {
+        ESP_LOGE(TAG, "Failed to open %s", path);
+        return ESP_FAIL;
+    }
+
+    return ESP_OK;
+}
+
+// the head ends at the first record that is torn or fails its CRC, the next append overwrites it
+static esp_err_t recover(sdcard_spool_handle spool) {
+    uint32_t newest = 0;
+    uint32_t oldest = 0;
+
+    for (uint32_t i = 0; i < spool->config.segment_count; i++) {
+        uint32_t generation = read_segment_generation(spool, i);
+        spool->generations[i] = generation;
+        if (generation > newest) {
+            newest = generation;
+        }
+        if (generation > 0 && (oldest == 0 || generation < oldest)) {
+            oldest = generation;
+        }
+    }
+
+    spool->head = (spool_position){newest, sizeof(spool_segment_header)};
+
+    if (newest > 0) {
+        esp_err_t ret = open_head(spool);
+        if (ret != ESP_OK) {
+            return ret;
+        }
+
+        spool_record_header header;
+        while (read_record_header(spool, spool->head_file, spool->head, &header) == ESP_OK &&
+               verify_record(spool, spool->head_file, spool->head, &header) == ESP_OK) {
+            spool->head.offset += record_stride(header.length);
+        }
+    }
+
+    load_cursor(spool, oldest);
+
+    ESP_LOGI(TAG, "%s: head %ld:%ld, cursor %ld:%ld", spool->dir, (long)spool->head.generation, (long)spool->head.offset,
+             (long)spool->cursor.generation, (long)spool->cursor.offset);
+
+    return ESP_OK;
+}
+
+// --------------------- public api -----------------------------------------
+static void spool_free(sdcard_spool_handle spool) {
+    close_read_file(spool);
+    if (spool->head_file != NULL) {
+        fclose(spool->head_file);
+    }
+    if (spool->lock != NULL) {
+        vSemaphoreDelete(spool->lock);
+    }
+    free(spool->scratch);
+    free(spool->generations);
+    free(spool->dir);
+    free(spool);
+}
+
+sdcard_spool_handle sdcard_spool_open(sdcard_spool_config config) {
+    if (config.dir == NULL || config.segment_count < 2 ||
+        config.segment_size < sizeof(spool_segment_header) + record_stride(1)) {
+        ESP_LOGE(TAG, "Invalid spool configuration");
+        return NULL;
+    }
+
+    sdcard_spool_handle spool = calloc(1, sizeof(struct sdcard_spool));
+    if (spool == NULL) {
+        ESP_LOGE(TAG, "Failed to allocate spool");
+        return NULL;
+    }
+
+    spool->config = config;
+    spool->dir = strdup(config.dir);
+    spool->lock = xSemaphoreCreateMutex();
+    spool->generations = calloc(config.segment_count, sizeof(uint32_t));
+    spool->scratch = malloc(SPOOL_SCRATCH_SIZE);
+    if (spool->dir == NULL || spool->lock == NULL || spool->generations == NULL || spool->scratch == NULL) {
+        ESP_LOGE(TAG, "Failed to allocate spool");
+        spool_free(spool);
+        return NULL;
+    }
+    spool->config.dir = spool->dir;
+
+    if (mkdir(spool->dir, 0775) != 0 && errno != EEXIST) {
+        ESP_LOGE(TAG, "Failed to create %s [ %d ]", spool->dir, errno);
+        spool_free(spool);
+        return NULL;
+    }
+
+    if (load_id(spool) != ESP_OK) {
+        spool_free(spool);
+        return NULL;
+    }
+
+    for (uint32_t i = 0; i < config.segment_count; i++) {
+        if (prepare_segment(spool, i) != ESP_OK) {
+            spool_free(spool);
+            return NULL;
+        }
+    }
+
+    if (recover(spool) != ESP_OK) {
+        spool_free(spool);
+        return NULL;
+    }
+
+    spool->stats.segment_count = config.segment_count;
+
+    return spool;
+}
+
+void sdcard_spool_close(sdcard_spool_handle spool) {
+    if (spool == NULL) {
+        return;
+    }
+
+    // the caller makes sure no other task still uses the spool
+    spool_free(spool);
+}
+
+void sdcard_spool_set_append_callback(sdcard_spool_handle spool, sdcard_spool_callback callback, void *arg) {
+    xSemaphoreTake(spool->lock, portMAX_DELAY);
+    spool->on_append = callback;
+    spool->on_append_arg = arg;
+    xSemaphoreGive(spool->lock);
+}
+
+// switches the head to the next segment file, refused while that file still holds pending records
+static esp_err_t start_segment(sdcard_spool_handle spool) {
+    uint32_t generation = spool->head.generation + 1;
+    uint32_t index = segment_index(spool, generation);
+    uint32_t previous = spool->generations[index];
+
+    spool_record_header header;
+    if (previous > 0 && advance_cursor(spool, &header) != ESP_ERR_NOT_FOUND && spool->cursor.generation <= previous) {
+        return ESP_ERR_NO_MEM;
+    }
+
+    if (spool->read_file != NULL && spool->read_generation == previous) {
+        close_read_file(spool);
+    }
+    if (spool->head_file != NULL) {
+        fclose(spool->head_file);
+        spool->head_file = NULL;
+    }
+
+    bool was_empty = is_empty(spool);
+
+    spool->head = (spool_position){generation, sizeof(spool_segment_header)};
+    spool->generations[index] = 0;
+
+    esp_err_t ret = open_head(spool);
+    if (ret != ESP_OK) {
+        return ret;
+    }
+
+    spool_segment_header segment = {
+        .magic = SPOOL_SEGMENT_MAGIC,
+        .generation = generation,
+    };
+    segment.crc = segment_crc(&segment);
+
+    if (fseek(spool->head_file, 0, SEEK_SET) != 0 || sdcard_io_write(&segment, sizeof(segment), spool->head_file) != sizeof(segment) ||
+        !sync_file(spool->head_file)) {
+        ESP_LOGE(TAG, "Failed to start segment %ld", (long)generation);
+        fclose(spool->head_file);
+        spool->head_file = NULL;
+        return ESP_FAIL;
+    }
+
+    spool->generations[index] = generation;
+
+    if (was_empty) {
+        spool->cursor = spool->head;
+    }
+
+    return ESP_OK;
+}
+
+esp_err_t sdcard_spool_append(sdcard_spool_handle spool, const void *data, uint32_t len) {
+    if (spool == NULL || (data == NULL && len > 0)) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    uint32_t stride = record_stride(len);
+    if (sizeof(spool_segment_header) + stride > spool->config.segment_size) {
+        ESP_LOGE(TAG, "%ld bytes record does not fit a segment", (long)len);
+        return ESP_ERR_INVALID_SIZE;
+    }
+
+    spool_record_header header = {
+        .magic = SPOOL_RECORD_MAGIC,
+        .length = len,
+        .timestamp = (uint32_t)time(NULL),
+    };
+
+    xSemaphoreTake(spool->lock, portMAX_DELAY);
+
+    esp_err_t ret = ESP_OK;
+    // no head yet, or the last attempt to start one failed
+    if (spool->head_file == NULL || spool->head.offset + stride > spool->config.segment_size) {
+        ret = start_segment(spool);
+    }
+
+    if (ret == ESP_OK) {
+        header.generation = spool->head.generation;
+        header.crc = esp_rom_crc32_le(0, (const uint8_t *)&header, offsetof(spool_record_header, crc));
+        header.crc = esp_rom_crc32_le(header.crc, data, len);
+
+        static const uint8_t padding[3] = {0};
+        uint32_t pad = stride - sizeof(header) - len;
+
+        // synced before the head moves, a crash in between leaves a record that fails its CRC
+        FILE *file = spool->head_file;
+        bool ok = fseek(file, spool->head.offset, SEEK_SET) == 0 && sdcard_io_write(&header, sizeof(header), file) == sizeof(header) &&
+                  sdcard_io_write(data, len, file) == len && sdcard_io_write(padding, pad, file) == pad && sync_file(file);
+        if (ok) {
+            spool->head.offset += stride;
+            spool->stats.appended++;
+        } else {
+            ESP_LOGE(TAG, "Failed to append %ld bytes [ %d ]", (long)len, errno);
+            ret = ESP_FAIL;
+        }
+    } else if (ret == ESP_ERR_NO_MEM) {
+        spool->stats.full++;
+        ESP_LOGW(TAG, "spool full, %ld bytes record refused", (long)len);
+    }
+
+    sdcard_spool_callback callback = spool->on_append;
+    void *arg = spool->on_append_arg;
+
+    xSemaphoreGive(spool->lock);
+
+    if (ret == ESP_OK && callback != NULL) {
+        callback(arg);
+    }
+
+    return ret;
+}
+
+esp_err_t sdcard_spool_peek(sdcard_spool_handle spool, sdcard_spool_record *record) {
+    if (spool == NULL || record == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    xSemaphoreTake(spool->lock, portMAX_DELAY);
+
+    esp_err_t ret;
+    spool_record_header header;
+
+    while ((ret = advance_cursor(spool, &header)) == ESP_OK) {
+        FILE *file = segment_file(spool, spool->cursor.generation);
+        ret = verify_record(spool, file, spool->cursor, &header);
+        if (ret == ESP_OK) {
+            record->spool_id = spool->id;
+            record->generation = spool->cursor.generation;
+            record->offset = spool->cursor.offset;
+            record->length = header.length;
+            record->timestamp = header.timestamp;
+            break;
+        }
+
+        // the record may be fine, it is read again on the next peek
+        if (ret == ESP_FAIL) {
+            ESP_LOGW(TAG, "record %ld:%ld could not be read", (long)spool->cursor.generation, (long)spool->cursor.offset);
+            close_read_file(spool);
+            break;
+        }
+
+        // a damaged record would block the queue forever, it is skipped
+        ESP_LOGW(TAG, "record %ld:%ld fails its CRC, skipped", (long)spool->cursor.generation, (long)spool->cursor.offset);
+        spool->cursor.offset += record_stride(header.length);
+        spool->stats.corrupt++;
+        save_cursor(spool);
+    }
+
+    xSemaphoreGive(spool->lock);
+
+    return ret;
+}
+
+int sdcard_spool_read(sdcard_spool_handle spool, const sdcard_spool_record *record, uint32_t offset, void *data, uint32_t len) {
+    if (spool == NULL || record == NULL || data == NULL || offset > record->length) {
+        return -1;
+    }
+
+    if (len > record->length - offset) {
+        len = record->length - offset;
+    }
+
+    xSemaphoreTake(spool->lock, portMAX_DELAY);
+
+    FILE *file = segment_file(spool, record->generation);
+    bool ok = file != NULL && read_at(file, record->offset + sizeof(spool_record_header) + offset, data, len);
+
+    xSemaphoreGive(spool->lock);
+
+    return ok ? (int)len : -1;
+}
+
+static esp_err_t pass_record(sdcard_spool_handle spool, const sdcard_spool_record *record, uint32_t *counter) {
+    if (spool == NULL || record == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    xSemaphoreTake(spool->lock, portMAX_DELAY);
+
+    esp_err_t ret = ESP_ERR_INVALID_STATE;
+    if (record->generation == spool->cursor.generation && record->offset == spool->cursor.offset) {
+        spool->cursor.offset += record_stride(record->length);
+        (*counter)++;
+        ret = save_cursor(spool);
+    }
+
+    xSemaphoreGive(spool->lock);
+
+    return ret;
+}
+
+esp_err_t sdcard_spool_consume(sdcard_spool_handle spool, const sdcard_spool_record *record) {
+    return pass_record(spool, record, spool != NULL ? &spool->stats.consumed : NULL);
+}
+
+esp_err_t sdcard_spool_skip(sdcard_spool_handle spool, const sdcard_spool_record *record) {
+    return pass_record(spool, record, spool != NULL ? &spool->stats.corrupt : NULL);
+}
+
+void sdcard_spool_get_stats(sdcard_spool_handle spool, sdcard_spool_stats *stats) {
+    xSemaphoreTake(spool->lock, portMAX_DELAY);
+
+    *stats = spool->stats;
+    stats->segments_pending = is_empty(spool) ? 0 : spool->head.generation - spool->cursor.generation + 1;
+
+    xSemaphoreGive(spool->lock);
+}
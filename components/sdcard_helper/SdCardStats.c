@@ -0,0 +1,199 @@
+#include "SdCardInternal.h"
+
+#include <string.h>
+
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+
+static const char *TAG = "SdCard Stats >>> ";
+
+static sdcard_stats stats;
+static portMUX_TYPE stats_lock = portMUX_INITIALIZER_UNLOCKED;
+
+static int bucket_index(uint32_t duration_us) {
+    int index = 0;
+    while (duration_us >= 128 && index < SDCARD_STATS_BUCKETS - 1) {
+        duration_us >>= 1;
+        index++;
+    }
+
+    return index;
+}
+
+void sdcard_stats_record(sdcard_op op, int64_t start_us, uint32_t bytes) {
+    int64_t elapsed = esp_timer_get_time() - start_us;
+    uint32_t duration_us = elapsed > UINT32_MAX ? UINT32_MAX : (uint32_t)elapsed;
+    int bucket = bucket_index(duration_us);
+
+    portENTER_CRITICAL(&stats_lock);
+
+    sdcard_latency_histogram *histogram = &stats.ops[op];
+    histogram->count++;
+    histogram->total_us += duration_us;
+    histogram->buckets[bucket]++;
+    if (duration_us > histogram->max_us) {
+        histogram->max_us = duration_us;
+    }
+
+    if (op == SDCARD_OP_WRITE) {
+        stats.bytes_written += bytes;
+    } else if (op == SDCARD_OP_READ) {
+        stats.bytes_read += bytes;
+    }
+
+    portEXIT_CRITICAL(&stats_lock);
+}
+
+// called with the lock held
+static sdcard_errno_count *find_errno(int err) {
+    for (int i = 0; i < stats.errno_count; i++) {
+        if (stats.errnos[i].err == err) {
+            return &stats.errnos[i];
+        }
+    }
+
+    if (stats.errno_count < SDCARD_STATS_ERRNO_SLOTS - 1) {
+        sdcard_errno_count *slot = &stats.errnos[stats.errno_count++];
+        slot->err = err;
+        return slot;
+    }
+
+    // table full, everything else lands in the last slot
+    sdcard_errno_count *other = &stats.errnos[SDCARD_STATS_ERRNO_SLOTS - 1];
+    if (stats.errno_count < SDCARD_STATS_ERRNO_SLOTS) {
+        stats.errno_count = SDCARD_STATS_ERRNO_SLOTS;
+        other->err = -1;
+    }
+
+    return other;
+}
+
+void sdcard_stats_error(sdcard_op op, int err) {
+    portENTER_CRITICAL(&stats_lock);
+    stats.ops[op].errors++;
+    find_errno(err)->count++;
+    portEXIT_CRITICAL(&stats_lock);
+}
+
+// kept across resets, a failed mount is what the counters are meant to explain
+void sdcard_stats_mount_failed(esp_err_t err) {
+    portENTER_CRITICAL(&stats_lock);
+    stats.mount_failures++;
+    stats.last_mount_error = err;
+    portEXIT_CRITICAL(&stats_lock);
+}
+
+void sdcard_stats_snapshot(SdCard *card, sdcard_stats *snapshot) {
+    portENTER_CRITICAL(&stats_lock);
+    *snapshot = stats;
+    portEXIT_CRITICAL(&stats_lock);
+
+    snapshot->mounted = card != NULL && !card->err && card->card != NULL;
+    if (!snapshot->mounted) {
+        return;
+    }
+
+    snapshot->real_freq_khz = card->card->real_freq_khz;
+    snapshot->cid = card->card->cid;
+    snapshot->csd = card->card->csd;
+
+    // walks the FAT on the first call after mounting, later calls use the cached free count
+    esp_err_t ret = esp_vfs_fat_info(card->config.mount_point, &snapshot->total_bytes, &snapshot->free_bytes);
+    if (ret != ESP_OK) {
+        ESP_LOGW(TAG, "Failed to read free space: %s", esp_err_to_name(ret));
+    }
+}
+
+void sdcard_stats_reset() {
+    portENTER_CRITICAL(&stats_lock);
+
+    uint32_t mount_failures = stats.mount_failures;
+    esp_err_t last_mount_error = stats.last_mount_error;
+
+    memset(&stats, 0, sizeof(stats));
+    stats.mount_failures = mount_failures;
+    stats.last_mount_error = last_mount_error;
+
+    portEXIT_CRITICAL(&stats_lock);
+}
+
+uint32_t sdcard_stats_percentile_us(const sdcard_latency_histogram *histogram, uint32_t permille) {
+    if (histogram->count == 0) {
+        return 0;
+    }
+
+    uint64_t target = ((uint64_t)histogram->count * permille + 999) / 1000;
+    uint64_t seen = 0;
+
+    for (int i = 0; i < SDCARD_STATS_BUCKETS - 1; i++) {
+        seen += histogram->buckets[i];
+        if (seen >= target) {
+            uint32_t bound = 128u << i;
+            return bound < histogram->max_us ? bound : histogram->max_us;
+        }
+    }
+
+    return histogram->max_us;
+}
+
+// --------------------- timed stdio ----------------------------------------
+FILE *sdcard_io_open(const char *path, const char *mode) {
+    int64_t start = esp_timer_get_time();
+    FILE *file = fopen(path, mode);
+    if (file != NULL) {
+        sdcard_stats_record(SDCARD_OP_OPEN, start, 0);
+    } else {
+        sdcard_stats_error(SDCARD_OP_OPEN, errno);
+    }
+
+    return file;
+}
+
+size_t sdcard_io_read(void *data, size_t len, FILE *file) {
+    int64_t start = esp_timer_get_time();
+    size_t n = fread(data, 1, len, file);
+    if (n == len) {
+        sdcard_stats_record(SDCARD_OP_READ, start, n);
+    } else if (ferror(file)) {
+        sdcard_stats_error(SDCARD_OP_READ, errno);
+    }
+
+    return n;
+}
+
+size_t sdcard_io_write(const void *data, size_t len, FILE *file) {
+    int64_t start = esp_timer_get_time();
+    size_t n = fwrite(data, 1, len, file);
+    if (n == len) {
+        sdcard_stats_record(SDCARD_OP_WRITE, start, n);
+    } else {
+        sdcard_stats_error(SDCARD_OP_WRITE, errno);
+    }
+
+    return n;
+}
+
+int sdcard_io_sync(FILE *file) {
+    int64_t start = esp_timer_get_time();
+    int ret = fflush(file) == 0 ? fsync(fileno(file)) : -1;
+    if (ret == 0) {
+        sdcard_stats_record(SDCARD_OP_SYNC, start, 0);
+    } else {
+        sdcard_stats_error(SDCARD_OP_SYNC, errno);
+    }
+
+    return ret;
+}
+
+int sdcard_io_rename(const char *from, const char *to) {
+    int64_t start = esp_timer_get_time();
+    int ret = rename(from, to);
+    if (ret == 0) {
+        sdcard_stats_record(SDCARD_OP_RENAME, start, 0);
+    } else if (errno != EEXIST) {
+        // EEXIST is FAT asking for the target to be removed first, not a card problem
+        sdcard_stats_error(SDCARD_OP_RENAME, errno);
+    }
+
+    return ret;
+}
@@ -0,0 +1,414 @@
+#include "SdCardInternal.h"
+
+#include <string.h>
+#include <sys/stat.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+
+static const char *TAG = "SdCard Writer >>> ";
+
+typedef enum {
+    JOB_OPEN = 0,
+    JOB_WRITE,
+    JOB_WRITE_AT,
+    JOB_FLUSH,
+    JOB_CLOSE,
+} writer_job_type;
+
+typedef struct {
+    writer_job_type type;
+    sdcard_writer_file_handle file;
+    uint8_t *buffer;  // pool buffer, returned by the task once written
+    uint32_t len;
+    uint32_t offset;
+} writer_job;
+
+struct sdcard_writer_file {
+    FILE *file;
+    char *path;
+    char mode[4];
+
+    // caller side, the cluster buffer being filled
+    uint8_t *pending;
+    uint32_t pending_len;
+    uint32_t pending_capacity;
+    uint32_t size;  // end of the file once everything handed over is written
+
+    // task side
+    uint32_t unsynced;
+    esp_err_t flush_result;
+    SemaphoreHandle_t flushed;
+
+    volatile bool failed;
+};
+
+static QueueHandle_t volatile job_queue = NULL;
+static QueueHandle_t free_buffers = NULL;
+static sdcard_writer_config writer_config;
+
+// only one init runs, it is claimed again when it fails
+static portMUX_TYPE init_lock = portMUX_INITIALIZER_UNLOCKED;
+static volatile bool init_claimed = false;
+
+// every open file may hold one pending buffer, with no more files than buffers a writer waiting
+// for one only waits on buffers already queued to the task
+static portMUX_TYPE files_lock = portMUX_INITIALIZER_UNLOCKED;
+static int open_files = 0;
+
+// --------------------- writer task ----------------------------------------
+static void fail(sdcard_writer_file_handle file, const char *what) {
+    if (!file->failed) {
+        ESP_LOGE(TAG, "%s failed on %s [ %d ]", what, file->path, errno);
+    }
+    file->failed = true;
+}
+
+static void sync_file(sdcard_writer_file_handle file) {
+    if (file->file != NULL && !file->failed && sdcard_io_sync(file->file) != 0) {
+        fail(file, "fsync");
+    }
+    file->unsynced = 0;
+}
+
+static void write_job(writer_job *job) {
+    sdcard_writer_file_handle file = job->file;
+
+    if (file->file != NULL && !file->failed) {
+        bool positioned = job->type == JOB_WRITE || fseek(file->file, job->offset, SEEK_SET) == 0;
+        if (!positioned || sdcard_io_write(job->buffer, job->len, file->file) != job->len) {
+            fail(file, "write");
+        }
+
+        // back to the end for the writes that follow
+        if (job->type == JOB_WRITE_AT && fseek(file->file, 0, SEEK_END) != 0) {
+            fail(file, "seek");
+        }
+    }
+
+    xQueueSend(free_buffers, &job->buffer, portMAX_DELAY);
+
+    file->unsynced += job->len;
+    if (writer_config.fsync_policy == SDCARD_FSYNC_EVERY_WRITE ||
+        (writer_config.fsync_policy == SDCARD_FSYNC_INTERVAL && file->unsynced >= writer_config.fsync_bytes)) {
+        sync_file(file);
+    }
+}
+
+static void file_free(sdcard_writer_file_handle file) {
+    if (file->flushed != NULL) {
+        vSemaphoreDelete(file->flushed);
+    }
+    free(file->path);
+    free(file);
+}
+
+static void sdcard_writer_task(void *arg) {
+    // the queue is handed over, the task starts before it is published
+    QueueHandle_t jobs = (QueueHandle_t)arg;
+    writer_job job;
+
+    while (true) {
+        if (xQueueReceive(jobs, &job, portMAX_DELAY) != pdTRUE) {
+            continue;
+        }
+
+        sdcard_writer_file_handle file = job.file;
+
+        switch (job.type) {
+            case JOB_OPEN:
+                file->file = sdcard_io_open(file->path, file->mode);
+                if (file->file == NULL) {
+                    fail(file, "open");
+                    break;
+                }
+
+                // writes already come in whole clusters, stdio buffering would only add a copy
+                setvbuf(file->file, NULL, _IONBF, 0);
+                break;
+
+            case JOB_WRITE:
+            case JOB_WRITE_AT:
+                write_job(&job);
+                break;
+
+            case JOB_FLUSH:
+                sync_file(file);
+                file->flush_result = file->failed ? ESP_FAIL : ESP_OK;
+                xSemaphoreGive(file->flushed);
+                break;
+
+            case JOB_CLOSE:
+                if (file->file != NULL && fclose(file->file) != 0) {
+                    fail(file, "close");
+                }
+                ESP_LOGD(TAG, "closed %s, %ld bytes%s", file->path, (long)file->size, file->failed ? ", write failed" : "");
+                file_free(file);
+                break;
+        }
+    }
+}
+
+static void release_init() {
+    portENTER_CRITICAL(&init_lock);
+    init_claimed = false;
+    portEXIT_CRITICAL(&init_lock);
+}
+
+esp_err_t sdcard_writer_init(sdcard_writer_config config) {
+    if (config.buffer_count <= 0 || config.cluster_size < 0) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    // whole allocation units, so no write straddles two clusters
+    if (config.cluster_size == 0) {
+        uint32_t unit = sdcard_allocation_unit();
+        config.cluster_size = unit > 0 ? unit : SDCARD_WRITER_CLUSTER_SIZE_DEFAULT;
+        if (config.cluster_size > SDCARD_WRITER_CLUSTER_SIZE_MAX) {
+            config.cluster_size = SDCARD_WRITER_CLUSTER_SIZE_MAX;
+        }
+    }
+
+    portENTER_CRITICAL(&init_lock);
+    bool claimed = !init_claimed;
+    init_claimed = true;
+    portEXIT_CRITICAL(&init_lock);
+
+    if (!claimed) {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    // one reservation for all buffers, DMA capable when possible
+    size_t total = (size_t)config.buffer_count * config.cluster_size;
+    uint8_t *memory = heap_caps_malloc(total, config.caps);
+    if (memory == NULL) {
+        memory = heap_caps_malloc(total, MALLOC_CAP_DEFAULT);
+    }
+
+    // control jobs queue up behind a full set of buffers without blocking
+    QueueHandle_t jobs = xQueueCreate(config.buffer_count + 8, sizeof(writer_job));
+    QueueHandle_t buffers = xQueueCreate(config.buffer_count, sizeof(uint8_t *));
+    if (memory == NULL || jobs == NULL || buffers == NULL) {
+        ESP_LOGE(TAG, "Failed to allocate %d x %d bytes buffers", config.buffer_count, config.cluster_size);
+        heap_caps_free(memory);
+        if (jobs != NULL) {
+            vQueueDelete(jobs);
+        }
+        if (buffers != NULL) {
+            vQueueDelete(buffers);
+        }
+        release_init();
+        return ESP_ERR_NO_MEM;
+    }
+
+    for (int i = 0; i < config.buffer_count; i++) {
+        uint8_t *buffer = memory + (size_t)i * config.cluster_size;
+        xQueueSend(buffers, &buffer, 0);
+    }
+
+    writer_config = config;
+    free_buffers = buffers;
+
+    // nothing is queued until job_queue is published, so a failed start leaves no caller waiting on it
+    if (xTaskCreatePinnedToCore(&sdcard_writer_task, "sd_writer", config.stack_size, jobs, config.priority, NULL, config.core_id) != pdPASS) {
+        ESP_LOGE(TAG, "Failed to start writer task");
+        free_buffers = NULL;
+        vQueueDelete(jobs);
+        vQueueDelete(buffers);
+        heap_caps_free(memory);
+        release_init();
+        return ESP_FAIL;
+    }
+
+    job_queue = jobs;
+
+    ESP_LOGI(TAG, "writer started, %d x %d bytes buffers on core %d", config.buffer_count, config.cluster_size, config.core_id);
+
+    return ESP_OK;
+}
+
+// --------------------- caller side ----------------------------------------
+static void submit(writer_job_type type, sdcard_writer_file_handle file, uint8_t *buffer, uint32_t len, uint32_t offset) {
+    writer_job job = {
+        .type = type,
+        .file = file,
+        .buffer = buffer,
+        .len = len,
+        .offset = offset,
+    };
+
+    xQueueSend(job_queue, &job, portMAX_DELAY);
+}
+
+static void submit_pending(sdcard_writer_file_handle file) {
+    if (file->pending == NULL) {
+        return;
+    }
+
+    if (file->pending_len > 0) {
+        submit(JOB_WRITE, file, file->pending, file->pending_len, 0);
+    } else {
+        xQueueSend(free_buffers, &file->pending, portMAX_DELAY);
+    }
+
+    file->pending = NULL;
+}
+
+// starts the task on first use, a concurrent first open waits for the init already running
+static bool writer_started() {
+    if (job_queue == NULL) {
+        sdcard_writer_init((sdcard_writer_config)SDCARD_WRITER_CONFIG_DEFAULT());
+
+        while (job_queue == NULL && init_claimed) {
+            vTaskDelay(1);
+        }
+    }
+
+    return job_queue != NULL;
+}
+
+static bool reserve_file(int delta) {
+    portENTER_CRITICAL(&files_lock);
+    bool reserved = delta < 0 || open_files < writer_config.buffer_count;
+    if (reserved) {
+        open_files += delta;
+    }
+    portEXIT_CRITICAL(&files_lock);
+
+    return reserved;
+}
+
+sdcard_writer_file_handle sdcard_writer_open(const char *path, const char *mode) {
+    // writes follow each other from the end of the file, which an "r+" position would not
+    if (path == NULL || mode == NULL || (mode[0] != 'w' && mode[0] != 'a')) {
+        ESP_LOGE(TAG, "Invalid mode for %s, only \"w\" and \"a\" are supported", path != NULL ? path : "");
+        return NULL;
+    }
+
+    if (!writer_started()) {
+        return NULL;
+    }
+
+    if (!reserve_file(1)) {
+        ESP_LOGE(TAG, "Failed to open %s, %d files already open", path, writer_config.buffer_count);
+        return NULL;
+    }
+
+    sdcard_writer_file_handle file = calloc(1, sizeof(struct sdcard_writer_file));
+    if (file == NULL) {
+        ESP_LOGE(TAG, "Failed to allocate file");
+        reserve_file(-1);
+        return NULL;
+    }
+
+    file->path = strdup(path);
+    file->flushed = xSemaphoreCreateBinary();
+    if (file->path == NULL || file->flushed == NULL) {
+        ESP_LOGE(TAG, "Failed to allocate file");
+        file_free(file);
+        reserve_file(-1);
+        return NULL;
+    }
+
+    strncpy(file->mode, mode, sizeof(file->mode) - 1);
+
+    // appended data continues the cluster alignment of what is already there
+    struct stat st;
+    if (mode[0] == 'a' && stat(path, &st) == 0) {
+        file->size = st.st_size;
+    }
+
+    submit(JOB_OPEN, file, NULL, 0, 0);
+
+    return file;
+}
+
+esp_err_t sdcard_writer_write(sdcard_writer_file_handle file, const void *data, uint32_t len) {
+    if (file == NULL || (data == NULL && len > 0)) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (file->failed) {
+        return ESP_FAIL;
+    }
+
+    const uint8_t *bytes = data;
+
+    while (len > 0) {
+        if (file->pending == NULL) {
+            xQueueReceive(free_buffers, &file->pending, portMAX_DELAY);
+            file->pending_len = 0;
+
+            // every buffer ends on a cluster boundary of the file
+            file->pending_capacity = writer_config.cluster_size - file->size % writer_config.cluster_size;
+        }
+
+        uint32_t n = file->pending_capacity - file->pending_len;
+        if (n > len) {
+            n = len;
+        }
+
+        memcpy(file->pending + file->pending_len, bytes, n);
+        file->pending_len += n;
+        file->size += n;
+        bytes += n;
+        len -= n;
+
+        if (file->pending_len == file->pending_capacity) {
+            submit_pending(file);
+        }
+    }
+
+    return ESP_OK;
+}
+
+esp_err_t sdcard_writer_write_at(sdcard_writer_file_handle file, uint32_t offset, const void *data, uint32_t len) {
+    if (file == NULL || data == NULL || len == 0 || len > writer_config.cluster_size) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    // O_APPEND ignores the seek, the patch would land at the end of the file
+    if (file->mode[0] == 'a') {
+        return ESP_ERR_INVALID_STATE;
+    }
+    if (file->failed) {
+        return ESP_FAIL;
+    }
+
+    submit_pending(file);
+
+    uint8_t *buffer;
+    xQueueReceive(free_buffers, &buffer, portMAX_DELAY);
+    memcpy(buffer, data, len);
+
+    submit(JOB_WRITE_AT, file, buffer, len, offset);
+
+    return ESP_OK;
+}
+
+esp_err_t sdcard_writer_flush(sdcard_writer_file_handle file) {
+    if (file == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    submit_pending(file);
+    submit(JOB_FLUSH, file, NULL, 0, 0);
+    xSemaphoreTake(file->flushed, portMAX_DELAY);
+
+    return file->flush_result;
+}
+
+esp_err_t sdcard_writer_close(sdcard_writer_file_handle file) {
+    if (file == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    bool failed = file->failed;
+
+    // the task frees the file once it is closed
+    submit_pending(file);
+    submit(JOB_CLOSE, file, NULL, 0, 0);
+    reserve_file(-1);
+
+    return failed ? ESP_FAIL : ESP_OK;
+}
@@ -1,3 +1,4 @@
+#include "esp_heap_caps.h"
 #include "esp_vfs.h"
 #include "esp_vfs_fat.h"
 #include "sdmmc_cmd.h"
@@ -5,6 +6,9 @@
 #ifndef __sdcard_h__
 #define __sdcard_h__
 
+// mount point plus a mount relative path, longer paths are refused rather than cut
+#define SDCARD_PATH_MAX 128
+
 typedef struct pin_config {
     int miso;
     int mosi;
@@ -12,28 +16,274 @@ typedef struct pin_config {
     int cs;
 } pin_config;
 
+// SD pins for the SDMMC host, d1..d3 are only used by the 4-bit bus
+typedef struct sdmmc_pin_config {
+    int clk;
+    int cmd;
+    int d0;
+    int d1;
+    int d2;
+    int d3;
+} sdmmc_pin_config;
+
+typedef enum {
+    SDCARD_BUS_SPI = 0,
+    SDCARD_BUS_SDMMC_1BIT,
+    SDCARD_BUS_SDMMC_4BIT,
+} sdcard_bus;
+
+// fields left at 0 keep the defaults
 typedef struct {
-    pin_config pin_mode;
-    int max_req_khz;
+    pin_config pin_mode;          // SPI pins
+    int max_req_khz;              // 0 keeps the host default, SDMMC_FREQ_HIGHSPEED for high speed cards
     char mount_point[10];
+    sdcard_bus bus;
+    sdmmc_pin_config sdmmc_pins;  // SDMMC pins, any GPIO on the S3
+    int max_transfer_sz;          // SPI DMA transfer size, default 8192
+    int max_files;                // open files at once, default 5
+    int allocation_unit_size;     // FAT cluster size when formatting, default 16 KB
 } sdcard_config;
 
 struct SdCard {
     void *data;
     sdmmc_card_t *card;
     sdmmc_host_t host;
-    sdcard_config *config;
+    sdcard_config config;
     bool err;
 };
 
 typedef struct SdCard SdCard;
 
+// Throughput benchmark on a mounted card, fields left at 0 keep the defaults
+typedef struct {
+    uint32_t file_size;   // test file, default 4 MB
+    uint32_t block_size;  // sequential transfer size, default 32 KB
+    uint32_t random_ops;  // 4 KB reads and writes at random offsets, default 256 each
+} sdcard_benchmark_config;
+
+typedef struct {
+    float seq_write_mbps;
+    float seq_read_mbps;
+    float rand_write_mbps;
+    float rand_read_mbps;
+} sdcard_benchmark_result;
+
+// Metadata benchmark, operations per second on small files
+typedef struct {
+    float create_per_s;   // create, write 512 bytes and close
+    float stat_per_s;
+    float rename_per_s;
+    float replace_per_s;  // sdcard_replace_file of 512 bytes
+    float unlink_per_s;
+} sdcard_file_ops_result;
+
+// Write-behind writer, one task owns the file I/O and callers only copy into queued cluster buffers
+typedef enum {
+    SDCARD_FSYNC_ON_CLOSE = 0,  // on flush and close only
+    SDCARD_FSYNC_INTERVAL,      // also after every fsync_bytes written
+    SDCARD_FSYNC_EVERY_WRITE,   // after every cluster write
+} sdcard_fsync_policy;
+
+typedef struct {
+    int buffer_count;      // cluster buffers in flight, also the limit of files open at once
+    int cluster_size;      // writes end on cluster boundaries, 0 uses sdcard_allocation_unit()
+    uint32_t caps;         // buffer memory, DMA capable memory spares the driver a bounce copy
+    sdcard_fsync_policy fsync_policy;
+    uint32_t fsync_bytes;  // with SDCARD_FSYNC_INTERVAL
+    int stack_size;
+    int priority;
+    int core_id;
+} sdcard_writer_config;
+
+// cluster size of the writer without a mounted card, and the largest taken from the card. bigger
+// allocation units are written in parts of this size, which still end on their boundaries
+#define SDCARD_WRITER_CLUSTER_SIZE_DEFAULT (16 * 1024)
+#define SDCARD_WRITER_CLUSTER_SIZE_MAX (32 * 1024)
+
+#define SDCARD_WRITER_CONFIG_DEFAULT()              \
+    {                                               \
+        .buffer_count = 4,                          \
+        .cluster_size = 0,                          \
+        .caps = MALLOC_CAP_DMA,                     \
+        .fsync_policy = SDCARD_FSYNC_ON_CLOSE,      \
+        .fsync_bytes = 256 * 1024,                  \
+        .stack_size = 4 * 1024,                     \
+        .priority = 4,                              \
+        .core_id = 0,                               \
+    }
+
+typedef struct sdcard_writer_file *sdcard_writer_file_handle;
+
+// Append-only spool of framed records (length, CRC32, timestamp, payload) in pre-allocated segment files.
+// Records stay on the card until a consumer has handed them on, the consumer cursor survives a reboot
+typedef struct {
+    const char *dir;         // created when missing, e.g. "/sdcard/spool"
+    uint32_t segment_size;   // a record never spans segments, so this bounds the record size
+    uint32_t segment_count;  // appends are refused once every segment holds pending records
+} sdcard_spool_config;
+
+#define SDCARD_SPOOL_CONFIG_DEFAULT()   \
+    {                                   \
+        .dir = "/sdcard/spool",         \
+        .segment_size = 1024 * 1024,    \
+        .segment_count = 16,            \
+    }
+
+// oldest pending record, valid until it is consumed.
+// spool_id, generation and offset name it uniquely on this device, also across a wiped spool
+typedef struct {
+    uint32_t spool_id;
+    uint32_t generation;
+    uint32_t offset;
+    uint32_t length;     // payload bytes
+    uint32_t timestamp;  // time() when it was appended
+} sdcard_spool_record;
+
+typedef struct {
+    uint32_t segment_count;
+    uint32_t segments_pending;  // holding records not consumed yet
+    uint32_t appended;          // since open
+    uint32_t consumed;
+    uint32_t corrupt;           // records skipped on a CRC mismatch or by sdcard_spool_skip
+    uint32_t full;              // appends refused for lack of a free segment
+} sdcard_spool_stats;
+
+typedef struct sdcard_spool *sdcard_spool_handle;
+
+typedef void (*sdcard_spool_callback)(void *arg);
+
+// Card health and I/O latency telemetry, collected from the helper's own file I/O
+typedef enum {
+    SDCARD_OP_OPEN = 0,
+    SDCARD_OP_READ,
+    SDCARD_OP_WRITE,
+    SDCARD_OP_SYNC,
+    SDCARD_OP_RENAME,
+    SDCARD_OP_COUNT,
+} sdcard_op;
+
+// bucket 0 counts durations below 128 us, bucket i below 2^(i + 7) us, the last one everything above
+#define SDCARD_STATS_BUCKETS 20
+#define SDCARD_STATS_ERRNO_SLOTS 8
+
+typedef struct {
+    uint32_t count;
+    uint32_t errors;
+    uint64_t total_us;
+    uint32_t max_us;
+    uint32_t buckets[SDCARD_STATS_BUCKETS];
+} sdcard_latency_histogram;
+
+typedef struct {
+    int err;  // errno, -1 in the last slot once the table is full
+    uint32_t count;
+} sdcard_errno_count;
+
+typedef struct {
+    sdcard_latency_histogram ops[SDCARD_OP_COUNT];
+    uint64_t bytes_written;
+    uint64_t bytes_read;
+    int errno_count;
+    sdcard_errno_count errnos[SDCARD_STATS_ERRNO_SLOTS];
+    uint32_t mount_failures;
+    esp_err_t last_mount_error;
+
+    // filled from the card passed to the snapshot
+    bool mounted;
+    uint64_t total_bytes;
+    uint64_t free_bytes;
+    int real_freq_khz;
+    sdmmc_cid_t cid;
+    sdmmc_csd_t csd;
+} sdcard_stats;
+
 #endif
 
 SdCard sdcard_mount(sdcard_config sdcard_config);
 
 void sdcard_unmount(SdCard *card);
 
+// cluster size of the mounted card in bytes, 0 when no card is mounted
+uint32_t sdcard_allocation_unit();
+
 void sdcard_delete_file(SdCard *card, const char *source_file_path);
 
-void sdcard_move_file(SdCard *card, const char *source_file_path, const char *destination_file_path);
\ No newline at end of file
+// both paths are relative to the mount point, an existing destination is replaced
+void sdcard_move_file(SdCard *card, const char *source_file_path, const char *destination_file_path);
+
+// builds "<mount point>/<relative>" into path, ESP_ERR_INVALID_SIZE when it does not fit size bytes
+esp_err_t sdcard_path(const SdCard *card, const char *relative, char *path, size_t size);
+
+// same path with the file extension swapped for ext (no dot), e.g. "/sdcard/data.bin" -> "/sdcard/data.tmp".
+// the name stays 8.3 without long file name support, ESP_ERR_INVALID_ARG when path already has ext
+esp_err_t sdcard_path_swap_ext(const char *path, const char *ext, char *out, size_t size);
+
+// writes a whole file so a power loss leaves either the old or the new content, through "<name>.tmp"
+// and "<name>.new" next to it. files that differ only in their extension must not be replaced at once
+esp_err_t sdcard_replace_file(SdCard *card, const char *relative, const void *data, size_t len);
+
+// finishes a replace interrupted by a reset, call after mounting and before reading the file
+esp_err_t sdcard_replace_recover(SdCard *card, const char *relative);
+
+// writes, reads and removes a test file under the mount point and prints MB/s for the profile
+esp_err_t sdcard_benchmark(SdCard *card, sdcard_benchmark_config config, sdcard_benchmark_result *result);
+
+// creates, stats, renames, replaces and removes small files in a bench directory, default 64 files
+esp_err_t sdcard_file_ops_benchmark(SdCard *card, uint32_t files, sdcard_file_ops_result *result);
+
+// starts the write-behind task, ESP_ERR_INVALID_STATE when it is already running or being started.
+// sdcard_writer_open starts it with SDCARD_WRITER_CONFIG_DEFAULT when needed, safe from several tasks
+esp_err_t sdcard_writer_init(sdcard_writer_config config);
+
+// the file is opened by the writer task, a failure shows up on the following calls.
+// mode is "w" or "a" based, NULL for other modes or when buffer_count files are already open
+sdcard_writer_file_handle sdcard_writer_open(const char *path, const char *mode);
+
+// copies data and returns, only waits while every buffer is queued
+esp_err_t sdcard_writer_write(sdcard_writer_file_handle file, const void *data, uint32_t len);
+
+// overwrites len bytes at offset after the writes queued before, for headers patched at the end.
+// len is at most cluster_size, ESP_ERR_INVALID_STATE on files opened in "a" mode
+esp_err_t sdcard_writer_write_at(sdcard_writer_file_handle file, uint32_t offset, const void *data, uint32_t len);
+
+// barrier, waits until everything queued so far is written and synced
+esp_err_t sdcard_writer_flush(sdcard_writer_file_handle file);
+
+// queues the close and returns, the handle must not be used afterwards
+esp_err_t sdcard_writer_close(sdcard_writer_file_handle file);
+
+// allocates missing segment files, then recovers the head and the consumer cursor from the card.
+// a record torn by a crash or power loss is dropped
+sdcard_spool_handle sdcard_spool_open(sdcard_spool_config config);
+
+// no other task may use the spool anymore
+void sdcard_spool_close(sdcard_spool_handle spool);
+
+// called after every successful append, outside the spool lock, e.g. to wake a drainer
+void sdcard_spool_set_append_callback(sdcard_spool_handle spool, sdcard_spool_callback callback, void *arg);
+
+// the record is synced to the card on return, ESP_ERR_NO_MEM when the spool is full
+esp_err_t sdcard_spool_append(sdcard_spool_handle spool, const void *data, uint32_t len);
+
+// oldest pending record with its CRC checked, ESP_ERR_NOT_FOUND when nothing is pending.
+// ESP_FAIL when the card could not be read, nothing is skipped and the peek can be repeated
+esp_err_t sdcard_spool_peek(sdcard_spool_handle spool, sdcard_spool_record *record);
+
+// reads payload bytes of a peeked record, returns the bytes read or -1
+int sdcard_spool_read(sdcard_spool_handle spool, const sdcard_spool_record *record, uint32_t offset, void *data, uint32_t len);
+
+// moves the persisted cursor past the peeked record
+esp_err_t sdcard_spool_consume(sdcard_spool_handle spool, const sdcard_spool_record *record);
+
+// like consume, for a record that cannot be handed on, it is counted as corrupt
+esp_err_t sdcard_spool_skip(sdcard_spool_handle spool, const sdcard_spool_record *record);
+
+void sdcard_spool_get_stats(sdcard_spool_handle spool, sdcard_spool_stats *stats);
+
+// counters since the last reset, plus free space and the CID/CSD when card is mounted
+void sdcard_stats_snapshot(SdCard *card, sdcard_stats *stats);
+
+void sdcard_stats_reset();
+
+// upper bound of the bucket holding the given permille of the samples, e.g. 990 for p99
+uint32_t sdcard_stats_percentile_us(const sdcard_latency_histogram *histogram, uint32_t permille);
@@ -9,6 +9,7 @@
 #include "esp_afe_sr_iface.h"
 #include "esp_afe_sr_models.h"
 #include "esp_event.h"
+#include "esp_heap_caps.h"
 #include "esp_log.h"
 #include "esp_mac.h"
 #include "format_wav.h"
@@ -16,8 +17,10 @@
 #include "freertos/event_groups.h"
 #include "freertos/task.h"
 #include "model_path.h"
+#include "sdkconfig.h"
 #include "synchroniser.h"
 
+// AFE output format, the I2S clock always runs at SAMPLE_RATE and recordings default to it
 #define SAMPLE_RATE 16000
 #define BITS_PER_SAMPLE 16
 #define CHANNELS 1
@@ -25,25 +28,283 @@
 #define BYTE_RATE (SAMPLE_RATE * (BITS_PER_SAMPLE / 8) * CHANNELS)  // 16000 * 2 = 32000 bytes per second
 #define BUFFER_SIZE ((SAMPLE_RATE * (BITS_PER_SAMPLE / 8) * CHANNELS) * RECORD_SECONDS)
 
+// large audio buffers go to PSRAM when the board enables it, internal RAM holds a single recording buffer
+#ifdef CONFIG_SPIRAM
+#define SR_BUFFER_CAPS_DEFAULT MALLOC_CAP_SPIRAM
+#define SR_POOL_COUNT_DEFAULT 2
+#else
+#define SR_BUFFER_CAPS_DEFAULT MALLOC_CAP_DEFAULT
+#define SR_POOL_COUNT_DEFAULT 1
+#endif
+
+// Recording buffer pool, reserved once at init so recordings do not fragment the heap
+typedef struct {
+    uint32_t count;        // buffers, 0 takes every recording from the heap
+    uint32_t buffer_size;  // 0 fits record_seconds plus a second of pre-roll as PCM WAV
+    uint32_t caps;         // MALLOC_CAP_SPIRAM, MALLOC_CAP_INTERNAL or MALLOC_CAP_DMA
+} sr_pool_config_t;
+
+#define SR_POOL_CONFIG_DEFAULT()        \
+    {                                   \
+        .count = SR_POOL_COUNT_DEFAULT, \
+        .buffer_size = 0,               \
+        .caps = SR_BUFFER_CAPS_DEFAULT, \
+    }
+
+typedef struct {
+    uint32_t count;
+    uint32_t buffer_size;
+    uint32_t in_use;
+    uint32_t in_use_max;
+    uint32_t acquired;        // acquisitions served by the pool
+    uint32_t exhausted;       // acquisitions that found every buffer in use
+    uint32_t heap_fallbacks;  // recordings taken from the heap, pool exhausted or buffer too small
+} sr_pool_stats_t;
+
+// Audio setup, pins and slot follow the board, sample_rate and record_seconds shape the recordings
+typedef struct {
+    uint32_t sample_rate;            // SAMPLE_RATE, or SAMPLE_RATE / 2 for narrowband recordings
+    uint32_t record_seconds;         // length of wav_record() and record_to_file()
+    i2s_data_bit_width_t bit_width;  // microphone slot width, 32 or 16 bit
+    i2s_std_slot_mask_t slot_mask;   // I2S_STD_SLOT_LEFT or I2S_STD_SLOT_RIGHT, follows the mic L/R pin
+    i2s_std_gpio_config_t gpio;
+    sr_pool_config_t pool;
+} sr_audio_config_t;
+
+#define SR_AUDIO_CONFIG_DEFAULT()                   \
+    {                                               \
+        .sample_rate = SAMPLE_RATE,                 \
+        .record_seconds = RECORD_SECONDS,           \
+        .bit_width = I2S_DATA_BIT_WIDTH_32BIT,      \
+        .slot_mask = I2S_STD_SLOT_LEFT,             \
+        .gpio = {                                   \
+            .mclk = I2S_GPIO_UNUSED,                \
+            .bclk = GPIO_NUM_5,                     \
+            .ws = GPIO_NUM_6,                       \
+            .dout = I2S_GPIO_UNUSED,                \
+            .din = GPIO_NUM_4,                      \
+            .invert_flags = {                       \
+                .mclk_inv = false,                  \
+                .bclk_inv = false,                  \
+                .ws_inv = false,                    \
+            },                                      \
+        },                                          \
+        .pool = SR_POOL_CONFIG_DEFAULT(),           \
+    }
+
+// Recording encoding, ADPCM is a quarter of the PCM size
+typedef enum {
+    SR_ENCODING_PCM = 0,
+    SR_ENCODING_IMA_ADPCM,  // 4 bit IMA ADPCM, WAV audio_format 0x11
+} sr_encoding_t;
+
+typedef struct {
+    sr_encoding_t encoding;
+    bool container;  // WAV header in front, false gives the raw encoded stream
+} sr_encoder_config_t;
+
+#define SR_ENCODER_CONFIG_DEFAULT()     \
+    {                                   \
+        .encoding = SR_ENCODING_PCM,    \
+        .container = true,              \
+    }
+
+// A recording, reference counted. release it with sr_recording_release, never free it
 typedef struct {
     uint8_t* data_buffer;
     uint32_t data_buffer_size;
+    sr_encoding_t encoding;
+    uint32_t capacity;  // size of data_buffer
+    uint32_t refs;      // owned by the pool
+    int slot;           // pool buffer, -1 when taken from the heap
 } recording_result_t;
 
-// setup
+// Pre-roll, the latest processed audio is kept so a recording can start before the wake word fired
+typedef struct {
+    uint32_t duration_ms;  // 0 disables pre-roll
+    uint32_t caps;         // MALLOC_CAP_SPIRAM or MALLOC_CAP_INTERNAL
+} sr_preroll_config_t;
+
+#define SR_PREROLL_CONFIG_DEFAULT()     \
+    {                                   \
+        .duration_ms = 1000,            \
+        .caps = SR_BUFFER_CAPS_DEFAULT, \
+    }
+
+// I2S to AFE sample conversion, the default is the original fixed >> 14 with wrap-around
+typedef struct {
+    int gain_shift;  // right shift of the 32 bit I2S sample, lower is louder
+    bool saturate;   // clamp to the int16 range instead of wrapping around
+} sr_feed_conversion_t;
+
+#define SR_FEED_CONVERSION_DEFAULT()    \
+    {                                   \
+        .gain_shift = 14,               \
+        .saturate = false,              \
+    }
+
+// Result of sr_convert_benchmark
+typedef struct {
+    int samples;
+    uint32_t reference_cycles;  // original per sample loop
+    uint32_t optimized_cycles;
+    bool match;                 // both produced the same output
+} sr_convert_stats_t;
+
+// Frame consumer, every AFE frame is fetched once and copied into the queue of each open consumer
+typedef struct sr_consumer_t* sr_consumer_handle_t;
+
+typedef struct {
+    uint32_t depth;  // frames queued before new ones are dropped, rounded up to a power of two
+    uint32_t caps;   // MALLOC_CAP_SPIRAM or MALLOC_CAP_INTERNAL
+} sr_consumer_config_t;
+
+#define SR_CONSUMER_CONFIG_DEFAULT()    \
+    {                                   \
+        .depth = 16,                    \
+        .caps = MALLOC_CAP_DEFAULT,     \
+    }
+
+// Audio pipeline stages timed per iteration
+typedef enum {
+    SR_STAGE_I2S_READ = 0,  // bsp_get_feed_data, mostly waiting for the I2S DMA
+    SR_STAGE_FEED,          // afe feed
+    SR_STAGE_FETCH,         // afe fetch, waiting for fed audio plus the AFE processing
+    SR_STAGE_COUNT,
+} sr_stats_stage_t;
+
+typedef enum {
+    SR_TASK_FEED = 0,
+    SR_TASK_FETCH,
+    SR_TASK_DETECT,
+    SR_TASK_COUNT,
+} sr_stats_task_t;
+
+typedef struct {
+    uint32_t count;
+    uint64_t total_us;
+    uint32_t max_us;
+} sr_stats_timing_t;
+
+typedef struct {
+    bool running;
+    // share of one core in permille. exact with CONFIG_FREERTOS_GENERATE_RUN_TIME_STATS,
+    // otherwise the timed work only, where fetch also counts its wait for the feed
+    uint32_t load_permille;
+    uint32_t stack_free_min;  // stack high-water mark in bytes, kept after the task exits
+} sr_stats_task_info_t;
+
+// Audio pipeline statistics since the last sr_stats_reset
+typedef struct {
+    uint64_t window_us;
+    sr_stats_timing_t stages[SR_STAGE_COUNT];
+    uint32_t i2s_stalls;          // reads that failed or took over twice the audio they returned
+    uint32_t dma_overflows;       // I2S DMA buffers lost because the feed task read too late
+    uint32_t missed_deadlines;    // feed iterations longer than the audio they carried, plus a quarter
+    uint32_t afe_backlog_ms;      // audio fed into the AFE and not fetched yet
+    uint32_t afe_backlog_max_ms;
+    sr_stats_task_info_t tasks[SR_TASK_COUNT];
+} sr_stats_t;
+
+// Streaming WAV writer, the header sizes are patched when the file is closed
+typedef struct sr_wav_writer_t* sr_wav_writer_handle_t;
+
+// setup, sr_init uses SR_AUDIO_CONFIG_DEFAULT with the given microphone pins
 esp_afe_sr_iface_t sr_init(afe_config_t config, i2s_std_gpio_config_t micConfig);
 
-// data feed
+esp_afe_sr_iface_t sr_init_audio(afe_config_t config, sr_audio_config_t audio);
+
+// call once before the wakeup listener starts, recordings then begin with duration_ms of pre-roll.
+// ESP_ERR_INVALID_STATE while the feed runs
+esp_err_t sr_preroll_init(sr_preroll_config_t config);
+
+// data feed, counted together with the consumers: the feed runs while any of them holds it,
+// every start_feed needs its own stop_feed
 void start_feed();
 void stop_feed();
 
+// takes effect with the next feed chunk
+void sr_set_feed_conversion(sr_feed_conversion_t conversion);
+
+// runs the feed conversion over samples of random data with the current settings,
+// checks it against the original loop and reports the cycles of both
+esp_err_t sr_convert_benchmark(int samples, sr_convert_stats_t *stats);
+
+// frame consumers, a wake word listener, recorder, level meter or streamer each open their own.
+// the feed starts with the first consumer and stops when the last one is closed
+sr_consumer_handle_t sr_consumer_open(sr_consumer_config_t config);
+
+// next frame, valid until the following call. NULL after timeout or once the feed stopped
+afe_fetch_result_t* sr_consumer_fetch(sr_consumer_handle_t consumer, TickType_t timeout);
+
+// frames lost because the queue was full
+uint32_t sr_consumer_dropped(sr_consumer_handle_t consumer);
+
+void sr_consumer_close(sr_consumer_handle_t consumer);
+
+// pipeline statistics, sr_stats_start posts an SR_STATS event carrying an sr_stats_t
+// every period_ms, 0 stops it
+esp_err_t sr_stats_start(uint32_t period_ms);
+
+void sr_stats_snapshot(sr_stats_t* stats);
+
+void sr_stats_reset();
+
 // wakeup word process
 void start_wakeup_listener();
 void stop_wakeup_listener();
 
-// recording
+// Variable length recording, ends after silence_ms of trailing silence once min_ms is recorded.
+// needs the AFE created with vad_init = true. the buffer is sized for pre-roll plus max_ms up front
+typedef struct {
+    uint32_t min_ms;      // never stops earlier, pre-roll not included
+    uint32_t max_ms;      // stops here even while speech goes on
+    uint32_t silence_ms;  // trailing silence that ends the utterance
+} sr_vad_record_config_t;
+
+#define SR_VAD_RECORD_CONFIG_DEFAULT()  \
+    {                                   \
+        .min_ms = 500,                  \
+        .max_ms = 8000,                 \
+        .silence_ms = 700,              \
+    }
+
+// recording buffers. acquire returns a result with one reference and an empty buffer of at
+// least size bytes, from the pool when one fits and is free, otherwise from the heap
+recording_result_t* sr_recording_acquire(uint32_t size);
+
+// one more holder, for example a task uploading the recording while another stores it
+void sr_recording_retain(recording_result_t* result);
+
+// the buffer goes back to the pool with the last reference
+void sr_recording_release(recording_result_t* result);
+
+void sr_pool_stats(sr_pool_stats_t* stats);
+
+// recording, the result is released with sr_recording_release
 recording_result_t* wav_record();
 
+// records until the end of speech
+recording_result_t* wav_record_vad(sr_vad_record_config_t config);
+
+// encoding of the following recordings, frames are encoded while they are captured
+void sr_set_encoder(sr_encoder_config_t config);
+
+// writes go through the sdcard_helper write-behind task. block_size is its cluster
+// when this starts it, 0 uses the allocation unit of the mounted card
+sr_wav_writer_handle_t sr_wav_open(const char* path, uint32_t block_size);
+
+// same as sr_wav_open, PCM passed to sr_wav_write is encoded before it is written
+sr_wav_writer_handle_t sr_wav_open_encoded(const char* path, uint32_t block_size, sr_encoder_config_t encoder);
+
+esp_err_t sr_wav_write(sr_wav_writer_handle_t writer, const void* pcm, uint32_t len);
+
+// PCM bytes taken in so far
+uint32_t sr_wav_size(sr_wav_writer_handle_t writer);
+
+// flushes, patches the header and frees the writer
+esp_err_t sr_wav_close(sr_wav_writer_handle_t writer);
+
 // events setup
 typedef enum {
     SR_FEED_STOP = 0,
@@ -54,6 +315,7 @@ typedef enum {
     SR_SYSTEM_READY,
     RECORDING_SUCCESS,
     RECORDING_FAIL,
+    SR_STATS,  // event data is an sr_stats_t
 } sr_event_t;
 
 void sr_register_callback(esp_event_handler_t callback);
\ No newline at end of file
@@ -0,0 +1,96 @@
+#include "SrConsumer.h"
+
+#include <string.h>
+
+static const char *TAG = "SR Consumer";
+
+sr_consumer_handle_t sr_consumer_alloc(sr_consumer_config_t config, uint32_t frame_bytes) {
+    uint32_t depth = 2;
+    while (depth < config.depth) {
+        depth <<= 1;
+    }
+
+    sr_consumer_handle_t consumer = calloc(1, sizeof(struct sr_consumer_t));
+    if (!consumer) {
+        ESP_LOGE(TAG, "Failed to allocate consumer");
+        return NULL;
+    }
+
+    consumer->depth = depth;
+    consumer->frame_bytes = frame_bytes;
+    consumer->frames = heap_caps_calloc(depth, sizeof(afe_fetch_result_t), config.caps | MALLOC_CAP_8BIT);
+    consumer->data = heap_caps_malloc(depth * frame_bytes, config.caps | MALLOC_CAP_8BIT);
+    consumer->ready = xSemaphoreCreateBinary();
+    if (!consumer->frames || !consumer->data || !consumer->ready) {
+        ESP_LOGE(TAG, "Failed to allocate %ld frames queue (%ld bytes)", (long)depth, (long)(depth * frame_bytes));
+        sr_consumer_free(consumer);
+        return NULL;
+    }
+
+    for (uint32_t i = 0; i < depth; i++) {
+        consumer->frames[i].data = (int16_t *)(consumer->data + i * frame_bytes);
+    }
+
+    atomic_init(&consumer->head, 0);
+    atomic_init(&consumer->tail, 0);
+    atomic_init(&consumer->dropped, 0);
+
+    return consumer;
+}
+
+void sr_consumer_free(sr_consumer_handle_t consumer) {
+    if (!consumer) {
+        return;
+    }
+
+    if (consumer->ready) {
+        vSemaphoreDelete(consumer->ready);
+    }
+    heap_caps_free(consumer->frames);
+    heap_caps_free(consumer->data);
+    free(consumer);
+}
+
+bool sr_consumer_push(sr_consumer_handle_t consumer, const afe_fetch_result_t *res) {
+    uint32_t head = atomic_load_explicit(&consumer->head, memory_order_relaxed);
+    uint32_t tail = atomic_load_explicit(&consumer->tail, memory_order_acquire);
+
+    // a slow consumer only loses its own frames, the others and the AFE keep going
+    if (head - tail == consumer->depth) {
+        atomic_fetch_add_explicit(&consumer->dropped, 1, memory_order_relaxed);
+        return false;
+    }
+
+    afe_fetch_result_t *frame = &consumer->frames[head & (consumer->depth - 1)];
+    int16_t *data = frame->data;
+    uint32_t len = res->data_size < consumer->frame_bytes ? res->data_size : consumer->frame_bytes;
+
+    // the result fields are kept, only the audio is copied
+    *frame = *res;
+    frame->data = data;
+    frame->data_size = len;
+    memcpy(data, res->data, len);
+
+    atomic_store_explicit(&consumer->head, head + 1, memory_order_release);
+    xSemaphoreGive(consumer->ready);
+
+    return true;
+}
+
+afe_fetch_result_t *sr_consumer_pop(sr_consumer_handle_t consumer) {
+    uint32_t tail = atomic_load_explicit(&consumer->tail, memory_order_relaxed);
+
+    if (consumer->holding) {
+        tail++;
+        atomic_store_explicit(&consumer->tail, tail, memory_order_release);
+        consumer->holding = false;
+    }
+
+    if (atomic_load_explicit(&consumer->head, memory_order_acquire) == tail) {
+        return NULL;
+    }
+
+    consumer->holding = true;
+
+    return &consumer->frames[tail & (consumer->depth - 1)];
+}
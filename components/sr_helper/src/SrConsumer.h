@@ -0,0 +1,32 @@
+#pragma once
+
+#include <stdatomic.h>
+
+#include "SrHelper.h"
+#include "freertos/semphr.h"
+
+// single producer / single consumer frame queue without locks. the fetch task is the only
+// producer and never waits, a full queue drops the new frame and counts it
+
+struct sr_consumer_t {
+    afe_fetch_result_t *frames;  // depth results, data points into the consumer's own slot
+    uint8_t *data;               // depth slots of frame_bytes
+    uint32_t depth;              // power of two
+    uint32_t frame_bytes;
+    atomic_uint head;            // frames published
+    atomic_uint tail;            // frames released by the consumer
+    bool holding;                // the frame at tail is still handed out
+    atomic_uint dropped;
+    SemaphoreHandle_t ready;     // given after every push, wakes a waiting consumer
+};
+
+// depth is rounded up to a power of two
+sr_consumer_handle_t sr_consumer_alloc(sr_consumer_config_t config, uint32_t frame_bytes);
+
+void sr_consumer_free(sr_consumer_handle_t consumer);
+
+// producer side, copies the frame, returns false if it was dropped
+bool sr_consumer_push(sr_consumer_handle_t consumer, const afe_fetch_result_t *res);
+
+// consumer side, releases the previously returned frame and returns the next one, NULL if empty
+afe_fetch_result_t *sr_consumer_pop(sr_consumer_handle_t consumer);
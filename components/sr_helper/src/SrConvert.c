@@ -0,0 +1,71 @@
+#include "SrConvert.h"
+
+#include "esp_attr.h"
+
+static inline int32_t clamp16(int32_t value) {
+    // the compiler turns this into a single CLAMPS on the S3
+    return value < INT16_MIN ? INT16_MIN : (value > INT16_MAX ? INT16_MAX : value);
+}
+
+// unrolled by four so the loads, shifts and stores of neighbouring samples can overlap,
+// runs from IRAM as it is called for every feed chunk
+void IRAM_ATTR sr_convert_samples(int32_t *samples, int count, int shift, bool saturate) {
+    int32_t *p = samples;
+    int32_t *end4 = samples + (count & ~3);
+    int32_t *end = samples + count;
+
+    if (saturate) {
+        while (p < end4) {
+            int32_t a = p[0] >> shift;
+            int32_t b = p[1] >> shift;
+            int32_t c = p[2] >> shift;
+            int32_t d = p[3] >> shift;
+            p[0] = clamp16(a);
+            p[1] = clamp16(b);
+            p[2] = clamp16(c);
+            p[3] = clamp16(d);
+            p += 4;
+        }
+        while (p < end) {
+            *p = clamp16(*p >> shift);
+            p++;
+        }
+    } else {
+        while (p < end4) {
+            int32_t a = p[0] >> shift;
+            int32_t b = p[1] >> shift;
+            int32_t c = p[2] >> shift;
+            int32_t d = p[3] >> shift;
+            p[0] = a;
+            p[1] = b;
+            p[2] = c;
+            p[3] = d;
+            p += 4;
+        }
+        while (p < end) {
+            *p = *p >> shift;
+            p++;
+        }
+    }
+}
+
+void IRAM_ATTR sr_expand_samples16(int32_t *slots, int count) {
+    const int16_t *samples = (const int16_t *)slots;
+
+    // back to front, so no sample is overwritten before it is read
+    for (int i = count - 1; i >= 0; i--) {
+        slots[i] = samples[i];
+    }
+}
+
+void sr_convert_samples_reference(int32_t *samples, int count, int shift, bool saturate) {
+    for (int i = 0; i < count; i++) {
+        int32_t value = samples[i] >> shift;
+        if (saturate && value > INT16_MAX) {
+            value = INT16_MAX;
+        } else if (saturate && value < INT16_MIN) {
+            value = INT16_MIN;
+        }
+        samples[i] = value;
+    }
+}
@@ -0,0 +1,14 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// converts 32 bit I2S slots in place to AFE input, each slot keeps its int32 layout
+// and holds sample >> shift, clamped to the int16 range when saturate is set
+void sr_convert_samples(int32_t *samples, int count, int shift, bool saturate);
+
+// widens count 16 bit samples packed at the start of slots into int32 slots, in place
+void sr_expand_samples16(int32_t *slots, int count);
+
+// the original per sample loop, kept as the benchmark and correctness reference
+void sr_convert_samples_reference(int32_t *samples, int count, int shift, bool saturate);
@@ -0,0 +1,259 @@
+#include "SrEncoder.h"
+
+#include <assert.h>
+#include <string.h>
+
+// IMA ADPCM WAV header, fmt carries the samples per block and a fact chunk the real sample count
+typedef struct {
+    char chunk_id[4];
+    uint32_t chunk_size;
+    char chunk_format[4];
+    char fmt_id[4];
+    uint32_t fmt_size;
+    uint16_t audio_format;
+    uint16_t num_of_channels;
+    uint32_t sample_rate;
+    uint32_t byte_rate;
+    uint16_t block_align;
+    uint16_t bits_per_sample;
+    uint16_t extra_size;
+    uint16_t samples_per_block;
+    char fact_id[4];
+    uint32_t fact_size;
+    uint32_t sample_count;
+    char data_id[4];
+    uint32_t data_size;
+} wav_header_ima_adpcm_t;
+
+static_assert(sizeof(wav_header_ima_adpcm_t) == 60, "IMA ADPCM header must not be padded");
+
+static const int8_t index_table[16] = {
+    -1, -1, -1, -1, 2, 4, 6, 8,
+    -1, -1, -1, -1, 2, 4, 6, 8,
+};
+
+static const int16_t step_table[89] = {
+    7, 8, 9, 10, 11, 12, 13, 14, 16, 17,
+    19, 21, 23, 25, 28, 31, 34, 37, 41, 45,
+    50, 55, 60, 66, 73, 80, 88, 97, 107, 118,
+    130, 143, 157, 173, 190, 209, 230, 253, 279, 307,
+    337, 371, 408, 449, 494, 544, 598, 658, 724, 796,
+    876, 963, 1060, 1166, 1282, 1411, 1552, 1707, 1878, 2066,
+    2272, 2499, 2749, 3024, 3327, 3660, 4026, 4428, 4871, 5358,
+    5894, 6484, 7132, 7845, 8630, 9493, 10442, 11487, 12635, 13899,
+    15289, 16818, 18500, 20350, 22385, 24623, 27086, 29794, 32767,
+};
+
+void sr_encoder_init(sr_encoder_t *encoder, sr_encoder_config_t config, uint32_t sample_rate) {
+    memset(encoder, 0, sizeof(sr_encoder_t));
+    encoder->config = config;
+    encoder->decimation = sample_rate > 0 && sample_rate < SAMPLE_RATE ? 2 : 1;
+    encoder->sample_rate = SAMPLE_RATE / encoder->decimation;
+}
+
+uint32_t sr_encoder_header_size(const sr_encoder_t *encoder) {
+    if (!encoder->config.container) {
+        return 0;
+    }
+
+    return encoder->config.encoding == SR_ENCODING_IMA_ADPCM ? sizeof(wav_header_ima_adpcm_t) : sizeof(wav_header_t);
+}
+
+void sr_encoder_header(const sr_encoder_t *encoder, uint8_t *out) {
+    if (!encoder->config.container) {
+        return;
+    }
+
+    if (encoder->config.encoding != SR_ENCODING_IMA_ADPCM) {
+        wav_header_t wav_header = WAV_HEADER_PCM_DEFAULT(encoder->data_size, BITS_PER_SAMPLE, encoder->sample_rate, CHANNELS);
+        memcpy(out, &wav_header, sizeof(wav_header_t));
+        return;
+    }
+
+    wav_header_ima_adpcm_t wav_header = {
+        .chunk_id = {'R', 'I', 'F', 'F'},
+        .chunk_size = encoder->data_size + sizeof(wav_header_ima_adpcm_t) - 8,
+        .chunk_format = {'W', 'A', 'V', 'E'},
+        .fmt_id = {'f', 'm', 't', ' '},
+        .fmt_size = 20,
+        .audio_format = 0x11,
+        .num_of_channels = CHANNELS,
+        .sample_rate = encoder->sample_rate,
+        .byte_rate = encoder->sample_rate * SR_ADPCM_BLOCK_ALIGN / SR_ADPCM_BLOCK_SAMPLES,
+        .block_align = SR_ADPCM_BLOCK_ALIGN,
+        .bits_per_sample = 4,
+        .extra_size = 2,
+        .samples_per_block = SR_ADPCM_BLOCK_SAMPLES,
+        .fact_id = {'f', 'a', 'c', 't'},
+        .fact_size = 4,
+        .sample_count = encoder->samples,
+        .data_id = {'d', 'a', 't', 'a'},
+        .data_size = encoder->data_size,
+    };
+    memcpy(out, &wav_header, sizeof(wav_header_ima_adpcm_t));
+}
+
+uint32_t sr_encoder_max_size(sr_encoder_config_t config, uint32_t sample_rate, uint32_t pcm_bytes) {
+    sr_encoder_t encoder = {.config = config};
+    uint32_t header = sr_encoder_header_size(&encoder);
+
+    if (sample_rate > 0 && sample_rate < SAMPLE_RATE) {
+        pcm_bytes = pcm_bytes / 2 + sizeof(int16_t);
+    }
+
+    if (config.encoding != SR_ENCODING_IMA_ADPCM) {
+        return header + pcm_bytes;
+    }
+
+    uint32_t samples = pcm_bytes / sizeof(int16_t);
+    uint32_t blocks = (samples + SR_ADPCM_BLOCK_SAMPLES - 1) / SR_ADPCM_BLOCK_SAMPLES;
+
+    return header + blocks * SR_ADPCM_BLOCK_ALIGN;
+}
+
+static uint8_t encode_sample(sr_encoder_t *encoder, int sample) {
+    int step = step_table[encoder->index];
+    int diff = sample - encoder->predictor;
+    uint8_t nibble = 0;
+
+    if (diff < 0) {
+        nibble = 8;
+        diff = -diff;
+    }
+
+    int delta = step >> 3;
+    if (diff >= step) {
+        nibble |= 4;
+        diff -= step;
+        delta += step;
+    }
+    if (diff >= step >> 1) {
+        nibble |= 2;
+        diff -= step >> 1;
+        delta += step >> 1;
+    }
+    if (diff >= step >> 2) {
+        nibble |= 1;
+        delta += step >> 2;
+    }
+
+    int predictor = encoder->predictor + ((nibble & 8) ? -delta : delta);
+    encoder->predictor = predictor < INT16_MIN ? INT16_MIN : (predictor > INT16_MAX ? INT16_MAX : predictor);
+
+    int index = encoder->index + index_table[nibble];
+    encoder->index = index < 0 ? 0 : (index > 88 ? 88 : index);
+
+    return nibble;
+}
+
+// one mono WAV block: first sample and step index, then two samples per byte, low nibble first
+static bool encode_block(sr_encoder_t *encoder, sr_encoder_emit_t emit, void *ctx) {
+    uint8_t block[SR_ADPCM_BLOCK_ALIGN];
+    const int16_t *pcm = encoder->pending;
+
+    encoder->predictor = pcm[0];
+    block[0] = (uint8_t)(pcm[0] & 0xff);
+    block[1] = (uint8_t)((uint16_t)pcm[0] >> 8);
+    block[2] = (uint8_t)encoder->index;
+    block[3] = 0;
+
+    for (int i = 0; i < SR_ADPCM_BLOCK_ALIGN - 4; i++) {
+        uint8_t low = encode_sample(encoder, pcm[1 + 2 * i]);
+        uint8_t high = encode_sample(encoder, pcm[2 + 2 * i]);
+        block[4 + i] = low | (high << 4);
+    }
+
+    encoder->pending_count = 0;
+    encoder->data_size += SR_ADPCM_BLOCK_ALIGN;
+
+    return emit(ctx, block, SR_ADPCM_BLOCK_ALIGN);
+}
+
+static bool encode_pcm(sr_encoder_t *encoder, const void *pcm, uint32_t len, sr_encoder_emit_t emit, void *ctx) {
+    if (encoder->config.encoding != SR_ENCODING_IMA_ADPCM) {
+        encoder->samples += len / sizeof(int16_t);
+        encoder->data_size += len;
+        return emit(ctx, pcm, len);
+    }
+
+    const int16_t *samples = pcm;
+    uint32_t count = len / sizeof(int16_t);
+    encoder->samples += count;
+
+    while (count > 0) {
+        uint32_t n = SR_ADPCM_BLOCK_SAMPLES - encoder->pending_count;
+        if (n > count) {
+            n = count;
+        }
+
+        memcpy(encoder->pending + encoder->pending_count, samples, n * sizeof(int16_t));
+        encoder->pending_count += n;
+        samples += n;
+        count -= n;
+
+        if (encoder->pending_count == SR_ADPCM_BLOCK_SAMPLES && !encode_block(encoder, emit, ctx)) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+// 2:1 halfband low pass, taps -1 0 9 16 9 0 -1 / 32, keeps speech below 3.4 kHz clear of aliasing
+static int decimate(sr_encoder_t *encoder, const int16_t *in, int count, int16_t *out) {
+    int16_t *h = encoder->history;
+    int produced = 0;
+
+    for (int i = 0; i < count; i++) {
+        int32_t x = in[i];
+
+        if (encoder->phase) {
+            int32_t y = (-h[0] + 9 * h[2] + 16 * h[3] + 9 * h[4] - x) >> 5;
+            out[produced++] = y < INT16_MIN ? INT16_MIN : (y > INT16_MAX ? INT16_MAX : y);
+        }
+        encoder->phase ^= 1;
+
+        memmove(h, h + 1, 5 * sizeof(int16_t));
+        h[5] = x;
+    }
+
+    return produced;
+}
+
+bool sr_encoder_write(sr_encoder_t *encoder, const void *pcm, uint32_t len, sr_encoder_emit_t emit, void *ctx) {
+    if (encoder->decimation == 1) {
+        return encode_pcm(encoder, pcm, len, emit, ctx);
+    }
+
+    const int16_t *samples = pcm;
+    uint32_t count = len / sizeof(int16_t);
+    int16_t out[128];
+
+    while (count > 0) {
+        uint32_t n = count > 2 * 128 ? 2 * 128 : count;
+        int produced = decimate(encoder, samples, n, out);
+
+        if (!encode_pcm(encoder, out, produced * sizeof(int16_t), emit, ctx)) {
+            return false;
+        }
+
+        samples += n;
+        count -= n;
+    }
+
+    return true;
+}
+
+bool sr_encoder_finish(sr_encoder_t *encoder, sr_encoder_emit_t emit, void *ctx) {
+    if (encoder->config.encoding != SR_ENCODING_IMA_ADPCM || encoder->pending_count == 0) {
+        return true;
+    }
+
+    // decoders stop at the fact sample count, the padding is never played
+    int16_t last = encoder->pending[encoder->pending_count - 1];
+    while (encoder->pending_count < SR_ADPCM_BLOCK_SAMPLES) {
+        encoder->pending[encoder->pending_count++] = last;
+    }
+
+    return encode_block(encoder, emit, ctx);
+}
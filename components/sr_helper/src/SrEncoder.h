@@ -0,0 +1,45 @@
+#pragma once
+
+#include "SrHelper.h"
+
+// encoder stage between the AFE and a recording sink, PCM passes through unchanged
+
+#define SR_ADPCM_BLOCK_ALIGN 256
+#define SR_ADPCM_BLOCK_SAMPLES ((SR_ADPCM_BLOCK_ALIGN - 4) * 2 + 1)  // 505
+
+// receives encoded output, returns false to abort
+typedef bool (*sr_encoder_emit_t)(void *ctx, const uint8_t *data, uint32_t len);
+
+typedef struct {
+    sr_encoder_config_t config;
+    uint32_t sample_rate;  // output rate, the AFE rate or half of it
+    int decimation;
+    int16_t history[6];    // halfband filter taps of the previous input
+    int phase;
+    int16_t predictor;
+    int index;
+    int16_t pending[SR_ADPCM_BLOCK_SAMPLES];  // samples of the ADPCM block being filled
+    int pending_count;
+    uint32_t samples;    // PCM samples taken in
+    uint32_t data_size;  // encoded bytes emitted
+} sr_encoder_t;
+
+// recording rate set by sr_init_audio
+uint32_t sr_recording_sample_rate();
+
+// input is always AFE output, sample_rate below the AFE rate decimates it first
+void sr_encoder_init(sr_encoder_t *encoder, sr_encoder_config_t config, uint32_t sample_rate);
+
+// 0 for a raw stream
+uint32_t sr_encoder_header_size(const sr_encoder_t *encoder);
+
+// container header for what was emitted so far, header_size bytes
+void sr_encoder_header(const sr_encoder_t *encoder, uint8_t *out);
+
+// upper bound of the encoded size of pcm_bytes, header included
+uint32_t sr_encoder_max_size(sr_encoder_config_t config, uint32_t sample_rate, uint32_t pcm_bytes);
+
+bool sr_encoder_write(sr_encoder_t *encoder, const void *pcm, uint32_t len, sr_encoder_emit_t emit, void *ctx);
+
+// emits the last partial ADPCM block, padded with its last sample
+bool sr_encoder_finish(sr_encoder_t *encoder, sr_encoder_emit_t emit, void *ctx);
@@ -2,6 +2,16 @@
 
 #include <string.h>
 
+#include "SrConsumer.h"
+#include "SrConvert.h"
+#include "SrEncoder.h"
+#include "SrPool.h"
+#include "SrRingBuffer.h"
+#include "SrStats.h"
+#include "esp_attr.h"
+#include "esp_cpu.h"
+#include "esp_random.h"
+#include "esp_timer.h"
 #include "esp_vfs_fat.h"
 
 // #ifdef DEBUG_ENABLED
@@ -19,6 +29,36 @@ bool is_feed_active = false;
 bool continue_wakeword_detection = true;
 bool wakeword_detection_stop = true;
 
+static sr_audio_config_t audio_config = SR_AUDIO_CONFIG_DEFAULT();
+static sr_feed_conversion_t feed_conversion = SR_FEED_CONVERSION_DEFAULT();
+
+static sr_encoder_config_t recording_encoder = SR_ENCODER_CONFIG_DEFAULT();
+
+static sr_ring_t preroll_ring;
+static uint32_t preroll_bytes = 0;
+
+#define SR_CONSUMERS_MAX 4
+
+// tasks sample their stack and run time every this many iterations, about a second
+#define SR_STATS_UPDATE_INTERVAL 32
+
+// open consumers, the fetch task publishes under the same lock
+static sr_consumer_handle_t consumers[SR_CONSUMERS_MAX];
+static SemaphoreHandle_t consumers_lock = NULL;
+
+// feed users, the feed starts on the first and stops with the last. the feed and fetch tasks never
+// take this lock, so a start can wait under it for a stop to finish. taken before consumers_lock
+static SemaphoreHandle_t feed_lock = NULL;
+static int feed_users = 0;
+static bool feed_handed_over = false;
+
+// a wake word handover no recording claims within this time is given back
+#define SR_FEED_HANDOVER_TIMEOUT_MS 5000
+static esp_timer_handle_t handover_timer = NULL;
+
+static volatile bool is_fetch_active = false;
+static volatile bool is_feed_running = false;
+
 // --------------------- callback process ----------------------------------------
 void sr_register_callback(esp_event_handler_t callback) {
     ESP_ERROR_CHECK(esp_event_handler_instance_register(SR_EVENT,
@@ -38,246 +78,566 @@ void sr_trigger_event(sr_event_t event) {
     );
 }
 
+// --------------------- pre-roll process ----------------------------------------
+static esp_err_t preroll_replace(sr_preroll_config_t config) {
+    if (preroll_ring.data != NULL) {
+        sr_ring_free(&preroll_ring);
+        preroll_bytes = 0;
+    }
+
+    if (config.duration_ms == 0) {
+        return ESP_OK;
+    }
+
+    // whole samples only
+    uint32_t bytes = (uint64_t)BYTE_RATE * config.duration_ms / 1000;
+    bytes -= bytes % sizeof(int16_t);
+
+    // frames keep arriving while a recording copies the pre-roll out, the headroom keeps them
+    // from overwriting the oldest pre-roll bytes before they are read
+    esp_err_t ret = sr_ring_init(&preroll_ring, bytes + BYTE_RATE / 4, config.caps);
+    if (ret != ESP_OK) {
+        return ret;
+    }
+
+    preroll_bytes = bytes;
+    ESP_LOGI(TAG, "pre-roll of %ld ms, %ld bytes ring", (long)config.duration_ms, (long)preroll_ring.size);
+
+    return ESP_OK;
+}
+
+esp_err_t sr_preroll_init(sr_preroll_config_t config) {
+    if (feed_lock == NULL) {
+        return preroll_replace(config);
+    }
+
+    // the fetch task writes the ring and recordings read it, holding feed_lock keeps the feed from starting
+    xSemaphoreTake(feed_lock, portMAX_DELAY);
+
+    esp_err_t ret = ESP_ERR_INVALID_STATE;
+    if (feed_users == 0 && !is_fetch_active && !is_feed_running) {
+        ret = preroll_replace(config);
+    } else {
+        ESP_LOGE(TAG, "pre-roll can not change while the feed runs");
+    }
+
+    xSemaphoreGive(feed_lock);
+
+    return ret;
+}
+
+uint32_t sr_recording_sample_rate() {
+    return audio_config.sample_rate;
+}
+
+// AFE output bytes of one fixed length recording
+static int record_bytes() {
+    return BYTE_RATE * audio_config.record_seconds;
+}
+
+// pre-roll bytes between tail and end
+typedef struct {
+    uint32_t tail;
+    uint32_t end;
+} sr_preroll_cursor_t;
+
+// the pre-roll held right now, taken under consumers_lock so it ends where the consumer queue starts
+static sr_preroll_cursor_t preroll_snapshot() {
+    sr_preroll_cursor_t cursor = {0};
+
+    if (preroll_bytes > 0) {
+        cursor.tail = sr_ring_tail_for(&preroll_ring, preroll_bytes);
+        cursor.end = atomic_load(&preroll_ring.head);
+    }
+
+    return cursor;
+}
+
+static uint32_t preroll_read(sr_preroll_cursor_t *cursor, void *out, uint32_t len) {
+    uint32_t remaining = cursor->end - cursor->tail;
+    if (remaining == 0 || remaining > preroll_ring.size) {
+        return 0;
+    }
+
+    return sr_ring_read(&preroll_ring, &cursor->tail, out, len < remaining ? len : remaining);
+}
+
+// --------------------- feed users ----------------------------------------
+static void feed_start_locked();
+
+static void feed_take_locked() {
+    if (feed_users++ == 0) {
+        feed_start_locked();
+    }
+}
+
+// the fetch task resets the AFE buffer once it is out of its last fetch
+static void feed_give_locked() {
+    if (feed_users > 0 && --feed_users == 0) {
+        is_feed_active = false;
+    }
+}
+
+static void handover_expired(void *arg) {
+    xSemaphoreTake(feed_lock, portMAX_DELAY);
+
+    if (feed_handed_over) {
+        ESP_LOGW(TAG, "no recording after the wake word, feed released");
+        feed_handed_over = false;
+        feed_give_locked();
+    }
+
+    xSemaphoreGive(feed_lock);
+}
+
+// --------------------- fan-out process ----------------------------------------
+static sr_consumer_handle_t consumer_open(sr_consumer_config_t config, sr_preroll_cursor_t *preroll) {
+    uint32_t frame_bytes = afe_handle->get_fetch_chunksize(afe_data) * sizeof(int16_t);
+    sr_consumer_handle_t consumer = sr_consumer_alloc(config, frame_bytes);
+    if (!consumer) {
+        return NULL;
+    }
+
+    xSemaphoreTake(feed_lock, portMAX_DELAY);
+    xSemaphoreTake(consumers_lock, portMAX_DELAY);
+
+    int slot = 0;
+    while (slot < SR_CONSUMERS_MAX && consumers[slot] != NULL) {
+        slot++;
+    }
+
+    if (slot == SR_CONSUMERS_MAX) {
+        xSemaphoreGive(consumers_lock);
+        xSemaphoreGive(feed_lock);
+        ESP_LOGE(TAG, "Too many consumers (max %d)", SR_CONSUMERS_MAX);
+        sr_consumer_free(consumer);
+        return NULL;
+    }
+
+    consumers[slot] = consumer;
+    if (preroll != NULL) {
+        *preroll = preroll_snapshot();
+    }
+
+    xSemaphoreGive(consumers_lock);
+
+    // a wake word listener passes its feed on to the recording that follows, only recordings take a pre-roll
+    if (preroll != NULL && feed_handed_over) {
+        feed_handed_over = false;
+        esp_timer_stop(handover_timer);
+    } else {
+        feed_take_locked();
+    }
+
+    xSemaphoreGive(feed_lock);
+
+    return consumer;
+}
+
+static void consumer_close(sr_consumer_handle_t consumer, bool hand_over) {
+    if (!consumer) {
+        return;
+    }
+
+    xSemaphoreTake(feed_lock, portMAX_DELAY);
+    xSemaphoreTake(consumers_lock, portMAX_DELAY);
+
+    for (int i = 0; i < SR_CONSUMERS_MAX; i++) {
+        if (consumers[i] == consumer) {
+            consumers[i] = NULL;
+        }
+    }
+
+    xSemaphoreGive(consumers_lock);
+
+    // one handover at a time, an older one still waiting is given back
+    if (hand_over && handover_timer != NULL) {
+        if (feed_handed_over) {
+            esp_timer_stop(handover_timer);
+            feed_give_locked();
+        }
+        feed_handed_over = true;
+        esp_timer_start_once(handover_timer, (uint64_t)SR_FEED_HANDOVER_TIMEOUT_MS * 1000);
+    } else {
+        feed_give_locked();
+    }
+
+    xSemaphoreGive(feed_lock);
+
+    uint32_t dropped = atomic_load(&consumer->dropped);
+    if (dropped > 0) {
+        ESP_LOGW(TAG, "consumer closed, %ld frames dropped", (long)dropped);
+    }
+
+    sr_consumer_free(consumer);
+}
+
+sr_consumer_handle_t sr_consumer_open(sr_consumer_config_t config) {
+    return consumer_open(config, NULL);
+}
+
+afe_fetch_result_t *sr_consumer_fetch(sr_consumer_handle_t consumer, TickType_t timeout) {
+    while (true) {
+        afe_fetch_result_t *res = sr_consumer_pop(consumer);
+        if (res != NULL) {
+            return res;
+        }
+
+        if (!is_fetch_active || xSemaphoreTake(consumer->ready, timeout) != pdTRUE) {
+            return NULL;
+        }
+    }
+}
+
+uint32_t sr_consumer_dropped(sr_consumer_handle_t consumer) {
+    return consumer ? atomic_load(&consumer->dropped) : 0;
+}
+
+void sr_consumer_close(sr_consumer_handle_t consumer) {
+    consumer_close(consumer, false);
+}
+
+// the only task calling the AFE fetch, every frame goes to the pre-roll ring and each open consumer
+void fetch_task(void *arg) {
+    int iterations = 0;
+
+    while (is_feed_active) {
+        if (++iterations % SR_STATS_UPDATE_INTERVAL == 0) {
+            sr_stats_task_update(SR_TASK_FETCH);
+        }
+
+        int64_t start = esp_timer_get_time();
+        afe_fetch_result_t *res = afe_handle->fetch(afe_data);
+        sr_stats_record(SR_STAGE_FETCH, start);
+
+        if (!res || res->ret_value == ESP_FAIL) {
+            ESP_LOGE(TAG, "data fetch error");
+            vTaskDelay(pdMS_TO_TICKS(10));
+            continue;
+        }
+
+        sr_stats_afe_fetched(res->data_size / sizeof(int16_t));
+
+        xSemaphoreTake(consumers_lock, portMAX_DELAY);
+
+        if (preroll_bytes > 0) {
+            sr_ring_write(&preroll_ring, res->data, res->data_size);
+        }
+
+        for (int i = 0; i < SR_CONSUMERS_MAX; i++) {
+            if (consumers[i] != NULL) {
+                sr_consumer_push(consumers[i], res);
+            }
+        }
+
+        xSemaphoreGive(consumers_lock);
+
+        sr_stats_busy(SR_TASK_FETCH, esp_timer_get_time() - start);
+    }
+
+    // nothing fetches any more, so the reset can not pull a frame from under anyone
+    afe_handle->reset_buffer(afe_data);
+    sr_stats_afe_reset();
+    sr_stats_task_exit(SR_TASK_FETCH);
+    is_fetch_active = false;
+
+    // consumers waiting for a frame see the feed stopped
+    xSemaphoreTake(consumers_lock, portMAX_DELAY);
+    for (int i = 0; i < SR_CONSUMERS_MAX; i++) {
+        if (consumers[i] != NULL) {
+            xSemaphoreGive(consumers[i]->ready);
+        }
+    }
+    xSemaphoreGive(consumers_lock);
+
+    ESP_LOGI(TAG, "Fetch task stopped");
+    vTaskDelete(NULL);
+}
+
 // --------------------- recording process ----------------------------------------
-esp_err_t write_file(char *filePath, int16_t *audio_buffer, int bytes_collected) {
-    // Create WAV header using the provided macro
-    wav_header_t wav_header = WAV_HEADER_PCM_DEFAULT(
-        bytes_collected,  // wav_sample_size
-        BITS_PER_SAMPLE,  // wav_sample_bits
-        SAMPLE_RATE,      // wav_sample_rate
-        CHANNELS          // wav_channel_num
-    );
+typedef struct {
+    uint8_t *buffer;
+    uint32_t size;
+    uint32_t capacity;
+} sr_memory_sink_t;
+
+// encoder output straight into the final recording buffer, the only copy of each frame
+static bool emit_to_memory(void *ctx, const uint8_t *data, uint32_t len) {
+    sr_memory_sink_t *sink = ctx;
+    if (sink->size + len > sink->capacity) {
+        return false;
+    }
 
-    // remove file if exists
-    struct stat st;
-    if (stat(filePath, &st) == 0) {
-        unlink(filePath);
-        ESP_LOGI(TAG, "file [%s] removed", filePath);
+    memcpy(sink->buffer + sink->size, data, len);
+    sink->size += len;
+
+    return true;
+}
+
+static bool encode_preroll(sr_encoder_t *encoder, sr_preroll_cursor_t *preroll, sr_encoder_emit_t emit, void *ctx) {
+    uint8_t chunk[512];
+    uint32_t n;
+
+    while ((n = preroll_read(preroll, chunk, sizeof(chunk))) > 0) {
+        if (!sr_encoder_write(encoder, chunk, n, emit, ctx)) {
+            return false;
+        }
     }
 
-    // Open file for writing
-    FILE *fp = fopen(filePath, "wb");
-    if (!fp) {
-        ESP_LOGE(TAG, "Failed to open file %s for writing", filePath);
-        stop_feed();
-        return ESP_FAIL;
+    return true;
+}
+
+// records pre-roll and record_seconds into one pool buffer that already has room for the header
+static recording_result_t *record_wav() {
+    int bytes_to_read = record_bytes();
+    uint32_t capacity = sr_encoder_max_size(recording_encoder, audio_config.sample_rate, preroll_bytes + bytes_to_read);
+    recording_result_t *result = sr_recording_acquire(capacity);
+    sr_encoder_t *encoder = malloc(sizeof(sr_encoder_t));
+    if (!result || !encoder) {
+        ESP_LOGE(TAG, "Failed to allocate recording");
+        sr_recording_release(result);
+        free(encoder);
+        return NULL;
     }
 
-    // Write WAV header
-    size_t written = fwrite(&wav_header, sizeof(wav_header), 1, fp);
-    if (written != 1) {
-        ESP_LOGE(TAG, "Failed to write WAV header to %s", filePath);
-        fclose(fp);
-        return ESP_FAIL;
+    sr_preroll_cursor_t preroll;
+    sr_consumer_handle_t consumer = consumer_open((sr_consumer_config_t)SR_CONSUMER_CONFIG_DEFAULT(), &preroll);
+    if (!consumer) {
+        sr_recording_release(result);
+        free(encoder);
+        return NULL;
     }
 
-    ESP_LOGI(TAG, "Writing audio buffer to file: %d", bytes_collected);
+    sr_encoder_init(encoder, recording_encoder, audio_config.sample_rate);
+
+    sr_memory_sink_t sink = {
+        .buffer = result->data_buffer,
+        .size = sr_encoder_header_size(encoder),
+        .capacity = capacity,
+    };
+
+    bool ok = encode_preroll(encoder, &preroll, emit_to_memory, &sink);
 
-    // Write audio data in chunks to handle large buffers
-    size_t bytes_remaining = bytes_collected;
-    size_t offset = 0;
-    while (bytes_remaining > 0) {
-        size_t chunk_to_write = bytes_remaining > 10000 ? 10000 : bytes_remaining;
-        written = fwrite(audio_buffer + offset, 1, chunk_to_write, fp);
-        
-        if (written != chunk_to_write) {
-            ESP_LOGE(TAG, "Failed to write audio data to %s, wrote %d/%d bytes",filePath, written, chunk_to_write);
-        
-            fclose(fp);
+    ESP_LOGI(TAG, "Starting %ld-second audio recording at %ld Hz, pre-roll %ld samples", (long)audio_config.record_seconds,
+             (long)encoder->sample_rate, (long)encoder->samples);
 
-            return ESP_FAIL;
+    int bytes_collected = 0;
+    while (ok && bytes_collected < bytes_to_read) {
+        afe_fetch_result_t *res = sr_consumer_fetch(consumer, portMAX_DELAY);
+        if (!res || res->ret_value == ESP_FAIL) {
+            ESP_LOGE(TAG, "AFE fetch error");
+            ok = false;
+            break;
         }
-        
-        bytes_remaining -= written;
-        offset += written / sizeof(int16_t);
-        // ESP_LOGI(TAG, "Wrote %d bytes, remaining: %d/%d", written, bytes_remaining, bytes_collected);
+
+        int chunk_size = (bytes_to_read - bytes_collected) > res->data_size ? res->data_size : (bytes_to_read - bytes_collected);
+        ok = sr_encoder_write(encoder, res->data, chunk_size, emit_to_memory, &sink);
+
+        bytes_collected += chunk_size;
     }
 
-    ESP_LOGI(TAG, "Written audio buffer to file, remaining: %d/%d", bytes_remaining, bytes_collected);
+    // the feed stops with its last consumer
+    consumer_close(consumer, false);
 
-    fclose(fp);
+    ok = ok && sr_encoder_finish(encoder, emit_to_memory, &sink);
+    if (!ok) {
+        sr_recording_release(result);
+        free(encoder);
+        return NULL;
+    }
 
-    return ESP_OK;
+    ESP_LOGI(TAG, "Recording done, total collected: %ld samples, encoded to %ld bytes",
+             (long)encoder->samples, (long)encoder->data_size);
+
+    // header in front of the audio, now that the sizes are known
+    sr_encoder_header(encoder, result->data_buffer);
+    result->data_buffer_size = sink.size;
+    result->encoding = recording_encoder.encoding;
+
+    free(encoder);
+
+    return result;
 }
 
+// streams pre-roll and record_seconds to a WAV file as the frames arrive, no recording sized buffer
 esp_err_t record_to_file(void *arg) {
     char *filePath = (char *)arg;
-    esp_err_t ret = ESP_OK;
-    size_t bytes_read;
-    int16_t *audio_buffer = malloc(BUFFER_SIZE);
-    if (!audio_buffer) {
-        ESP_LOGE(TAG, "Failed to allocate memory for audio buffer (%d bytes)", BUFFER_SIZE);
-        stop_feed();
+
+    // remove file if exists
+    struct stat st;
+    if (stat(filePath, &st) == 0) {
+        unlink(filePath);
+        ESP_LOGI(TAG, "file [%s] removed", filePath);
+    }
+
+    sr_preroll_cursor_t preroll;
+    sr_consumer_handle_t consumer = consumer_open((sr_consumer_config_t)SR_CONSUMER_CONFIG_DEFAULT(), &preroll);
+    if (!consumer) {
         sr_trigger_event(RECORDING_FAIL);
         return ESP_FAIL;
     }
 
-    // Get AFE chunk size and allocate temp buffer
-    int afe_chunk_size = afe_handle->get_fetch_chunksize(afe_data);
-    int16_t *temp_buffer = (int16_t *)malloc(afe_chunk_size * sizeof(int16_t));
-    if (!temp_buffer) {
-        ESP_LOGE(TAG, "Failed to allocate temporary buffer (%d bytes)", afe_chunk_size * sizeof(int16_t));
-        stop_feed();
-        free(audio_buffer);
+    sr_wav_writer_handle_t writer = sr_wav_open_encoded(filePath, 0, recording_encoder);
+    if (!writer) {
+        consumer_close(consumer, false);
         sr_trigger_event(RECORDING_FAIL);
         return ESP_FAIL;
     }
 
-    // Calculate total samples needed for 3 seconds
-    int total_samples = SAMPLE_RATE * RECORD_SECONDS;
-    int bytes_to_read = total_samples * sizeof(int16_t);
-    int bytes_collected = 0;
+    esp_err_t ret = ESP_OK;
 
-    ESP_LOGI(TAG, "Starting 3-second audio recording to %s, AFE chunk size: %d bytes", filePath, afe_chunk_size * sizeof(int16_t));
+    uint8_t chunk[512];
+    uint32_t n;
+    while (ret == ESP_OK && (n = preroll_read(&preroll, chunk, sizeof(chunk))) > 0) {
+        ret = sr_wav_write(writer, chunk, n);
+    }
 
-    // Read audio data from AFE
-    while (bytes_collected < bytes_to_read) {
-        afe_fetch_result_t *res = afe_handle->fetch(afe_data);
+    ESP_LOGI(TAG, "Starting %ld-second audio recording to %s, pre-roll %ld bytes", (long)audio_config.record_seconds, filePath, (long)sr_wav_size(writer));
+
+    int bytes_to_read = record_bytes();
+    int bytes_collected = 0;
+    while (ret == ESP_OK && bytes_collected < bytes_to_read) {
+        afe_fetch_result_t *res = sr_consumer_fetch(consumer, portMAX_DELAY);
         if (!res || res->ret_value == ESP_FAIL) {
             ESP_LOGE(TAG, "AFE fetch error");
-            stop_feed();
-            free(temp_buffer);
-            free(audio_buffer);
-            sr_trigger_event(RECORDING_FAIL);
-            return ESP_FAIL;
+            ret = ESP_FAIL;
+            break;
         }
 
-        // Copy AFE data to audio buffer
-        size_t chunk_size = (bytes_to_read - bytes_collected) > afe_chunk_size * sizeof(int16_t) ? afe_chunk_size * sizeof(int16_t) : (bytes_to_read - bytes_collected);
-        memcpy(temp_buffer, res->data, chunk_size);
-        memcpy(audio_buffer + (bytes_collected / sizeof(int16_t)), temp_buffer, chunk_size);
-        bytes_read = chunk_size;
-
-        bytes_collected += bytes_read;
-        // ESP_LOGI(TAG, "Read %d bytes from AFE, total collected: %d/%d", bytes_read, bytes_collected, bytes_to_read);
+        int chunk_size = (bytes_to_read - bytes_collected) > res->data_size ? res->data_size : (bytes_to_read - bytes_collected);
+        ret = sr_wav_write(writer, res->data, chunk_size);
+        bytes_collected += chunk_size;
     }
 
-    ESP_LOGI(TAG, "Recording done, total collected: %d/%d", bytes_collected, bytes_to_read);
+    // the feed stops with its last consumer
+    consumer_close(consumer, false);
 
-    // stop the feed since we no longer need the data
-    stop_feed();
-
-    for (int i = 0; i < 3; i++) {
-        ESP_LOGI(TAG, "try writing to file: %s", filePath);
+    uint32_t wav_data_size = sr_wav_size(writer);
+    if (sr_wav_close(writer) != ESP_OK) {
+        ret = ESP_FAIL;
+    }
 
-        esp_err_t res = write_file(filePath, audio_buffer, bytes_collected);
-        if (res == ESP_OK) {
-            sr_trigger_event(RECORDING_SUCCESS);
-            break;
-        } else if (i == 2) {
-            sr_trigger_event(RECORDING_FAIL);
-            break;
-        }
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "Recording to %s failed", filePath);
+        sr_trigger_event(RECORDING_FAIL);
+        return ESP_FAIL;
     }
 
-    free(temp_buffer);  // Free temp buffer after loop
-    free(audio_buffer);
+    ESP_LOGI(TAG, "Recording done, total collected: %ld", (long)wav_data_size);
+    sr_trigger_event(RECORDING_SUCCESS);
 
     return ESP_OK;
 }
 
 recording_result_t* record_to_buffer() {
-    recording_result_t *result = (recording_result_t *)malloc(sizeof(recording_result_t));
+    recording_result_t *result = record_wav();
     if (!result) {
-        ESP_LOGE(TAG, "Failed to allocate recording_result_t");
-        stop_feed();
         sr_trigger_event(RECORDING_FAIL);
         return NULL;
     }
-    result->data_buffer = NULL;
-    result->data_buffer_size = 0;
 
-    size_t bytes_read;
-    int16_t *audio_buffer = malloc(BUFFER_SIZE);
-    if (!audio_buffer) {
-        ESP_LOGE(TAG, "Failed to allocate memory for audio buffer (%d bytes)", BUFFER_SIZE);
-        stop_feed();
-        free(result);
+    ESP_LOGI(TAG, "WAV buffer created, size: %ld bytes", (long)result->data_buffer_size);
+    sr_trigger_event(RECORDING_SUCCESS);
+
+    return result;
+}
+
+// encodes straight into a buffer sized for max_ms, the same single copy as record_wav
+recording_result_t *record_vad_to_buffer(sr_vad_record_config_t config) {
+    uint32_t min_bytes = (uint64_t)BYTE_RATE * config.min_ms / 1000;
+    uint32_t max_bytes = (uint64_t)BYTE_RATE * config.max_ms / 1000;
+    uint32_t silence_bytes = (uint64_t)BYTE_RATE * config.silence_ms / 1000;
+
+    uint32_t capacity = sr_encoder_max_size(recording_encoder, audio_config.sample_rate, preroll_bytes + max_bytes);
+    recording_result_t *result = sr_recording_acquire(capacity);
+    sr_encoder_t *encoder = malloc(sizeof(sr_encoder_t));
+    if (!result || !encoder) {
+        ESP_LOGE(TAG, "Failed to allocate recording");
+        sr_recording_release(result);
+        free(encoder);
         sr_trigger_event(RECORDING_FAIL);
         return NULL;
     }
 
-    // Get AFE chunk size and allocate temp buffer
-    int afe_chunk_size = afe_handle->get_fetch_chunksize(afe_data);
-    int16_t *temp_buffer = (int16_t *)malloc(afe_chunk_size * sizeof(int16_t));
-    if (!temp_buffer) {
-        ESP_LOGE(TAG, "Failed to allocate temporary buffer (%d bytes)", afe_chunk_size * sizeof(int16_t));
-        stop_feed();
-        free(audio_buffer);
-        free(result);
+    sr_preroll_cursor_t preroll;
+    sr_consumer_handle_t consumer = consumer_open((sr_consumer_config_t)SR_CONSUMER_CONFIG_DEFAULT(), &preroll);
+    if (!consumer) {
+        sr_recording_release(result);
+        free(encoder);
         sr_trigger_event(RECORDING_FAIL);
         return NULL;
     }
 
-    // Calculate total samples needed for 3 seconds
-    int total_samples = SAMPLE_RATE * RECORD_SECONDS;
-    int bytes_to_read = total_samples * sizeof(int16_t);
-    int bytes_collected = 0;
+    sr_encoder_init(encoder, recording_encoder, audio_config.sample_rate);
 
-    ESP_LOGI(TAG, "Starting 3-second audio recording, AFE chunk size: %d bytes", afe_chunk_size * sizeof(int16_t));
+    sr_memory_sink_t sink = {
+        .buffer = result->data_buffer,
+        .size = sr_encoder_header_size(encoder),
+        .capacity = capacity,
+    };
 
-    // Read audio data from AFE
-    while (bytes_collected < bytes_to_read) {
-        afe_fetch_result_t *res = afe_handle->fetch(afe_data);
+    bool ok = encode_preroll(encoder, &preroll, emit_to_memory, &sink);
+
+    uint32_t recorded = 0;
+    uint32_t silence = 0;
+    bool speech = false;
+
+    ESP_LOGI(TAG, "Starting VAD recording, %ld..%ld ms, %ld ms trailing silence",
+             (long)config.min_ms, (long)config.max_ms, (long)config.silence_ms);
+
+    while (ok && recorded < max_bytes) {
+        afe_fetch_result_t *res = sr_consumer_fetch(consumer, portMAX_DELAY);
         if (!res || res->ret_value == ESP_FAIL) {
             ESP_LOGE(TAG, "AFE fetch error");
-            stop_feed();
-            free(temp_buffer);
-            free(audio_buffer);
-            free(result);
-            sr_trigger_event(RECORDING_FAIL);
-            return NULL;
+            ok = false;
+            break;
         }
 
-        // Copy AFE data to audio buffer
-        size_t chunk_size = (bytes_to_read - bytes_collected) > afe_chunk_size * sizeof(int16_t) ? 
-                            afe_chunk_size * sizeof(int16_t) : (bytes_to_read - bytes_collected);
-        memcpy(temp_buffer, res->data, chunk_size);
-        memcpy(audio_buffer + (bytes_collected / sizeof(int16_t)), temp_buffer, chunk_size);
-        bytes_read = chunk_size;
+        uint32_t len = res->data_size;
+        if (len > max_bytes - recorded) {
+            len = max_bytes - recorded;
+        }
 
-        bytes_collected += bytes_read;
-        // ESP_LOGI(TAG, "Read %d bytes from AFE, total collected: %d/%d", bytes_read, bytes_collected, bytes_to_read);
-    }
+        ok = sr_encoder_write(encoder, res->data, len, emit_to_memory, &sink);
+        recorded += len;
 
-    ESP_LOGI(TAG, "Recording done, total collected: %d/%d", bytes_collected, bytes_to_read);
+        if (res->vad_state == AFE_VAD_SPEECH) {
+            speech = true;
+            silence = 0;
+        } else {
+            silence += len;
+        }
 
-    // Stop the feed since we no longer need the data
-    stop_feed();
+        // without any speech the recording still ends once min and silence are both reached
+        if (recorded >= min_bytes && silence >= silence_bytes) {
+            break;
+        }
+    }
 
-    // Create WAV header
-    wav_header_t wav_header = WAV_HEADER_PCM_DEFAULT(
-        bytes_collected,  // wav_sample_size
-        BITS_PER_SAMPLE,  // wav_sample_bits
-        SAMPLE_RATE,      // wav_sample_rate
-        CHANNELS          // wav_channel_num
-    );
+    // the feed stops with its last consumer
+    consumer_close(consumer, false);
 
-    // Allocate output buffer for WAV file (header + audio data)
-    size_t wav_buffer_size = sizeof(wav_header_t) + bytes_collected;
-    uint8_t *wav_buffer = (uint8_t *)malloc(wav_buffer_size);
-    if (!wav_buffer) {
-        ESP_LOGE(TAG, "Failed to allocate WAV buffer (%d bytes)", wav_buffer_size);
-        free(temp_buffer);
-        free(audio_buffer);
-        free(result);
+    ok = ok && sr_encoder_finish(encoder, emit_to_memory, &sink);
+    if (!ok) {
+        ESP_LOGE(TAG, "VAD recording failed");
+        sr_recording_release(result);
+        free(encoder);
         sr_trigger_event(RECORDING_FAIL);
         return NULL;
     }
 
-    // Copy header and audio data to output buffer
-    memcpy(wav_buffer, &wav_header, sizeof(wav_header_t));
-    memcpy(wav_buffer + sizeof(wav_header_t), audio_buffer, bytes_collected);
+    ESP_LOGI(TAG, "Recording done after %ld ms, speech %s, total collected: %ld samples",
+             (long)(recorded * 1000ULL / BYTE_RATE), speech ? "yes" : "no", (long)encoder->samples);
+
+    sr_encoder_header(encoder, result->data_buffer);
+    result->data_buffer_size = sink.size;
+    result->encoding = recording_encoder.encoding;
 
-    free(temp_buffer);
-    free(audio_buffer);
+    free(encoder);
 
-    ESP_LOGI(TAG, "WAV buffer created, size: %d bytes", wav_buffer_size);
+    ESP_LOGI(TAG, "WAV buffer created, size: %ld bytes", (long)sink.size);
     sr_trigger_event(RECORDING_SUCCESS);
 
-    result->data_buffer = wav_buffer;
-    result->data_buffer_size = wav_buffer_size;
-    
     return result;
 }
 
@@ -286,30 +646,90 @@ void record_task(void *arg) {
     vTaskDelete(NULL);
 }
 
+// the recording opens its own consumer, which starts the feed if it is not running yet
 recording_result_t* wav_record() {
-    start_feed();
     return record_to_buffer();
 }
 
+recording_result_t* wav_record_vad(sr_vad_record_config_t config) {
+    return record_vad_to_buffer(config);
+}
+
+void sr_set_encoder(sr_encoder_config_t config) {
+    recording_encoder = config;
+}
+
 // --------------------- feed process ----------------------------------------
 esp_err_t bsp_get_feed_data(int16_t *buffer, int buffer_len) {
     esp_err_t ret = ESP_OK;
     size_t bytes_read;
     int audio_chunksize = buffer_len / (sizeof(int32_t));
 
+    // 16 bit microphones fill the first half, the samples are then widened to the int32 slot layout
+    if (audio_config.bit_width == I2S_DATA_BIT_WIDTH_16BIT) {
+        ret = i2s_channel_read(rx_handle, buffer, buffer_len / 2, &bytes_read, portMAX_DELAY);
+        sr_expand_samples16((int32_t *)buffer, audio_chunksize);
+        return ret;
+    }
+
     ret = i2s_channel_read(rx_handle, buffer, buffer_len, &bytes_read, portMAX_DELAY);
 
-    int32_t *tmp_buff = buffer;
-    for (int i = 0; i < audio_chunksize; i++) {
-        tmp_buff[i] = tmp_buff[i] >> 14;
-        // 32:8 is the effective bit, 8:0 is the lower 8 bits, all are
-        // 0, the input of AFE is 16-bit voice data, and 29:13 bits are
-        // used to amplify the voice signal.
-    }
+    // 32:8 is the effective bit, 8:0 is the lower 8 bits, all are
+    // 0, the input of AFE is 16-bit voice data, and 29:13 bits are
+    // used to amplify the voice signal.
+    sr_convert_samples((int32_t *)buffer, audio_chunksize, feed_conversion.gain_shift, feed_conversion.saturate);
 
     return ret;
 }
 
+void sr_set_feed_conversion(sr_feed_conversion_t conversion) {
+    feed_conversion = conversion;
+}
+
+esp_err_t sr_convert_benchmark(int samples, sr_convert_stats_t *stats) {
+    if (samples <= 0 || stats == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    int32_t *reference = malloc(samples * sizeof(int32_t));
+    int32_t *optimized = malloc(samples * sizeof(int32_t));
+    if (!reference || !optimized) {
+        ESP_LOGE(TAG, "Failed to allocate benchmark buffers (2 x %d bytes)", samples * sizeof(int32_t));
+        free(reference);
+        free(optimized);
+        return ESP_ERR_NO_MEM;
+    }
+
+    // random full scale slots, with the extremes that show wrap-around
+    esp_fill_random(reference, samples * sizeof(int32_t));
+    reference[0] = INT32_MAX;
+    reference[samples - 1] = INT32_MIN;
+    memcpy(optimized, reference, samples * sizeof(int32_t));
+
+    int shift = feed_conversion.gain_shift;
+    bool saturate = feed_conversion.saturate;
+
+    uint32_t start = esp_cpu_get_cycle_count();
+    sr_convert_samples_reference(reference, samples, shift, saturate);
+    stats->reference_cycles = esp_cpu_get_cycle_count() - start;
+
+    start = esp_cpu_get_cycle_count();
+    sr_convert_samples(optimized, samples, shift, saturate);
+    stats->optimized_cycles = esp_cpu_get_cycle_count() - start;
+
+    stats->samples = samples;
+    stats->match = memcmp(reference, optimized, samples * sizeof(int32_t)) == 0;
+
+    ESP_LOGI(TAG, "convert %d samples, shift %d%s: reference %ld cycles, optimized %ld cycles, %s",
+             samples, shift, saturate ? " saturated" : "", (long)stats->reference_cycles,
+             (long)stats->optimized_cycles, stats->match ? "match" : "MISMATCH");
+
+    free(reference);
+    free(optimized);
+
+    return stats->match ? ESP_OK : ESP_FAIL;
+}
+
 void feed_task(void *arg) {
     int audio_chunksize = afe_handle->get_feed_chunksize(afe_data);
     int nch = afe_handle->get_channel_num(afe_data);
@@ -321,11 +741,36 @@ void feed_task(void *arg) {
 
     sr_trigger_event(SR_FEED_START);
 
-    while (is_feed_active) {
-        bsp_get_feed_data(i2s_buff, audio_chunksize * sizeof(int16_t) * feed_channel);
+    // audio carried by one chunk, the pace the loop has to keep
+    uint32_t chunk_us = (uint64_t)audio_chunksize * 1000000 / SAMPLE_RATE;
+    int64_t previous_start = 0;
+    int iterations = 0;
+
+    // keeps feeding until the fetch task is out of its last fetch
+    while (is_feed_active || is_fetch_active) {
+        if (++iterations % SR_STATS_UPDATE_INTERVAL == 0) {
+            sr_stats_task_update(SR_TASK_FEED);
+        }
+
+        int64_t start = esp_timer_get_time();
+        if (previous_start > 0 && start - previous_start > chunk_us + chunk_us / 4) {
+            sr_stats_missed_deadline();
+        }
+        previous_start = start;
+
+        esp_err_t ret = bsp_get_feed_data(i2s_buff, audio_chunksize * sizeof(int16_t) * feed_channel);
+        if (sr_stats_record(SR_STAGE_I2S_READ, start) > 2 * chunk_us || ret != ESP_OK) {
+            sr_stats_i2s_stall();
+        }
+
+        int64_t feed_start = esp_timer_get_time();
         afe_handle->feed(afe_data, i2s_buff);
+        sr_stats_busy(SR_TASK_FEED, sr_stats_record(SR_STAGE_FEED, feed_start));
+        sr_stats_afe_fed(audio_chunksize);
     }
 
+    sr_stats_task_exit(SR_TASK_FEED);
+
     if (i2s_buff) {
         free(i2s_buff);
         i2s_buff = NULL;
@@ -333,41 +778,66 @@ void feed_task(void *arg) {
 
     ESP_LOGI(TAG, "Feeding task stopped");
 
+    is_feed_running = false;
     sr_trigger_event(SR_FEED_STOP);
     vTaskDelete(NULL);
 }
 
+// called with feed_lock held when the first user arrives
+static void feed_start_locked() {
+    // a stop in progress finishes within a frame, the feed keeps running until then
+    while (is_fetch_active || is_feed_running) {
+        vTaskDelay(pdMS_TO_TICKS(5));
+    }
+
+    is_feed_active = true;
+    is_fetch_active = true;
+    is_feed_running = true;
+    xTaskCreatePinnedToCore(&feed_task, "feed", 10 * 1024, NULL, 5, NULL, 1);
+    xTaskCreatePinnedToCore(&fetch_task, "fetch", 8 * 1024, NULL, 8, NULL, 1);
+}
+
 void start_feed() {
-    // prevent multiple feed calls
-    if (!is_feed_active) {
-        is_feed_active = true;
-        xTaskCreatePinnedToCore(&feed_task, "feed", 10 * 1024, NULL, 5, NULL, 1);
-    } else {
-        ESP_LOGI(TAG, "feed already in progress");
+    if (feed_lock == NULL) {
+        return;
     }
+
+    xSemaphoreTake(feed_lock, portMAX_DELAY);
+    feed_take_locked();
+    xSemaphoreGive(feed_lock);
 }
 
 void stop_feed() {
-    is_feed_active = false;
-    afe_handle->reset_buffer(afe_data);
+    if (feed_lock == NULL) {
+        return;
+    }
+
+    xSemaphoreTake(feed_lock, portMAX_DELAY);
+    feed_give_locked();
+    xSemaphoreGive(feed_lock);
 }
 
 // --------------------- wakeword process ----------------------------------------
 void wakeup_word_detect_task(void *arg) {
-    esp_afe_sr_data_t *afe_data = arg;
-    //     int detect_flag = false;
-    // int afe_chunksize = afe_handle->get_fetch_chunksize(afe_data);
+    sr_consumer_handle_t consumer = (sr_consumer_handle_t)arg;
 
     ESP_LOGI(TAG, "wakeup word detect start");
 
     sr_trigger_event(SR_WAKEWORD_START);
+    int iterations = 0;
     while (true && continue_wakeword_detection) {
-        afe_fetch_result_t *res = afe_handle->fetch(afe_data);
+        if (++iterations % SR_STATS_UPDATE_INTERVAL == 0) {
+            sr_stats_task_update(SR_TASK_DETECT);
+        }
+
+        afe_fetch_result_t *res = sr_consumer_fetch(consumer, portMAX_DELAY);
         if (!res || res->ret_value == ESP_FAIL) {
             ESP_LOGE(TAG, "data fetch error");
             break;
         }
 
+        int64_t start = esp_timer_get_time();
+
         if (res->wakeup_state == WAKENET_DETECTED) {
             ESP_LOGI(TAG, "WAKEWORD DETECTED");
 
@@ -378,9 +848,15 @@ void wakeup_word_detect_task(void *arg) {
                 break;
             }
         }
+
+        sr_stats_busy(SR_TASK_DETECT, esp_timer_get_time() - start);
     }
 
-    stop_feed();
+    sr_stats_task_exit(SR_TASK_DETECT);
+
+    // with pre-roll the feed is handed to a recording started within SR_FEED_HANDOVER_TIMEOUT_MS,
+    // so it continues right after the wake word
+    consumer_close(consumer, preroll_bytes > 0 && continue_wakeword_detection);
 
     ESP_LOGI(TAG, "wakeup word detect exit");
 
@@ -389,8 +865,13 @@ void wakeup_word_detect_task(void *arg) {
 }
 
 void start_wakeup_listener() {
-    start_feed();
-    xTaskCreatePinnedToCore(&wakeup_word_detect_task, "detect", 8 * 1024, (void *)afe_data, 10, NULL, 1);
+    sr_consumer_handle_t consumer = sr_consumer_open((sr_consumer_config_t)SR_CONSUMER_CONFIG_DEFAULT());
+    if (!consumer) {
+        ESP_LOGE(TAG, "wakeup word detect not started");
+        return;
+    }
+
+    xTaskCreatePinnedToCore(&wakeup_word_detect_task, "detect", 8 * 1024, (void *)consumer, 10, NULL, 1);
 }
 
 void stop_wakeup_listener() {
@@ -398,7 +879,13 @@ void stop_wakeup_listener() {
 }
 
 // --------------------- mic init ----------------------------------------
-esp_err_t init_microphone(i2s_std_gpio_config_t config) {
+// DMA buffers were full when more audio arrived, the feed task fell behind
+static bool IRAM_ATTR on_recv_overflow(i2s_chan_handle_t handle, i2s_event_data_t *event, void *ctx) {
+    sr_stats_dma_overflow();
+    return false;
+}
+
+esp_err_t init_microphone(sr_audio_config_t config) {
     esp_err_t ret_val = ESP_OK;
 
     /* RX channel will be registered on our second I2S (for now)*/
@@ -406,25 +893,19 @@ esp_err_t init_microphone(i2s_std_gpio_config_t config) {
     i2s_new_channel(&rx_chan_cfg, NULL, &rx_handle);
     i2s_std_config_t std_rx_cfg = {
         .clk_cfg = I2S_STD_CLK_DEFAULT_CONFIG(SAMPLE_RATE),
-        .slot_cfg = I2S_STD_PHILIPS_SLOT_DEFAULT_CONFIG(I2S_DATA_BIT_WIDTH_32BIT, I2S_SLOT_MODE_MONO),
-        .gpio_cfg = {
-            .mclk = I2S_GPIO_UNUSED,
-            .bclk = GPIO_NUM_5,
-            .ws = GPIO_NUM_6,
-            .dout = I2S_GPIO_UNUSED,
-            .din = GPIO_NUM_4,
-            .invert_flags = {
-                .mclk_inv = false,
-                .bclk_inv = false,
-                .ws_inv = false,
-            },
-        },
+        .slot_cfg = I2S_STD_PHILIPS_SLOT_DEFAULT_CONFIG(config.bit_width, I2S_SLOT_MODE_MONO),
+        .gpio_cfg = config.gpio,
     };
-    std_rx_cfg.slot_cfg.slot_mask = I2S_STD_SLOT_LEFT;
+    std_rx_cfg.slot_cfg.slot_mask = config.slot_mask;
     // ESP_ERROR_CHECK(i2s_channel_init_std_mode(rx_handle, &std_rx_cfg));
     // ESP_ERROR_CHECK(i2s_channel_enable(rx_handle));
 
+    i2s_event_callbacks_t callbacks = {
+        .on_recv_q_ovf = on_recv_overflow,
+    };
+
     ret_val |= i2s_channel_init_std_mode(rx_handle, &std_rx_cfg);
+    ret_val |= i2s_channel_register_event_callback(rx_handle, &callbacks, NULL);
     ret_val |= i2s_channel_enable(rx_handle);
 
     return ret_val;
@@ -433,7 +914,35 @@ esp_err_t init_microphone(i2s_std_gpio_config_t config) {
 // --------------------- init process ----------------------------------------
 
 esp_afe_sr_iface_t sr_init(afe_config_t config, i2s_std_gpio_config_t micConfig) {
-    init_microphone(micConfig);
+    sr_audio_config_t audio = SR_AUDIO_CONFIG_DEFAULT();
+    audio.gpio = micConfig;
+
+    return sr_init_audio(config, audio);
+}
+
+esp_afe_sr_iface_t sr_init_audio(afe_config_t config, sr_audio_config_t audio) {
+    // the AFE only runs at SAMPLE_RATE, lower rates are made by decimating its output
+    if (audio.sample_rate != SAMPLE_RATE && audio.sample_rate != SAMPLE_RATE / 2) {
+        ESP_LOGE(TAG, "unsupported sample rate %ld, using %d", (long)audio.sample_rate, SAMPLE_RATE);
+        audio.sample_rate = SAMPLE_RATE;
+    }
+    if (audio.bit_width != I2S_DATA_BIT_WIDTH_16BIT) {
+        audio.bit_width = I2S_DATA_BIT_WIDTH_32BIT;
+    }
+    audio_config = audio;
+
+    // buffers are reserved before the heap gets fragmented, the default fits a fixed recording
+    sr_pool_config_t pool = audio.pool;
+    if (pool.buffer_size == 0) {
+        sr_encoder_config_t pcm = SR_ENCODER_CONFIG_DEFAULT();
+        pool.buffer_size = sr_encoder_max_size(pcm, SAMPLE_RATE, BYTE_RATE * (audio.record_seconds + 1));
+    }
+    esp_err_t ret = sr_pool_init(pool);
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "recording pool not reserved (%s), recordings allocate on demand", esp_err_to_name(ret));
+    }
+
+    init_microphone(audio);
 
     srmodel_list_t *models = esp_srmodel_init("model");
 
@@ -455,6 +964,25 @@ esp_afe_sr_iface_t sr_init(afe_config_t config, i2s_std_gpio_config_t micConfig)
     afe_handle = (esp_afe_sr_iface_t *)&ESP_AFE_SR_HANDLE;
     afe_data = afe_handle->create_from_config(&config);
 
+    if (consumers_lock == NULL) {
+        consumers_lock = xSemaphoreCreateMutex();
+    }
+    if (feed_lock == NULL) {
+        feed_lock = xSemaphoreCreateMutex();
+    }
+    if (handover_timer == NULL) {
+        esp_timer_create_args_t args = {
+            .callback = handover_expired,
+            .name = "sr_handover",
+        };
+        if (esp_timer_create(&args, &handover_timer) != ESP_OK) {
+            ESP_LOGW(TAG, "Failed to create handover timer, the feed is not handed to recordings");
+            handover_timer = NULL;
+        }
+    }
+
+    sr_stats_reset();
+
     sr_trigger_event(SR_SYSTEM_READY);
     return *afe_handle;
 }
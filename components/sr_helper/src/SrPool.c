@@ -0,0 +1,148 @@
+#include "SrPool.h"
+
+#include <string.h>
+
+static const char *TAG = "SR Pool";
+
+static recording_result_t *results = NULL;  // one per buffer, free while refs is 0
+static uint8_t *memory = NULL;
+static sr_pool_stats_t stats;
+static portMUX_TYPE pool_lock = portMUX_INITIALIZER_UNLOCKED;
+
+esp_err_t sr_pool_init(sr_pool_config_t config) {
+    portENTER_CRITICAL(&pool_lock);
+    bool busy = stats.in_use > 0;
+    portEXIT_CRITICAL(&pool_lock);
+
+    if (busy) {
+        ESP_LOGE(TAG, "%ld buffers still in use", (long)stats.in_use);
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    free(results);
+    heap_caps_free(memory);
+    results = NULL;
+    memory = NULL;
+    memset(&stats, 0, sizeof(stats));
+
+    if (config.count == 0 || config.buffer_size == 0) {
+        return ESP_OK;
+    }
+
+    // one reservation for all buffers, it is never split up or given back
+    results = calloc(config.count, sizeof(recording_result_t));
+    memory = heap_caps_malloc((size_t)config.count * config.buffer_size, config.caps | MALLOC_CAP_8BIT);
+    if (!results || !memory) {
+        ESP_LOGE(TAG, "Failed to reserve %ld x %ld bytes", (long)config.count, (long)config.buffer_size);
+        free(results);
+        heap_caps_free(memory);
+        results = NULL;
+        memory = NULL;
+        return ESP_ERR_NO_MEM;
+    }
+
+    for (uint32_t i = 0; i < config.count; i++) {
+        results[i].data_buffer = memory + i * config.buffer_size;
+        results[i].capacity = config.buffer_size;
+        results[i].slot = i;
+    }
+
+    stats.count = config.count;
+    stats.buffer_size = config.buffer_size;
+
+    ESP_LOGI(TAG, "%ld recording buffers of %ld bytes reserved", (long)config.count, (long)config.buffer_size);
+
+    return ESP_OK;
+}
+
+recording_result_t *sr_recording_acquire(uint32_t size) {
+    recording_result_t *result = NULL;
+
+    portENTER_CRITICAL(&pool_lock);
+
+    if (size <= stats.buffer_size) {
+        for (uint32_t i = 0; i < stats.count; i++) {
+            if (results[i].refs == 0) {
+                result = &results[i];
+                result->refs = 1;
+                break;
+            }
+        }
+
+        if (result != NULL) {
+            stats.acquired++;
+            stats.in_use++;
+            if (stats.in_use > stats.in_use_max) {
+                stats.in_use_max = stats.in_use;
+            }
+        } else {
+            stats.exhausted++;
+        }
+    }
+
+    if (result == NULL) {
+        stats.heap_fallbacks++;
+    }
+
+    portEXIT_CRITICAL(&pool_lock);
+
+    if (result != NULL) {
+        result->data_buffer_size = 0;
+        result->encoding = SR_ENCODING_PCM;
+        return result;
+    }
+
+    ESP_LOGW(TAG, "No pool buffer for %ld bytes, using the heap", (long)size);
+
+    result = calloc(1, sizeof(recording_result_t));
+    uint8_t *buffer = malloc(size);
+    if (!result || !buffer) {
+        ESP_LOGE(TAG, "Failed to allocate recording (%ld bytes)", (long)size);
+        free(result);
+        free(buffer);
+        return NULL;
+    }
+
+    result->data_buffer = buffer;
+    result->capacity = size;
+    result->refs = 1;
+    result->slot = -1;
+
+    return result;
+}
+
+void sr_recording_retain(recording_result_t *result) {
+    if (!result) {
+        return;
+    }
+
+    portENTER_CRITICAL(&pool_lock);
+    result->refs++;
+    portEXIT_CRITICAL(&pool_lock);
+}
+
+void sr_recording_release(recording_result_t *result) {
+    if (!result) {
+        return;
+    }
+
+    portENTER_CRITICAL(&pool_lock);
+
+    bool last = --result->refs == 0;
+    if (last && result->slot >= 0) {
+        stats.in_use--;
+    }
+
+    portEXIT_CRITICAL(&pool_lock);
+
+    if (last && result->slot < 0) {
+        free(result->data_buffer);
+        free(result);
+    }
+}
+
+void sr_pool_stats(sr_pool_stats_t *out) {
+    portENTER_CRITICAL(&pool_lock);
+    *out = stats;
+    portEXIT_CRITICAL(&pool_lock);
+}
@@ -0,0 +1,8 @@
+#pragma once
+
+#include "SrHelper.h"
+
+// fixed recording buffers reserved in one allocation, handed out as reference counted results
+
+// replaces the current pool, fails while any of its buffers is still held
+esp_err_t sr_pool_init(sr_pool_config_t config);
@@ -0,0 +1,112 @@
+#include "SrRingBuffer.h"
+
+#include <string.h>
+
+#include "esp_heap_caps.h"
+#include "esp_log.h"
+
+static const char *TAG = "SR Ring";
+
+esp_err_t sr_ring_init(sr_ring_t *ring, uint32_t size, uint32_t caps) {
+    uint32_t rounded = 1;
+    while (rounded < size) {
+        rounded <<= 1;
+    }
+
+    ring->data = heap_caps_malloc(rounded, caps | MALLOC_CAP_8BIT);
+    if (ring->data == NULL) {
+        ESP_LOGE(TAG, "Failed to allocate ring buffer (%ld bytes)", (long)rounded);
+        return ESP_ERR_NO_MEM;
+    }
+
+    ring->size = rounded;
+    ring->overruns = 0;
+    atomic_init(&ring->claimed, 0);
+    atomic_init(&ring->head, 0);
+
+    return ESP_OK;
+}
+
+void sr_ring_free(sr_ring_t *ring) {
+    heap_caps_free(ring->data);
+    ring->data = NULL;
+    ring->size = 0;
+}
+
+// copies len bytes at position pos of an endless stream into the ring
+static void ring_copy_in(sr_ring_t *ring, uint32_t pos, const uint8_t *data, uint32_t len) {
+    uint32_t offset = pos & (ring->size - 1);
+    uint32_t first = ring->size - offset < len ? ring->size - offset : len;
+
+    memcpy(ring->data + offset, data, first);
+    memcpy(ring->data, data + first, len - first);
+}
+
+static void ring_copy_out(sr_ring_t *ring, uint32_t pos, uint8_t *out, uint32_t len) {
+    uint32_t offset = pos & (ring->size - 1);
+    uint32_t first = ring->size - offset < len ? ring->size - offset : len;
+
+    memcpy(out, ring->data + offset, first);
+    memcpy(out + first, ring->data, len - first);
+}
+
+void sr_ring_write(sr_ring_t *ring, const void *data, uint32_t len) {
+    const uint8_t *bytes = data;
+
+    // only the latest size bytes survive anyway
+    if (len > ring->size) {
+        bytes += len - ring->size;
+        len = ring->size;
+    }
+
+    uint32_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+
+    // the claim tells a concurrent reader which bytes are about to change
+    atomic_store_explicit(&ring->claimed, head + len, memory_order_relaxed);
+    atomic_thread_fence(memory_order_seq_cst);
+
+    ring_copy_in(ring, head, bytes, len);
+
+    atomic_store_explicit(&ring->head, head + len, memory_order_release);
+}
+
+uint32_t sr_ring_tail_for(sr_ring_t *ring, uint32_t len) {
+    uint32_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+    if (len > ring->size) {
+        len = ring->size;
+    }
+
+    // counters start at 0, early on there is less than len to read
+    return head < len ? 0 : head - len;
+}
+
+uint32_t sr_ring_read(sr_ring_t *ring, uint32_t *tail, void *out, uint32_t len) {
+    while (true) {
+        uint32_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+        uint32_t available = head - *tail;
+
+        if (available > ring->size) {
+            ring->overruns++;
+            *tail = head - ring->size;
+            available = ring->size;
+        }
+
+        uint32_t count = len < available ? len : available;
+        if (count == 0) {
+            return 0;
+        }
+
+        ring_copy_out(ring, *tail, out, count);
+
+        // the copy is only valid if the producer did not start overwriting it meanwhile
+        atomic_thread_fence(memory_order_seq_cst);
+        uint32_t claimed = atomic_load_explicit(&ring->claimed, memory_order_relaxed);
+        if (claimed - *tail <= ring->size) {
+            *tail += count;
+            return count;
+        }
+
+        ring->overruns++;
+        *tail = claimed - ring->size;
+    }
+}
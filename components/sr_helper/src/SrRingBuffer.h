@@ -0,0 +1,33 @@
+#pragma once
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "esp_err.h"
+
+// single producer / single consumer byte ring without locks, the producer never blocks
+// and overwrites the oldest bytes, so the ring always holds the latest size bytes
+
+typedef struct {
+    uint8_t *data;
+    uint32_t size;        // power of two
+    atomic_uint claimed;  // bytes the producer has started to write
+    atomic_uint head;     // bytes the producer has finished writing
+    uint32_t overruns;    // consumer reads that lost data to the producer
+} sr_ring_t;
+
+// size is rounded up to a power of two, caps selects internal RAM or PSRAM
+esp_err_t sr_ring_init(sr_ring_t *ring, uint32_t size, uint32_t caps);
+
+void sr_ring_free(sr_ring_t *ring);
+
+// producer side
+void sr_ring_write(sr_ring_t *ring, const void *data, uint32_t len);
+
+// position the consumer starts from to read the latest len bytes
+uint32_t sr_ring_tail_for(sr_ring_t *ring, uint32_t len);
+
+// consumer side, copies up to len bytes from *tail and advances it, returns the bytes copied.
+// a tail the producer already overwrote is moved up to the oldest byte still held
+uint32_t sr_ring_read(sr_ring_t *ring, uint32_t *tail, void *out, uint32_t len);
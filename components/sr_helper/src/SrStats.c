@@ -0,0 +1,222 @@
+#include "SrStats.h"
+
+#include <stdatomic.h>
+#include <string.h>
+
+#include "esp_attr.h"
+#include "esp_timer.h"
+
+static const char *TAG = "SR Stats";
+
+ESP_EVENT_DECLARE_BASE(SR_EVENT);
+
+typedef struct {
+    uint64_t busy_us;
+    uint32_t runtime_base;  // run time counter at the previous update
+    bool has_base;
+} sr_task_accounting_t;
+
+static sr_stats_t stats;
+static sr_task_accounting_t accounting[SR_TASK_COUNT];
+static int64_t window_start_us = 0;
+static int64_t afe_fed = 0;
+static int64_t afe_fetched = 0;
+static atomic_uint dma_overflows;
+static portMUX_TYPE stats_lock = portMUX_INITIALIZER_UNLOCKED;
+
+static esp_timer_handle_t stats_timer = NULL;
+
+uint32_t sr_stats_record(sr_stats_stage_t stage, int64_t start_us) {
+    int64_t elapsed = esp_timer_get_time() - start_us;
+    uint32_t duration_us = elapsed > UINT32_MAX ? UINT32_MAX : (uint32_t)elapsed;
+
+    portENTER_CRITICAL(&stats_lock);
+
+    sr_stats_timing_t *timing = &stats.stages[stage];
+    timing->count++;
+    timing->total_us += duration_us;
+    if (duration_us > timing->max_us) {
+        timing->max_us = duration_us;
+    }
+
+    portEXIT_CRITICAL(&stats_lock);
+
+    return duration_us;
+}
+
+void sr_stats_busy(sr_stats_task_t task, uint32_t duration_us) {
+#if !CONFIG_FREERTOS_GENERATE_RUN_TIME_STATS
+    portENTER_CRITICAL(&stats_lock);
+    accounting[task].busy_us += duration_us;
+    portEXIT_CRITICAL(&stats_lock);
+#endif
+}
+
+void sr_stats_i2s_stall() {
+    portENTER_CRITICAL(&stats_lock);
+    stats.i2s_stalls++;
+    portEXIT_CRITICAL(&stats_lock);
+}
+
+void sr_stats_missed_deadline() {
+    portENTER_CRITICAL(&stats_lock);
+    stats.missed_deadlines++;
+    portEXIT_CRITICAL(&stats_lock);
+}
+
+void IRAM_ATTR sr_stats_dma_overflow() {
+    atomic_fetch_add_explicit(&dma_overflows, 1, memory_order_relaxed);
+}
+
+// called with the lock held
+static void update_backlog() {
+    int64_t backlog = afe_fed - afe_fetched;
+    stats.afe_backlog_ms = backlog > 0 ? (uint32_t)(backlog * 1000 / SAMPLE_RATE) : 0;
+    if (stats.afe_backlog_ms > stats.afe_backlog_max_ms) {
+        stats.afe_backlog_max_ms = stats.afe_backlog_ms;
+    }
+}
+
+void sr_stats_afe_fed(int samples) {
+    portENTER_CRITICAL(&stats_lock);
+    afe_fed += samples;
+    update_backlog();
+    portEXIT_CRITICAL(&stats_lock);
+}
+
+void sr_stats_afe_fetched(int samples) {
+    portENTER_CRITICAL(&stats_lock);
+    afe_fetched += samples;
+    update_backlog();
+    portEXIT_CRITICAL(&stats_lock);
+}
+
+void sr_stats_afe_reset() {
+    portENTER_CRITICAL(&stats_lock);
+    afe_fed = 0;
+    afe_fetched = 0;
+    stats.afe_backlog_ms = 0;
+    portEXIT_CRITICAL(&stats_lock);
+}
+
+void sr_stats_task_update(sr_stats_task_t task) {
+    // on ESP-IDF the high-water mark is in bytes
+    uint32_t stack_free = uxTaskGetStackHighWaterMark(NULL);
+
+#if CONFIG_FREERTOS_GENERATE_RUN_TIME_STATS
+    uint32_t runtime = ulTaskGetRunTimeCounter(NULL);
+#endif
+
+    portENTER_CRITICAL(&stats_lock);
+
+    sr_stats_task_info_t *info = &stats.tasks[task];
+    if (!info->running || stack_free < info->stack_free_min) {
+        info->stack_free_min = stack_free;
+    }
+    info->running = true;
+
+#if CONFIG_FREERTOS_GENERATE_RUN_TIME_STATS
+    // the counter runs on esp_timer microseconds, the difference survives a wrap-around
+    sr_task_accounting_t *acc = &accounting[task];
+    if (acc->has_base) {
+        acc->busy_us += (uint32_t)(runtime - acc->runtime_base);
+    }
+    acc->runtime_base = runtime;
+    acc->has_base = true;
+#endif
+
+    portEXIT_CRITICAL(&stats_lock);
+}
+
+void sr_stats_task_exit(sr_stats_task_t task) {
+    sr_stats_task_update(task);
+
+    portENTER_CRITICAL(&stats_lock);
+    stats.tasks[task].running = false;
+    accounting[task].has_base = false;
+    portEXIT_CRITICAL(&stats_lock);
+}
+
+void sr_stats_snapshot(sr_stats_t *snapshot) {
+    int64_t now = esp_timer_get_time();
+
+    portENTER_CRITICAL(&stats_lock);
+
+    *snapshot = stats;
+    uint64_t window = window_start_us > 0 ? now - window_start_us : now;
+    for (int i = 0; i < SR_TASK_COUNT; i++) {
+        snapshot->tasks[i].load_permille = window > 0 ? (uint32_t)(accounting[i].busy_us * 1000 / window) : 0;
+    }
+
+    portEXIT_CRITICAL(&stats_lock);
+
+    snapshot->window_us = window;
+    snapshot->dma_overflows = atomic_load_explicit(&dma_overflows, memory_order_relaxed);
+}
+
+void sr_stats_reset() {
+    int64_t now = esp_timer_get_time();
+
+    portENTER_CRITICAL(&stats_lock);
+
+    // running tasks and their high-water marks carry over, a stack mark can not be reset
+    sr_stats_task_info_t tasks[SR_TASK_COUNT];
+    memcpy(tasks, stats.tasks, sizeof(tasks));
+    uint32_t backlog_ms = stats.afe_backlog_ms;
+
+    memset(&stats, 0, sizeof(stats));
+    memcpy(stats.tasks, tasks, sizeof(tasks));
+    stats.afe_backlog_ms = backlog_ms;
+    stats.afe_backlog_max_ms = backlog_ms;
+
+    for (int i = 0; i < SR_TASK_COUNT; i++) {
+        accounting[i].busy_us = 0;
+    }
+    window_start_us = now;
+
+    portEXIT_CRITICAL(&stats_lock);
+
+    atomic_store_explicit(&dma_overflows, 0, memory_order_relaxed);
+}
+
+// runs on the esp_timer task, the event loop copies the snapshot
+static void stats_timer_callback(void *arg) {
+    sr_stats_t snapshot;
+    sr_stats_snapshot(&snapshot);
+
+    if (esp_event_post(SR_EVENT, SR_STATS, &snapshot, sizeof(snapshot), 0) != ESP_OK) {
+        ESP_LOGD(TAG, "stats event dropped");
+    }
+}
+
+esp_err_t sr_stats_start(uint32_t period_ms) {
+    if (stats_timer != NULL) {
+        esp_timer_stop(stats_timer);
+        esp_timer_delete(stats_timer);
+        stats_timer = NULL;
+    }
+
+    if (period_ms == 0) {
+        return ESP_OK;
+    }
+
+    esp_timer_create_args_t args = {
+        .callback = stats_timer_callback,
+        .name = "sr_stats",
+    };
+
+    esp_err_t ret = esp_timer_create(&args, &stats_timer);
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to create stats timer: %s", esp_err_to_name(ret));
+        return ret;
+    }
+
+    ret = esp_timer_start_periodic(stats_timer, (uint64_t)period_ms * 1000);
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to start stats timer: %s", esp_err_to_name(ret));
+        esp_timer_delete(stats_timer);
+        stats_timer = NULL;
+    }
+
+    return ret;
+}
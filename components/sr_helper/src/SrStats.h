@@ -0,0 +1,28 @@
+#pragma once
+
+#include "SrHelper.h"
+
+// pipeline statistics collected by the SR tasks, read through sr_stats_snapshot
+
+// returns the duration since start_us
+uint32_t sr_stats_record(sr_stats_stage_t stage, int64_t start_us);
+
+// work done by a task, the load estimate without run time stats
+void sr_stats_busy(sr_stats_task_t task, uint32_t duration_us);
+
+void sr_stats_i2s_stall();
+void sr_stats_missed_deadline();
+
+// I2S driver ISR callback
+void sr_stats_dma_overflow();
+
+// AFE backlog, in samples per channel
+void sr_stats_afe_fed(int samples);
+void sr_stats_afe_fetched(int samples);
+void sr_stats_afe_reset();
+
+// called by the task itself every so often, samples its stack and run time
+void sr_stats_task_update(sr_stats_task_t task);
+
+// last update before the task deletes itself
+void sr_stats_task_exit(sr_stats_task_t task);
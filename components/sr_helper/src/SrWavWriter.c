@@ -0,0 +1,111 @@
+#include "SrHelper.h"
+
+#include <string.h>
+
+#include "SdCardHelper.h"
+#include "SrEncoder.h"
+
+static const char *TAG = "SR Wav";
+
+struct sr_wav_writer_t {
+    sdcard_writer_file_handle file;
+    uint32_t data_size;  // PCM bytes appended so far
+    bool failed;
+    sr_encoder_t encoder;
+};
+
+// encoder output goes to the write-behind task, the recording never waits on the card
+static bool append(void *ctx, const uint8_t *data, uint32_t len) {
+    sr_wav_writer_handle_t writer = ctx;
+
+    return sdcard_writer_write(writer->file, data, len) == ESP_OK;
+}
+
+sr_wav_writer_handle_t sr_wav_open(const char *path, uint32_t block_size) {
+    return sr_wav_open_encoded(path, block_size, (sr_encoder_config_t)SR_ENCODER_CONFIG_DEFAULT());
+}
+
+sr_wav_writer_handle_t sr_wav_open_encoded(const char *path, uint32_t block_size, sr_encoder_config_t encoder) {
+    // the first writer starts the SD writer task, with block_size or the card's allocation unit as its cluster
+    sdcard_writer_config config = SDCARD_WRITER_CONFIG_DEFAULT();
+    config.cluster_size = block_size;
+    sdcard_writer_init(config);
+
+    sr_wav_writer_handle_t writer = calloc(1, sizeof(struct sr_wav_writer_t));
+    if (!writer) {
+        ESP_LOGE(TAG, "Failed to allocate writer");
+        return NULL;
+    }
+
+    writer->file = sdcard_writer_open(path, "wb");
+    if (!writer->file) {
+        ESP_LOGE(TAG, "Failed to open file %s for writing", path);
+        free(writer);
+        return NULL;
+    }
+
+    sr_encoder_init(&writer->encoder, encoder, sr_recording_sample_rate());
+
+    // placeholder header, the sizes are patched on close. it shares the first cluster
+    // with the audio, so every write after it ends on an allocation unit boundary
+    uint32_t header_size = sr_encoder_header_size(&writer->encoder);
+    if (header_size > 0) {
+        uint8_t header[64];
+        sr_encoder_header(&writer->encoder, header);
+        writer->failed = !append(writer, header, header_size);
+    }
+
+    return writer;
+}
+
+esp_err_t sr_wav_write(sr_wav_writer_handle_t writer, const void *pcm, uint32_t len) {
+    if (!writer || (!pcm && len > 0)) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (writer->failed) {
+        return ESP_FAIL;
+    }
+
+    writer->data_size += len;
+
+    if (!sr_encoder_write(&writer->encoder, pcm, len, append, writer)) {
+        writer->failed = true;
+        return ESP_FAIL;
+    }
+
+    return ESP_OK;
+}
+
+uint32_t sr_wav_size(sr_wav_writer_handle_t writer) {
+    return writer ? writer->data_size : 0;
+}
+
+esp_err_t sr_wav_close(sr_wav_writer_handle_t writer) {
+    if (!writer) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    bool ok = !writer->failed && sr_encoder_finish(&writer->encoder, append, writer);
+
+    uint32_t header_size = sr_encoder_header_size(&writer->encoder);
+    if (ok && header_size > 0) {
+        uint8_t header[64];
+        sr_encoder_header(&writer->encoder, header);
+
+        ok = sdcard_writer_write_at(writer->file, 0, header, header_size) == ESP_OK;
+        if (!ok) {
+            ESP_LOGE(TAG, "Failed to patch WAV header");
+        }
+    }
+
+    // the recording is over, waiting for the card here no longer holds up any audio
+    ok = sdcard_writer_flush(writer->file) == ESP_OK && ok;
+    ok = sdcard_writer_close(writer->file) == ESP_OK && ok;
+
+    ESP_LOGI(TAG, "WAV closed, %ld bytes of audio encoded to %ld%s", (long)writer->data_size,
+             (long)writer->encoder.data_size, ok ? "" : ", write failed");
+
+    free(writer);
+
+    return ok ? ESP_OK : ESP_FAIL;
+}
@@ -0,0 +1,38 @@
+#pragma once
+
+#include <stdio.h>
+#include <string.h>
+
+// minimal checks for the host tests, each test binary returns the number of failed checks
+
+static int host_test_failures = 0;
+
+#define CHECK(cond)                                                          \
+    do {                                                                     \
+        if (!(cond)) {                                                       \
+            fprintf(stderr, "%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #cond); \
+            host_test_failures++;                                            \
+        }                                                                    \
+    } while (0)
+
+#define CHECK_EQ_INT(expected, actual)                                                             \
+    do {                                                                                           \
+        long long e_ = (long long)(expected);                                                      \
+        long long a_ = (long long)(actual);                                                        \
+        if (e_ != a_) {                                                                            \
+            fprintf(stderr, "%s:%d: expected %s == %lld, got %lld\n", __FILE__, __LINE__, #actual, e_, a_); \
+            host_test_failures++;                                                                  \
+        }                                                                                          \
+    } while (0)
+
+#define CHECK_EQ_STR(expected, actual)                                                                  \
+    do {                                                                                                \
+        if (strcmp((expected), (actual)) != 0) {                                                        \
+            fprintf(stderr, "%s:%d: expected %s == \"%s\", got \"%s\"\n", __FILE__, __LINE__, #actual, (expected), (actual)); \
+            host_test_failures++;                                                                       \
+        }                                                                                               \
+    } while (0)
+
+#define HOST_TEST_RESULT()                                                   \
+    (host_test_failures == 0 ? (printf("OK\n"), 0)                           \
+                             : (printf("%d check(s) failed\n", host_test_failures), 1))
@@ -0,0 +1,9 @@
+#pragma once
+
+#include <stdio.h>
+
+// errors are printed so an unexpected failure shows up in the test output
+#define ESP_LOGE(tag, fmt, ...) fprintf(stderr, "E %s" fmt "\n", tag, ##__VA_ARGS__)
+#define ESP_LOGW(tag, fmt, ...) fprintf(stderr, "W %s" fmt "\n", tag, ##__VA_ARGS__)
+#define ESP_LOGI(tag, fmt, ...) ((void)(tag))
+#define ESP_LOGD(tag, fmt, ...) ((void)(tag))
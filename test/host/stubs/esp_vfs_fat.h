@@ -0,0 +1,7 @@
+#pragma once
+
+// the real header brings in esp_log.h and the POSIX file calls
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "esp_log.h"
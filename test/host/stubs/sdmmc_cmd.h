@@ -0,0 +1,26 @@
+#pragma once
+
+#include <stdint.h>
+
+// only the types SdCardHelper.h embeds, the host tests never talk to a card
+typedef struct {
+    int slot;
+    int max_freq_khz;
+} sdmmc_host_t;
+
+typedef struct {
+    int mfg_id;
+    int oem_id;
+    char name[8];
+} sdmmc_cid_t;
+
+typedef struct {
+    int capacity;
+    int sector_size;
+} sdmmc_csd_t;
+
+typedef struct {
+    sdmmc_host_t host;
+    sdmmc_cid_t cid;
+    sdmmc_csd_t csd;
+} sdmmc_card_t;
@@ -0,0 +1,156 @@
+#include "SdCardInternal.h"
+#include "host_test.h"
+
+// SdCardPath.c also holds the replace helpers, their stdio wrappers are never reached here
+FILE *sdcard_io_open(const char *path, const char *mode) {
+    return NULL;
+}
+
+size_t sdcard_io_write(const void *data, size_t len, FILE *file) {
+    return 0;
+}
+
+int sdcard_io_sync(FILE *file) {
+    return -1;
+}
+
+int sdcard_io_rename(const char *from, const char *to) {
+    return -1;
+}
+
+static SdCard card_at(const char *mount_point) {
+    SdCard card = {0};
+    strncpy(card.config.mount_point, mount_point, sizeof(card.config.mount_point) - 1);
+    return card;
+}
+
+// --------------------- sdcard_path ----------------------------------------
+static void test_path_joins_mount_point() {
+    SdCard card = card_at("/sdcard");
+    char path[SDCARD_PATH_MAX];
+
+    CHECK_EQ_INT(ESP_OK, sdcard_path(&card, "data.bin", path, sizeof(path)));
+    CHECK_EQ_STR("/sdcard/data.bin", path);
+
+    // a leading separator is not doubled
+    CHECK_EQ_INT(ESP_OK, sdcard_path(&card, "/logs/today.txt", path, sizeof(path)));
+    CHECK_EQ_STR("/sdcard/logs/today.txt", path);
+}
+
+static void test_path_refuses_truncation() {
+    SdCard card = card_at("/sdcard");
+    char path[17];
+
+    // "/sdcard/data.bin" is 16 characters, exactly fits with its terminator
+    CHECK_EQ_INT(ESP_OK, sdcard_path(&card, "data.bin", path, 17));
+    CHECK_EQ_STR("/sdcard/data.bin", path);
+
+    // one byte short is refused and leaves an empty string, never a cut path
+    CHECK_EQ_INT(ESP_ERR_INVALID_SIZE, sdcard_path(&card, "data.bin", path, 16));
+    CHECK_EQ_STR("", path);
+}
+
+static void test_path_bound_at_max() {
+    SdCard card = card_at("/sdcard");
+    char relative[SDCARD_PATH_MAX];
+    char path[SDCARD_PATH_MAX];
+
+    // "/sdcard/" plus the relative part fills SDCARD_PATH_MAX - 1 characters
+    size_t fit = SDCARD_PATH_MAX - 1 - strlen("/sdcard/");
+    memset(relative, 'a', fit);
+    relative[fit] = '\0';
+
+    CHECK_EQ_INT(ESP_OK, sdcard_path(&card, relative, path, sizeof(path)));
+    CHECK_EQ_INT(SDCARD_PATH_MAX - 1, strlen(path));
+
+    relative[fit] = 'a';
+    relative[fit + 1] = '\0';
+
+    CHECK_EQ_INT(ESP_ERR_INVALID_SIZE, sdcard_path(&card, relative, path, sizeof(path)));
+    CHECK_EQ_STR("", path);
+}
+
+static void test_path_invalid_args() {
+    SdCard card = card_at("/sdcard");
+    char path[SDCARD_PATH_MAX];
+
+    CHECK_EQ_INT(ESP_ERR_INVALID_ARG, sdcard_path(NULL, "data.bin", path, sizeof(path)));
+    CHECK_EQ_INT(ESP_ERR_INVALID_ARG, sdcard_path(&card, NULL, path, sizeof(path)));
+    CHECK_EQ_INT(ESP_ERR_INVALID_ARG, sdcard_path(&card, "data.bin", NULL, sizeof(path)));
+    CHECK_EQ_INT(ESP_ERR_INVALID_ARG, sdcard_path(&card, "data.bin", path, 0));
+}
+
+// --------------------- sdcard_path_swap_ext ----------------------------------------
+static void test_swap_ext_replaces_extension() {
+    char out[SDCARD_PATH_MAX];
+
+    CHECK_EQ_INT(ESP_OK, sdcard_path_swap_ext("/sdcard/data.bin", "tmp", out, sizeof(out)));
+    CHECK_EQ_STR("/sdcard/data.tmp", out);
+
+    // an 8.3 name stays 8.3, the base name is kept whole
+    CHECK_EQ_INT(ESP_OK, sdcard_path_swap_ext("/sdcard/RECORD01.WAV", "new", out, sizeof(out)));
+    CHECK_EQ_STR("/sdcard/RECORD01.new", out);
+
+    // only the last extension of the name is swapped
+    CHECK_EQ_INT(ESP_OK, sdcard_path_swap_ext("/sdcard/a.b.c", "tmp", out, sizeof(out)));
+    CHECK_EQ_STR("/sdcard/a.b.tmp", out);
+}
+
+static void test_swap_ext_without_extension() {
+    char out[SDCARD_PATH_MAX];
+
+    CHECK_EQ_INT(ESP_OK, sdcard_path_swap_ext("/sdcard/data", "tmp", out, sizeof(out)));
+    CHECK_EQ_STR("/sdcard/data.tmp", out);
+
+    // a dot in a directory is not the extension of the file
+    CHECK_EQ_INT(ESP_OK, sdcard_path_swap_ext("/sdcard/v1.2/data", "tmp", out, sizeof(out)));
+    CHECK_EQ_STR("/sdcard/v1.2/data.tmp", out);
+
+    CHECK_EQ_INT(ESP_OK, sdcard_path_swap_ext("data", "tmp", out, sizeof(out)));
+    CHECK_EQ_STR("data.tmp", out);
+}
+
+static void test_swap_ext_refuses_same_extension() {
+    char out[SDCARD_PATH_MAX];
+
+    // the temp file would be the file itself
+    CHECK_EQ_INT(ESP_ERR_INVALID_ARG, sdcard_path_swap_ext("/sdcard/data.tmp", "tmp", out, sizeof(out)));
+
+    // FAT names are case insensitive
+    CHECK_EQ_INT(ESP_ERR_INVALID_ARG, sdcard_path_swap_ext("/sdcard/DATA.TMP", "tmp", out, sizeof(out)));
+    CHECK_EQ_INT(ESP_ERR_INVALID_ARG, sdcard_path_swap_ext("/sdcard/data.new", "new", out, sizeof(out)));
+}
+
+static void test_swap_ext_refuses_truncation() {
+    char out[SDCARD_PATH_MAX];
+
+    // "/sdcard/data.tmp" is 16 characters
+    CHECK_EQ_INT(ESP_OK, sdcard_path_swap_ext("/sdcard/data.bin", "tmp", out, 17));
+    CHECK_EQ_STR("/sdcard/data.tmp", out);
+
+    CHECK_EQ_INT(ESP_ERR_INVALID_SIZE, sdcard_path_swap_ext("/sdcard/data.bin", "tmp", out, 16));
+    CHECK_EQ_STR("", out);
+
+    // a path at the bound without an extension has no room left for one
+    char path[SDCARD_PATH_MAX];
+    memset(path, 'a', SDCARD_PATH_MAX - 1);
+    path[0] = '/';
+    path[SDCARD_PATH_MAX - 1] = '\0';
+
+    CHECK_EQ_INT(ESP_ERR_INVALID_SIZE, sdcard_path_swap_ext(path, "tmp", out, sizeof(out)));
+    CHECK_EQ_STR("", out);
+}
+
+int main() {
+    test_path_joins_mount_point();
+    test_path_refuses_truncation();
+    test_path_bound_at_max();
+    test_path_invalid_args();
+
+    test_swap_ext_replaces_extension();
+    test_swap_ext_without_extension();
+    test_swap_ext_refuses_same_extension();
+    test_swap_ext_refuses_truncation();
+
+    return HOST_TEST_RESULT();
+}
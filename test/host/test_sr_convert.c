@@ -0,0 +1,98 @@
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "SrConvert.h"
+#include "host_test.h"
+
+#define SAMPLES_MAX 67
+
+// full range I2S slots, with the extremes placed where the unrolled loop and its tail both see them
+static void fill_samples(int32_t *samples, int count, unsigned seed) {
+    srand(seed);
+    for (int i = 0; i < count; i++) {
+        samples[i] = (int32_t)(((uint32_t)rand() << 16) ^ (uint32_t)rand() ^ ((uint32_t)rand() << 31));
+    }
+
+    const int32_t extremes[] = {INT32_MIN, INT32_MAX, 0, -1, INT16_MAX, INT16_MIN, INT16_MAX + 1, INT16_MIN - 1};
+    for (int i = 0; i < (int)(sizeof(extremes) / sizeof(extremes[0])) && i < count; i++) {
+        samples[(i * 5) % count] = extremes[i];
+    }
+    if (count > 0) {
+        samples[count - 1] = INT32_MIN;
+    }
+}
+
+// the unrolled kernel matches the per sample loop for every shift, both modes and any tail length
+static void test_convert_matches_reference() {
+    int32_t reference[SAMPLES_MAX];
+    int32_t converted[SAMPLES_MAX];
+
+    const int counts[] = {0, 1, 2, 3, 4, 5, 7, 8, 13, 64, 66, SAMPLES_MAX};
+
+    for (int saturate = 0; saturate <= 1; saturate++) {
+        for (int shift = 0; shift <= 31; shift++) {
+            for (int c = 0; c < (int)(sizeof(counts) / sizeof(counts[0])); c++) {
+                int count = counts[c];
+                fill_samples(reference, count, shift * 131 + count);
+                memcpy(converted, reference, sizeof(reference));
+
+                sr_convert_samples_reference(reference, count, shift, saturate);
+                sr_convert_samples(converted, count, shift, saturate);
+
+                if (memcmp(reference, converted, count * sizeof(int32_t)) != 0) {
+                    fprintf(stderr, "mismatch at shift %d, saturate %d, count %d\n", shift, saturate, count);
+                    host_test_failures++;
+                }
+            }
+        }
+    }
+}
+
+// samples past count are left alone
+static void test_convert_stays_in_bounds() {
+    int32_t samples[8];
+    for (int i = 0; i < 8; i++) {
+        samples[i] = INT32_MAX;
+    }
+
+    sr_convert_samples(samples, 5, 8, true);
+
+    CHECK_EQ_INT(INT16_MAX, samples[4]);
+    CHECK_EQ_INT(INT32_MAX, samples[5]);
+    CHECK_EQ_INT(INT32_MAX, samples[7]);
+}
+
+static void test_convert_saturates() {
+    int32_t samples[] = {INT32_MAX, INT32_MIN, 0x00012345, -0x00012345, 0x7fff, -0x8000};
+
+    sr_convert_samples(samples, 6, 0, true);
+
+    CHECK_EQ_INT(INT16_MAX, samples[0]);
+    CHECK_EQ_INT(INT16_MIN, samples[1]);
+    CHECK_EQ_INT(INT16_MAX, samples[2]);
+    CHECK_EQ_INT(INT16_MIN, samples[3]);
+    CHECK_EQ_INT(0x7fff, samples[4]);
+    CHECK_EQ_INT(-0x8000, samples[5]);
+}
+
+static void test_expand_samples16() {
+    int32_t slots[5];
+    int16_t *packed = (int16_t *)slots;
+    const int16_t values[] = {1, -1, INT16_MAX, INT16_MIN, 1234};
+    memcpy(packed, values, sizeof(values));
+
+    sr_expand_samples16(slots, 5);
+
+    for (int i = 0; i < 5; i++) {
+        CHECK_EQ_INT(values[i], slots[i]);
+    }
+}
+
+int main() {
+    test_convert_matches_reference();
+    test_convert_stays_in_bounds();
+    test_convert_saturates();
+    test_expand_samples16();
+
+    return HOST_TEST_RESULT();
+}